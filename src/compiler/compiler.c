@@ -21,6 +21,8 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include <fpvm/fpvm.h>
@@ -34,57 +36,616 @@
 #include "parser_helper.h"
 #include "parser.h"
 #include "compiler.h"
+#ifdef WITH_SOFTPFPU
+#include "../renderer/vpfpu.h"
+#endif
 
 #include "infra-fnp.h"
 
+#define REPORT_LEN	512
+
 static void comp_report(struct compiler_sc *sc, const char *format, ...)
 {
 	va_list args;
 	int len;
-	char outbuf[512];
+	char outbuf[REPORT_LEN];
 
 	va_start(args, format);
 	len = vsnprintf(outbuf, sizeof(outbuf), format, args);
 	va_end(args);
-	sc->rmc(outbuf);
+	sc->rmc(sc->rmc_arg, outbuf);
+}
+
+/* 0 unless statistics are requested */
+static unsigned long long now(const struct compiler_sc *sc)
+{
+	struct timespec ts;
+
+	if(sc->stats == NULL)
+		return 0;
+#ifdef STANDALONE
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	rtems_clock_get_uptime(&ts);
+#endif
+	return ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+/* adds the time since start to phase */
+static void account(struct compiler_sc *sc, int phase,
+    unsigned long long start)
+{
+	if(sc->stats)
+		sc->stats->ns[phase] += now(sc)-start;
+}
+
+/* time spent in FPVM assignments so far, to subtract from parsing */
+static unsigned long long assign_time(const struct compiler_sc *sc)
+{
+	return sc->stats ? sc->stats->ns[COMP_PHASE_ASSIGN] : 0;
+}
+
+static void account_parse(struct compiler_sc *sc, unsigned long long start,
+    unsigned long long assigned)
+{
+	account(sc, COMP_PHASE_PARSE, start+(assign_time(sc)-assigned));
+}
+
+static int do_assign(struct compiler_sc *sc, struct fpvm_fragment *fragment,
+    struct sym *sym, struct ast_node *node)
+{
+	unsigned long long t = now(sc);
+	int r;
+
+	r = fpvm_do_assign(fragment, &sym->fpvm_sym, node);
+	account(sc, COMP_PHASE_ASSIGN, t);
+	if(sc->stats)
+		sc->stats->assignments++;
+	return r;
+}
+
+/*
+ * The schedulers of libfpvm are not reentrant. On the board, the lock is a
+ * semaphore, like the other locks of the firmware, see compiler_init.
+ */
+#ifdef STANDALONE
+
+static pthread_mutex_t schedule_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void schedule_lock_obtain(void)
+{
+	pthread_mutex_lock(&schedule_lock);
+}
+
+static void schedule_lock_release(void)
+{
+	pthread_mutex_unlock(&schedule_lock);
+}
+
+#else /* STANDALONE */
+
+static rtems_id schedule_lock;
+
+void compiler_init(void)
+{
+	rtems_status_code sc;
+
+	sc = rtems_semaphore_create(
+		rtems_build_name('S', 'C', 'H', 'D'),
+		1,
+		RTEMS_SIMPLE_BINARY_SEMAPHORE,
+		0,
+		&schedule_lock);
+	assert(sc == RTEMS_SUCCESSFUL);
+}
+
+static void schedule_lock_obtain(void)
+{
+	rtems_semaphore_obtain(schedule_lock, RTEMS_WAIT, RTEMS_NO_TIMEOUT);
+}
+
+static void schedule_lock_release(void)
+{
+	rtems_semaphore_release(schedule_lock);
+}
+
+#endif /* !STANDALONE */
+
+static int schedule(struct compiler_sc *sc, struct fpvm_fragment *fragment,
+    unsigned int *code, unsigned int *registers)
+{
+	unsigned long long t;
+	int r;
+
+	schedule_lock_obtain();
+	t = now(sc);
+	r = fpvm_default_schedule(fragment, code, registers);
+	account(sc, COMP_PHASE_SCHEDULE, t);
+	schedule_lock_release();
+	return r;
+}
+
+/*
+ * When the code doesn't fit the PFPU, we point at the equations that cost
+ * the most: the operations they add to the program, and the registers their
+ * evaluation needs (Sethi-Ullman, with a register for each leaf).
+ */
+
+#define UNSCHEDULED_WORST	3
+
+static int node_ops(const struct ast_node *n)
+{
+	if(n == NULL || !node_is_op(n))
+		return 0;
+	return 1+node_ops(n->contents.branches.a)
+	    +node_ops(n->contents.branches.b)
+	    +node_ops(n->contents.branches.c);
+}
+
+static int node_regs(const struct ast_node *n)
+{
+	int r[3], i, j, tmp, need;
+
+	if(n == NULL)
+		return 0;
+	if(!node_is_op(n))
+		return 1;
+	r[0] = node_regs(n->contents.branches.a);
+	r[1] = node_regs(n->contents.branches.b);
+	r[2] = node_regs(n->contents.branches.c);
+	/* the operand needing the most registers is evaluated first */
+	for(i=0;i<3;i++)
+		for(j=i+1;j<3;j++)
+			if(r[j] > r[i]) {
+				tmp = r[i];
+				r[i] = r[j];
+				r[j] = tmp;
+			}
+	need = r[0];
+	for(i=1;i<3;i++)
+		if(r[i] && r[i]+i > need)
+			need = r[i]+i;
+	return need;
+}
+
+static bool costs_more(int ops, int regs, int worst_ops, int worst_regs)
+{
+	return ops > worst_ops || (ops == worst_ops && regs > worst_regs);
+}
+
+static void report_unscheduled(struct compiler_sc *sc, const char *fragment,
+    const struct equations *eqs)
+{
+	const struct equation *eq, *worst[UNSCHEDULED_WORST];
+	int ops[UNSCHEDULED_WORST], regs[UNSCHEDULED_WORST];
+	int n_worst = 0, n_eqs = 0, total = 0;
+	int eq_ops, eq_regs, i, j;
+	char buf[REPORT_LEN];
+	int len;
+
+	for(eq = eqs->head; eq; eq = eq->next) {
+		eq_ops = node_ops(eq->node);
+		eq_regs = node_regs(eq->node);
+		n_eqs++;
+		total += eq_ops;
+		/* copies are not worth pointing at */
+		if(!eq_ops)
+			continue;
+		for(i=0;i<n_worst;i++)
+			if(costs_more(eq_ops, eq_regs, ops[i], regs[i]))
+				break;
+		if(i == UNSCHEDULED_WORST)
+			continue;
+		if(n_worst < UNSCHEDULED_WORST)
+			n_worst++;
+		for(j=n_worst-1;j>i;j--) {
+			worst[j] = worst[j-1];
+			ops[j] = ops[j-1];
+			regs[j] = regs[j-1];
+		}
+		worst[i] = eq;
+		ops[i] = eq_ops;
+		regs[i] = eq_regs;
+	}
+
+	len = snprintf(buf, sizeof(buf), "%s VLIW scheduling failed",
+	    fragment);
+	/* without the optimizations, there are no equations to look at */
+	if(n_eqs)
+		len += snprintf(buf+len, sizeof(buf)-len,
+		    ": %d operations in %d equations, largest:", total, n_eqs);
+	for(i=0;i<n_worst && len < (int) sizeof(buf);i++) {
+		if(worst[i]->lineno)
+			len += snprintf(buf+len, sizeof(buf)-len,
+			    "%s line %d", i ? "," : "", worst[i]->lineno);
+		else
+			len += snprintf(buf+len, sizeof(buf)-len, "%s %s",
+			    i ? "," : "", worst[i]->sym->fpvm_sym.name);
+		if(len < (int) sizeof(buf))
+			len += snprintf(buf+len, sizeof(buf)-len,
+			    " (%d operations, %d registers)", ops[i], regs[i]);
+	}
+
+	if(sc->unscheduled)
+		strcpy(sc->unscheduled, buf);
+	else
+		sc->rmc(sc->rmc_arg, buf);
 }
 
-void init_fpvm(struct fpvm_fragment *fragment, int vector_mode)
+void init_fpvm(struct symtab *st, struct fpvm_fragment *fragment,
+    int vector_mode)
 {
 	/*
 	 * We need to pass these through unique() because the parser does
 	 * the same. We can get rid of these calls to unique() later.
+	 * They are well-known symbols, the same for all compilations.
 	 */
 
-	_Xi = &unique("_Xi")->fpvm_sym;
-	_Xo = &unique("_Xo")->fpvm_sym;
-	_Yi = &unique("_Yi")->fpvm_sym;
-	_Yo = &unique("_Yo")->fpvm_sym;
+	_Xi = &unique(st, "_Xi")->fpvm_sym;
+	_Xo = &unique(st, "_Xo")->fpvm_sym;
+	_Yi = &unique(st, "_Yi")->fpvm_sym;
+	_Yo = &unique(st, "_Yo")->fpvm_sym;
 	fpvm_do_init(fragment, vector_mode);
 }
 
-/* ----- Compilation of internal per-fragment setup code ------------------- */
+/* the optimizations that work on all the equations of a fragment */
+#define COMP_EQUATIONS	(COMP_SIMPLIFY | COMP_CSE | COMP_DCE)
 
+/* ----- Per-frame invariants of the per-vertex code ----------------------- */
 
-static const char *assign_chunk(struct parser_comm *comm,
-    struct sym *sym, struct ast_node *node)
+
+/*
+ * Many per-vertex expressions only depend on constants and on per-frame
+ * variables copied to the per-vertex code by transfer_pvv_regs, e.g., 1/zoom
+ * or cos(rot) in the framework, and are the same for all vertices. With
+ * COMP_HOIST, the largest such expressions are computed once, at the end of
+ * the per-frame code, into temporaries that transfer_pvv_regs then copies
+ * along (see struct patch).
+ *
+ * A variable assigned such a value in the per-vertex code is invariant too,
+ * until it is assigned something else. For each variable assigned in the
+ * per-vertex code so far, pvv_values holds the leaf (constant or invariant
+ * variable) that stands for its value in the per-frame code, or NULL if the
+ * value depends on the vertex.
+ */
+
+#define PVV_VALUES_CHUNK	32
+
+struct pvv_value {
+	const struct sym *sym;
+	struct ast_node *value;
+};
+
+static struct pvv_value *pvv_value(struct compiler_sc *sc,
+    const struct sym *sym)
+{
+	int i;
+
+	for(i=0;i<sc->n_pvv_values;i++)
+		if(sc->pvv_values[i].sym == sym)
+			return sc->pvv_values+i;
+	return NULL;
+}
+
+/* -1 if sym is not a temporary */
+static int hoisted_index(struct compiler_sc *sc, const struct sym *sym)
+{
+	int i;
+
+	for(i=0;i<sc->p->n_hoisted;i++)
+		if(sc->hoisted[i] == sym)
+			return i;
+	return -1;
+}
+
+/* the leaf in terms of the per-frame code, NULL if it depends on the vertex */
+static const struct ast_node *invariant_leaf(struct compiler_sc *sc,
+    const struct ast_node *n)
 {
-	if(fpvm_do_assign(comm->u.fragment, &sym->fpvm_sym, node))
+	const struct sym *sym;
+	const struct pvv_value *v;
+
+	if(n->op == op_constant)
+		return n;
+	sym = FPVM2SYM(n->sym);
+	if(hoisted_index(sc, sym) >= 0)
+		return n;
+	v = pvv_value(sc, sym);
+	if(v != NULL)
+		return v->value;
+	if(sym->pfv_idx < 0 || sym->pvv_idx < 0)
+		return NULL;
+	/* control variables are also written in the per-vertex regf */
+	if(sym_var(sc->symtab, sym)->stim != NULL)
+		return NULL;
+	return n;
+}
+
+static struct ast_node *per_frame_copy(struct compiler_sc *sc,
+    const struct ast_node *n)
+{
+	struct ast_node *copy;
+
+	if(n == NULL)
+		return NULL;
+	copy = malloc(sizeof(struct ast_node));
+	if(node_is_op(n)) {
+		*copy = *n;
+		copy->contents.branches.a =
+		    per_frame_copy(sc, n->contents.branches.a);
+		copy->contents.branches.b =
+		    per_frame_copy(sc, n->contents.branches.b);
+		copy->contents.branches.c =
+		    per_frame_copy(sc, n->contents.branches.c);
+	} else
+		*copy = *invariant_leaf(sc, n);
+	return copy;
+}
+
+static bool same_ast(const struct ast_node *a, const struct ast_node *b)
+{
+	if(a == NULL || b == NULL)
+		return a == b;
+	if(a->op != b->op)
+		return false;
+	switch(a->op) {
+	case op_constant:
+		/* 0 and -0 are not the same */
+		return !memcmp(&a->contents.constant, &b->contents.constant,
+		    sizeof(float));
+	case op_ident:
+		return a->sym == b->sym;
+	default:
+		return same_ast(a->contents.branches.a,
+		    b->contents.branches.a) &&
+		    same_ast(a->contents.branches.b,
+		    b->contents.branches.b) &&
+		    same_ast(a->contents.branches.c,
+		    b->contents.branches.c);
+	}
+}
+
+/* replaces the invariant expression n by a temporary, if there's room */
+static void hoist_node(struct compiler_sc *sc, struct ast_node *n)
+{
+	struct patch *p = sc->p;
+	struct ast_node *expr;
+	char name[16];
+	int i;
+
+	expr = per_frame_copy(sc, n);
+	for(i=0;i<p->n_hoisted;i++)
+		if(same_ast(sc->hoisted_ast[i], expr))
+			break;
+	if(i != p->n_hoisted)
+		parse_free(expr);
+	else if(i == COMP_HOIST_MAX) {
+		parse_free(expr);
+		return;
+	} else {
+		/* not a name the scanner can produce */
+		sprintf(name, "%%h%d", i);
+		sc->hoisted[i] = unique(sc->symtab, name);
+		sc->hoisted_ast[i] = expr;
+		p->n_hoisted++;
+	}
+	parse_free(n->contents.branches.a);
+	parse_free(n->contents.branches.b);
+	parse_free(n->contents.branches.c);
+	n->op = op_ident;
+	n->sym = &sc->hoisted[i]->fpvm_sym;
+}
+
+/*
+ * Returns whether n is invariant. If it isn't, its invariant operands are
+ * hoisted.
+ */
+static bool hoist_operands(struct compiler_sc *sc, struct ast_node *n)
+{
+	struct ast_node *op[3];
+	bool inv[3], all = true;
+	int i;
+
+	if(!node_is_op(n))
+		return invariant_leaf(sc, n) != NULL;
+	op[0] = n->contents.branches.a;
+	op[1] = n->contents.branches.b;
+	op[2] = n->contents.branches.c;
+	for(i=0;i<3;i++) {
+		inv[i] = op[i] == NULL || hoist_operands(sc, op[i]);
+		all = all && inv[i];
+	}
+	if(all)
+		return true;
+	for(i=0;i<3;i++)
+		if(op[i] != NULL && inv[i] && node_is_op(op[i]))
+			hoist_node(sc, op[i]);
+	return false;
+}
+
+/* hoists the invariants of the per-vertex assignment sym = node */
+static void hoist(struct compiler_sc *sc, const struct sym *sym,
+    struct ast_node *node)
+{
+	struct ast_node *value = NULL;
+	struct pvv_value *v;
+
+	if(hoist_operands(sc, node) && node_is_op(node))
+		hoist_node(sc, node);
+	if(!node_is_op(node) && invariant_leaf(sc, node) != NULL)
+		value = per_frame_copy(sc, node);
+
+	v = pvv_value(sc, sym);
+	if(v == NULL) {
+		if(!(sc->n_pvv_values % PVV_VALUES_CHUNK))
+			sc->pvv_values = realloc(sc->pvv_values,
+			    (sc->n_pvv_values+PVV_VALUES_CHUNK)
+			    *sizeof(struct pvv_value));
+		v = sc->pvv_values+sc->n_pvv_values++;
+		v->sym = sym;
+	} else
+		free(v->value);
+	v->value = value;
+}
+
+static bool assign_hoisted(struct compiler_sc *sc)
+{
+	int i;
+
+	for(i=0;i<sc->p->n_hoisted;i++) {
+		if(sc->flags & COMP_EQUATIONS) {
+			equations_add(&sc->pfv_eqs, sc->hoisted[i],
+			    sc->hoisted_ast[i], 0);
+			sc->hoisted_ast[i] = NULL;
+		} else if(!do_assign(sc, &sc->pfv_fragment,
+		    sc->hoisted[i], sc->hoisted_ast[i]))
+			return false;
+	}
+	return true;
+}
+
+static void free_hoisted(struct compiler_sc *sc)
+{
+	int i;
+
+	for(i=0;i<sc->p->n_hoisted;i++)
+		parse_free(sc->hoisted_ast[i]);
+	for(i=0;i<sc->n_pvv_values;i++)
+		free(sc->pvv_values[i].value);
+	free(sc->pvv_values);
+}
+
+
+/* ----- Assignments ------------------------------------------------------- */
+
+
+static struct equations *fragment_equations(struct compiler_sc *sc,
+    struct fpvm_fragment *frag)
+{
+	return frag == &sc->pfv_fragment ? &sc->pfv_eqs : &sc->pvv_eqs;
+}
+
+static void set_bind_mode(struct compiler_sc *sc,
+    struct fpvm_fragment *frag, int mode)
+{
+	fpvm_set_bind_mode(frag, mode);
+	fragment_equations(sc, frag)->bind_mode = mode;
+}
+
+static const char *assign_fragment(struct compiler_sc *sc,
+    struct fpvm_fragment *frag, struct sym *sym, struct ast_node *node,
+    int lineno)
+{
+	struct ast_node *root;
+
+	if(frag == &sc->pfv_fragment && sym->pfv_idx >= 0)
+		sc->pfv_writes[sym->pfv_idx]++;
+	if(sc->flags & COMP_EQUATIONS) {
+		/*
+		 * The parser frees node when we return. We take its operands
+		 * and leave it a constant, which parse_free frees alone.
+		 */
+		root = malloc(sizeof(struct ast_node));
+		*root = *node;
+		node->op = op_constant;
+		equations_add(fragment_equations(sc, frag), sym, root, lineno);
+		return NULL;
+	}
+	if(do_assign(sc, frag, sym, node))
 		return NULL;
 	else
-		return strdup(fpvm_get_last_error(comm->u.fragment));
+		return strdup(fpvm_get_last_error(frag));
+}
+
+/* the line of the assignment in the patch, 0 in compile_chunk */
+static int patch_line(const struct parser_comm *comm)
+{
+	return comm->assign_per_frame ? comm->lineno : 0;
 }
 
-static int compile_chunk(struct fpvm_fragment *fragment, const char *chunk)
+static const char *assign_per_frame(struct parser_comm *comm,
+    struct sym *sym, struct ast_node *node)
+{
+	struct compiler_sc *sc = comm->u.sc;
+
+	return assign_fragment(sc, &sc->pfv_fragment, sym, node,
+	    patch_line(comm));
+}
+
+static const char *assign_per_vertex(struct parser_comm *comm,
+    struct sym *sym, struct ast_node *node)
+{
+	struct compiler_sc *sc = comm->u.sc;
+
+	if(sc->flags & COMP_HOIST)
+		hoist(sc, sym, node);
+	return assign_fragment(sc, &sc->pvv_fragment, sym, node,
+	    patch_line(comm));
+}
+
+static bool is_output(const struct sym *sym)
+{
+	return &sym->fpvm_sym == _Xo || &sym->fpvm_sym == _Yo;
+}
+
+static bool pvv_output(void *_sc, const struct sym *sym)
+{
+	struct compiler_sc *sc = _sc;
+
+	return is_output(sym) || sym_var(sc->symtab, sym)->stim != NULL;
+}
+
+/* optimizes the equations kept for frag and adds them to it */
+static bool assign_equations(struct compiler_sc *sc,
+    struct fpvm_fragment *frag,
+    bool (*output)(void *arg, const struct sym *sym),
+    bool (*initial)(void *arg, const struct sym *sym, float value))
+{
+	struct equations *eqs = fragment_equations(sc, frag);
+	struct optimizer opt = {
+		.symtab = sc->symtab,
+		.flags = sc->flags,
+		.output = output,
+		.initial = initial,
+		.arg = sc,
+		.n_temps = sc->n_temps,
+	};
+	struct equation *eq;
+	unsigned long long t = now(sc);
+
+	optimize_equations(&opt, eqs);
+	account(sc, COMP_PHASE_OPTIMIZE, t);
+	sc->n_temps = opt.n_temps;
+	for(eq = eqs->head; eq; eq = eq->next) {
+		fpvm_set_bind_mode(frag, eq->bind_mode);
+		if(!do_assign(sc, frag, eq->sym, eq->node))
+			return false;
+	}
+	fpvm_set_bind_mode(frag, eqs->bind_mode);
+	return true;
+}
+
+
+/* ----- Compilation of internal per-fragment setup code ------------------- */
+
+
+static int compile_chunk(struct compiler_sc *sc,
+    struct fpvm_fragment *fragment, const char *chunk)
 {
 	struct parser_comm comm = {
-		.u.fragment = fragment,
-		.assign_default = assign_chunk,
+		.u.sc = sc,
+		.symtab = sc->symtab,
+		.assign_default = fragment == &sc->pvv_fragment ?
+		    assign_per_vertex : assign_per_frame,
 		.assign_per_frame = NULL,	/* crash ... */
 		.assign_per_vertex = NULL,	/* and burn */
 	};
+	unsigned long long t = now(sc), assigned = assign_time(sc);
+	int ok;
 
-	if(parse(chunk, TOK_START_ASSIGN, &comm))
+	ok = parse(chunk, TOK_START_ASSIGN, &comm);
+	account_parse(sc, t, assigned);
+	if(ok)
 		return 1;
 	snprintf(fragment->last_error, FPVM_MAXERRLEN, "%s", comm.msg);
 	free((void *) comm.msg);
@@ -173,21 +734,131 @@ static void all_initials_to_pfv(struct compiler_sc *sc)
 		initial_to_pfv(sc, i);
 }
 
+/*
+ * The renderer resets the per-frame variables to their initial values before
+ * each frame, then writes the ones that are SF_LIVE.
+ */
+static bool pfv_initial(void *_sc, const struct sym *sym, float value)
+{
+	struct compiler_sc *sc = _sc;
+	int pfv = pfv_from_sym(sym);
+
+	if(pfv < 0 || sc->pfv_writes[pfv] != 1 ||
+	    (sym_var(sc->symtab, sym)->flags & SF_LIVE))
+		return false;
+	pfv_update_patch_requires(sc, pfv);
+	set_initial(sc, pfv, value);
+	sc->pfv_writes[pfv] = 0;
+	return true;
+}
+
+/* the variable keeps its initial value, which is stored in x */
+static bool pfv_fixed(struct compiler_sc *sc, int pfv, float *x)
+{
+	*x = sc->p->pfv_initial[pfv];
+	return !sc->pfv_writes[pfv];
+}
+
+/* see the drawing functions of the renderer for the conditions */
+static unsigned int disabled_outputs(struct compiler_sc *sc)
+{
+	unsigned int disabled = 0;
+	bool outer, inner;
+	float x;
+	int i;
+
+	if((pfv_fixed(sc, pfv_mv_a, &x) && 64*x > -1 && 64*x < 1) ||
+	    (pfv_fixed(sc, pfv_mv_x, &x) && x == 0) ||
+	    (pfv_fixed(sc, pfv_mv_y, &x) && x == 0))
+		disabled |= DISABLED_MV;
+
+	outer = (pfv_fixed(sc, pfv_ob_size, &x) && x == 0) ||
+	    (pfv_fixed(sc, pfv_ob_a, &x) && x == 0);
+	inner = (pfv_fixed(sc, pfv_ib_size, &x) && x == 0) ||
+	    (pfv_fixed(sc, pfv_ib_a, &x) && x == 0);
+	if(outer && inner)
+		disabled |= DISABLED_BORDERS;
+
+	/* only modes 2 to 6 draw something */
+	if((pfv_fixed(sc, pfv_wave_a, &x) && x == 0) ||
+	    (pfv_fixed(sc, pfv_wave_mode, &x) && !(x >= 2 && x < 7)))
+		disabled |= DISABLED_WAVE;
+
+	/* the alpha of the TMU is 64*a-1 */
+	if(pfv_fixed(sc, pfv_video_echo_alpha, &x) && 64*x < 2)
+		disabled |= DISABLED_VECHO;
+	if(pfv_fixed(sc, pfv_video_a, &x) && 64*x < 2)
+		disabled |= DISABLED_VIDEO;
+	if((pfv_fixed(sc, pfv_image1_a, &x) && 64*x < 2) ||
+	    (pfv_fixed(sc, pfv_image1_index, &x) &&
+	    !(x > -1 && x < sc->p->n_images)))
+		disabled |= DISABLED_IMAGE1;
+	if((pfv_fixed(sc, pfv_image2_a, &x) && 64*x < 2) ||
+	    (pfv_fixed(sc, pfv_image2_index, &x) &&
+	    !(x > -1 && x < sc->p->n_images)))
+		disabled |= DISABLED_IMAGE2;
+
+	disabled |= DISABLED_DMX;
+	for(i=pfv_dmx1;i<=pfv_dmx8;i++)
+		if(!pfv_fixed(sc, i, &x))
+			disabled &= ~DISABLED_DMX;
+	return disabled;
+}
+
+/* the disabled feature that uses pfv, 0 if none */
+static unsigned int pfv_feature(int pfv)
+{
+	if(pfv >= pfv_wave_mode && pfv <= pfv_wave_a)
+		return DISABLED_WAVE;
+	if(pfv >= pfv_ob_size && pfv <= pfv_ib_a)
+		return DISABLED_BORDERS;
+	if(pfv >= pfv_mv_x && pfv <= pfv_mv_a)
+		return DISABLED_MV;
+	if(pfv >= pfv_video_echo_alpha && pfv <= pfv_video_echo_orientation)
+		return DISABLED_VECHO;
+	if(pfv == pfv_video_a)
+		return DISABLED_VIDEO;
+	if(pfv >= pfv_image1_a && pfv <= pfv_image1_index)
+		return DISABLED_IMAGE1;
+	if(pfv >= pfv_image2_a && pfv <= pfv_image2_index)
+		return DISABLED_IMAGE2;
+	return 0;
+}
+
+/*
+ * Control variables are read by the stimuli, see pfv_bind_callback. The
+ * parameters of disabled features are not outputs, but the constants folded
+ * before can disable more features, so they are checked each time.
+ */
+static bool pfv_output(void *_sc, const struct sym *sym)
+{
+	struct compiler_sc *sc = _sc;
+	int pfv = pfv_from_sym(sym);
+
+	if(pfv >= 0)
+		return !(pfv_feature(pfv) & disabled_outputs(sc));
+	return is_output(sym) || sym_var(sc->symtab, sym)->stim != NULL ||
+	    hoisted_index(sc, sym) >= 0;
+}
+
 static void pfv_bind_callback(void *_sc, struct fpvm_sym *sym, int reg)
 {
 	struct compiler_sc *sc = _sc;
 	struct sym *s = FPVM2SYM(sym);
-	struct sym_stim *r;
-	int pfv;
+	struct sym_stim *r, *stim = sym_var(sc->symtab, s)->stim;
+	int pfv, i;
 
 	pfv = pfv_from_sym(s);
 	if(pfv >= 0) {
 		pfv_update_patch_requires(sc, pfv);
 		sc->p->pfv_allocation[pfv] = reg;
 	}
-	if(s->stim != NULL)
+	i = hoisted_index(sc, s);
+	if(i >= 0)
+		sc->p->hoisted_pfv[i] = reg;
+	if(stim != NULL)
 		sc->p->require |= REQUIRE_STIM;
-	for(r = s->stim; r; r = r->next)
+	for(r = stim; r; r = r->next)
 		r->regs->pfv = sc->p->perframe_regs+reg;
 }
 
@@ -195,19 +866,35 @@ static bool init_pfv(struct compiler_sc *sc)
 {
 	int i;
 
-	init_fpvm(&sc->pfv_fragment, 0);
-	fpvm_set_bind_mode(&sc->pfv_fragment, FPVM_BIND_ALL);
-	for(i=0;i<COMP_PFV_COUNT;i++)
+	init_fpvm(sc->symtab, &sc->pfv_fragment, 0);
+	set_bind_mode(sc, &sc->pfv_fragment, FPVM_BIND_ALL);
+	for(i=0;i<COMP_PFV_COUNT;i++) {
 		sc->p->pfv_allocation[i] = -1;
+		sc->pfv_writes[i] = 0;
+	}
 	fpvm_set_bind_callback(&sc->pfv_fragment, pfv_bind_callback, sc);
 	return true;
 }
 
 static bool finalize_pfv(struct compiler_sc *sc)
 {
+	const struct sym *sym;
+	int i;
+
+	/* after all the per-frame code, see transfer_pvv_regs */
+	if(!assign_hoisted(sc))
+		goto fail_fpvm;
 	/* assign dummy values for output */
-	if(!compile_chunk(&sc->pfv_fragment, FINISH_PFV_FNP))
+	if(!compile_chunk(sc, &sc->pfv_fragment, FINISH_PFV_FNP))
+		goto fail_fpvm;
+	for(i=0;i<num_well_known;i++) {
+		sym = well_known+i;
+		if(sym->pfv_idx >= 0 && sym_var(sc->symtab, sym)->stim)
+			sc->pfv_writes[sym->pfv_idx]++;
+	}
+	if(!assign_equations(sc, &sc->pfv_fragment, pfv_output, pfv_initial))
 		goto fail_fpvm;
+	sc->p->disabled = disabled_outputs(sc);
 	#ifdef COMP_DEBUG
 	printf("per-frame FPVM fragment:\n");
 	fpvm_dump(&sc->pfv_fragment);
@@ -222,11 +909,11 @@ fail_fpvm:
 
 static bool schedule_pfv(struct compiler_sc *sc)
 {
-	sc->p->perframe_prog_length = fpvm_default_schedule(&sc->pfv_fragment,
+	sc->p->perframe_prog_length = schedule(sc, &sc->pfv_fragment,
 		(unsigned int *)sc->p->perframe_prog,
 		(unsigned int *)sc->p->perframe_regs);
 	if(sc->p->perframe_prog_length < 0) {
-		comp_report(sc, "per-frame VLIW scheduling failed");
+		report_unscheduled(sc, "per-frame", &sc->pfv_eqs);
 		return false;
 	}
 	all_initials_to_pfv(sc);
@@ -259,33 +946,37 @@ static void pvv_bind_callback(void *_sc, struct fpvm_sym *sym, int reg)
 {
 	struct compiler_sc *sc = _sc;
 	struct sym *s = FPVM2SYM(sym);
-	struct sym_stim *r;
-	int pvv;
+	struct sym_stim *r, *stim = sym_var(sc->symtab, s)->stim;
+	int pvv, i;
 
 	pvv = pvv_from_sym(s);
 	if(pvv >= 0) {
 		pvv_update_patch_requires(sc, pvv);
 		sc->p->pvv_allocation[pvv] = reg;
 	}
-	if(s->stim != NULL)
+	i = hoisted_index(sc, s);
+	if(i >= 0)
+		sc->p->hoisted_pvv[i] = reg;
+	if(stim != NULL)
 		sc->p->require |= REQUIRE_STIM;
-	for(r = s->stim; r; r = r->next)
+	for(r = stim; r; r = r->next)
 		r->regs->pvv = sc->p->pervertex_regs+reg;
 }
 
-static bool init_pvv(struct compiler_sc *sc, int framework)
+static bool init_pvv(struct compiler_sc *sc)
 {
 	int i;
 
-	init_fpvm(&sc->pvv_fragment, 1);
+	init_fpvm(sc->symtab, &sc->pvv_fragment, 1);
 	for(i=0;i<COMP_PVV_COUNT;i++)
 		sc->p->pvv_allocation[i] = -1;
 	fpvm_set_bind_callback(&sc->pvv_fragment, pvv_bind_callback, sc);
 
-	fpvm_set_bind_mode(&sc->pvv_fragment, FPVM_BIND_SOURCE);
-	if(framework && !compile_chunk(&sc->pvv_fragment, INIT_PVV_FNP))
+	set_bind_mode(sc, &sc->pvv_fragment, FPVM_BIND_SOURCE);
+	if((sc->flags & COMP_FRAMEWORK) &&
+	    !compile_chunk(sc, &sc->pvv_fragment, INIT_PVV_FNP))
 		goto fail_assign;
-	fpvm_set_bind_mode(&sc->pvv_fragment, FPVM_BIND_ALL);
+	set_bind_mode(sc, &sc->pvv_fragment, FPVM_BIND_ALL);
 
 	return true;
 
@@ -297,11 +988,19 @@ fail_assign:
 
 static int finalize_pvv(struct compiler_sc *sc)
 {
-	fpvm_set_bind_mode(&sc->pvv_fragment, FPVM_BIND_SOURCE);
+	unsigned long long t;
+	int ok;
+
+	set_bind_mode(sc, &sc->pvv_fragment, FPVM_BIND_SOURCE);
 
-	if(!compile_chunk(&sc->pvv_fragment, FINISH_PVV_FNP))
+	if(!compile_chunk(sc, &sc->pvv_fragment, FINISH_PVV_FNP))
 		goto fail_assign;
-	if(!fpvm_finalize(&sc->pvv_fragment)) goto fail_finalize;
+	if(!assign_equations(sc, &sc->pvv_fragment, pvv_output, NULL))
+		goto fail_optimize;
+	t = now(sc);
+	ok = fpvm_finalize(&sc->pvv_fragment);
+	account(sc, COMP_PHASE_ASSIGN, t);
+	if(!ok) goto fail_finalize;
 	#ifdef COMP_DEBUG
 	printf("per-vertex FPVM fragment:\n");
 	fpvm_dump(&sc->pvv_fragment);
@@ -314,6 +1013,11 @@ fail_assign:
 	    fpvm_get_last_error(&sc->pvv_fragment));
 	return false;
 
+fail_optimize:
+	comp_report(sc, "failed to add optimized per-vertex equation: %s",
+	    fpvm_get_last_error(&sc->pvv_fragment));
+	return false;
+
 fail_finalize:
 	comp_report(sc, "failed to finalize per-vertex variables: %s",
 	    fpvm_get_last_error(&sc->pvv_fragment));
@@ -322,11 +1026,11 @@ fail_finalize:
 
 static bool schedule_pvv(struct compiler_sc *sc)
 {
-	sc->p->pervertex_prog_length = fpvm_default_schedule(&sc->pvv_fragment,
+	sc->p->pervertex_prog_length = schedule(sc, &sc->pvv_fragment,
 		(unsigned int *)sc->p->pervertex_prog,
 		(unsigned int *)sc->p->pervertex_regs);
 	if(sc->p->pervertex_prog_length < 0) {
-		comp_report(sc, "per-vertex VLIW scheduling failed");
+		report_unscheduled(sc, "per-vertex", &sc->pvv_eqs);
 		return false;
 	}
 	#ifdef COMP_DEBUG
@@ -372,35 +1076,15 @@ static const char *assign_default(struct parser_comm *comm,
 	return NULL;
 }
 
-static const char *assign_fragment(struct fpvm_fragment *frag,
-    struct sym *sym, struct ast_node *node)
-{
-	if(fpvm_do_assign(frag, &sym->fpvm_sym, node))
-		return NULL;
-	else
-		return strdup(fpvm_get_last_error(frag));
-}
-
-static const char *assign_per_frame(struct parser_comm *comm,
-    struct sym *sym, struct ast_node *node)
-{
-	return assign_fragment(&comm->u.sc->pfv_fragment, sym, node);
-}
-
-static const char *assign_per_vertex(struct parser_comm *comm,
-    struct sym *sym, struct ast_node *node)
-{
-	return assign_fragment(&comm->u.sc->pvv_fragment, sym, node);
-}
-
 static const char *assign_image_name(struct parser_comm *comm,
     int number, const char *name)
 {
-#ifndef STANDALONE
 	struct compiler_sc *sc = comm->u.sc;
 	char *totalname;
 	struct image *img;
 
+	if(sc->basedir == NULL)
+		return NULL;
 	if(number > sc->p->n_images) {
 		int i;
 
@@ -441,7 +1125,6 @@ static const char *assign_image_name(struct parser_comm *comm,
 		free(totalname);
 		return strdup("cannot load image file");
 	}
-#endif /* !STANDALONE */
 	return NULL;
 }
 
@@ -449,34 +1132,50 @@ static bool parse_patch(struct compiler_sc *sc, const char *patch_code)
 {
 	struct parser_comm comm = {
 		.u.sc = sc,
+		.symtab = sc->symtab,
 		.assign_default = assign_default,
 		.assign_per_frame = assign_per_frame,
 		.assign_per_vertex = assign_per_vertex,
 		.assign_image_name = assign_image_name,
 	};
+	unsigned long long t = now(sc), assigned = assign_time(sc);
 	int ok;
 
 	ok = parse(patch_code, TOK_START_ASSIGN, &comm);
+	account_parse(sc, t, assigned);
 	if(comm.msg)
-		sc->rmc(comm.msg);
+		sc->rmc(sc->rmc_arg, comm.msg);
 	free((void *) comm.msg);
 	return ok;
 }
 
-struct patch *patch_do_compile(const char *basedir, const char *patch_code,
-    report_message rmc, int framework)
+static void free_images(struct patch *p)
+{
+	struct image *img;
+
+	for(img = p->images; img != p->images+p->n_images; img++) {
+		pixbuf_dec_ref(img->pixbuf);
+		free((void *) img->filename);
+	}
+	free(p->images);
+}
+
+static struct patch *compile(const char *basedir, const char *patch_code,
+    report_message rmc, void *arg, struct symtab *symtab, int flags,
+    struct comp_stats *stats, char *unscheduled)
 {
 	struct compiler_sc *sc;
 	struct patch *p;
+	int i;
 
 	sc = malloc(sizeof(struct compiler_sc));
 	if(sc == NULL) {
-		rmc("Failed to allocate memory for compiler internal data");
+		rmc(arg, "Failed to allocate memory for compiler internal data");
 		return NULL;
 	}
 	p = sc->p = malloc(sizeof(struct patch));
 	if(sc->p == NULL) {
-		rmc("Failed to allocate memory for patch");
+		rmc(arg, "Failed to allocate memory for patch");
 		free(sc);
 		return NULL;
 	}
@@ -484,51 +1183,155 @@ struct patch *patch_do_compile(const char *basedir, const char *patch_code,
 	sc->p->n_images = 0;
 	sc->p->ref = 1;
 	sc->p->require = 0;
+	sc->p->disabled = 0;
 	sc->p->original = NULL;
 	sc->p->next = NULL;
 	sc->p->stim = NULL;
+	sc->p->perframe_vprog = NULL;
+	sc->p->pervertex_vprog = NULL;
+	sc->p->n_hoisted = 0;
+	for(i=0;i<COMP_HOIST_MAX;i++) {
+		sc->p->hoisted_pfv[i] = -1;
+		sc->p->hoisted_pvv[i] = -1;
+	}
 
 	sc->basedir = basedir;
 	sc->rmc = rmc;
+	sc->rmc_arg = arg;
 	sc->linenr = 0;
-
-	symtab_init();
+	sc->stats = stats;
+	sc->unscheduled = unscheduled;
+	sc->flags = flags;
+	equations_init(&sc->pfv_eqs, FPVM_BIND_ALL);
+	equations_init(&sc->pvv_eqs, FPVM_BIND_ALL);
+	sc->n_temps = 0;
+	sc->pvv_values = NULL;
+	sc->n_pvv_values = 0;
+
+	sc->symtab = symtab ? symtab : &sc->own_symtab;
+	symtab_init(sc->symtab);
 
 	load_defaults(sc);
 	if(!init_pfv(sc)) goto fail;
-	if(!init_pvv(sc, framework)) goto fail;
+	if(!init_pvv(sc)) goto fail;
 
 	if(!parse_patch(sc, patch_code))
 		goto fail;
 
-	if(framework && !finalize_pfv(sc)) goto fail;
+	/* the per-vertex footer has invariants to hoist too */
+	if((flags & COMP_FRAMEWORK) && !finalize_pvv(sc)) goto fail;
+	if((flags & COMP_FRAMEWORK) && !finalize_pfv(sc)) goto fail;
 	if(!schedule_pfv(sc)) goto fail;
-	if(framework && !finalize_pvv(sc)) goto fail;
 	if(!schedule_pvv(sc)) goto fail;
 
-#ifndef STANDALONE
-	symtab_free();
-#endif
-	stim_db_free(); /* @@@ */
-
+	free_hoisted(sc);
+	equations_free(&sc->pfv_eqs);
+	equations_free(&sc->pvv_eqs);
+	if(!symtab)
+		symtab_free(&sc->own_symtab);
 	free(sc);
 	return p;
 
 fail:
-	symtab_free();
+	free_hoisted(sc);
+	equations_free(&sc->pfv_eqs);
+	equations_free(&sc->pvv_eqs);
+	if(!symtab)
+		symtab_free(&sc->own_symtab);
+	free_images(sc->p);
+	stim_put(sc->p->stim);
 	free(sc->p);
 	free(sc);
 	return NULL;
 }
 
+/* the flags of the n-th retry of COMP_RETRY, -1 if there are no more */
+static int retry_flags(int flags, int n)
+{
+	int tries[3];
+	int n_tries = 0;
+
+	/* recompute common subexpressions instead of holding them */
+	if(flags & COMP_CSE)
+		tries[n_tries++] = flags & ~COMP_CSE;
+	/* trade per-vertex operations for per-vertex registers, or back */
+	tries[n_tries++] = flags ^ COMP_HOIST;
+	if(flags & COMP_CSE)
+		tries[n_tries++] = (flags & ~COMP_CSE) ^ COMP_HOIST;
+	return n < n_tries ? tries[n] : -1;
+}
+
+static void ignore_message(void *arg, const char *msg)
+{
+}
+
+static void report_retry(report_message rmc, void *arg, int flags,
+    int retry)
+{
+	const char *cse = "", *hoist = "";
+	char buf[REPORT_LEN];
+
+	if(flags & ~retry & COMP_CSE)
+		cse = " without common subexpressions";
+	if((flags ^ retry) & COMP_HOIST)
+		hoist = retry & COMP_HOIST ?
+		    " with hoisting" : " without hoisting";
+	snprintf(buf, sizeof(buf),
+	    "code too large for the PFPU, compiled%s%s%s",
+	    cse, *cse && *hoist ? " and" : "", hoist);
+	rmc(arg, buf);
+}
+
+struct patch *patch_do_compile(const char *basedir, const char *patch_code,
+    report_message rmc, void *arg, struct symtab *symtab, int flags,
+    struct comp_stats *stats)
+{
+	char unscheduled[REPORT_LEN];
+	struct patch *p;
+	int i, retry;
+
+	if(stats)
+		memset(stats, 0, sizeof(struct comp_stats));
+	/*
+	 * Without the framework, the per-frame code is not run before the
+	 * per-vertex code and the fragments are not finalized, which is where
+	 * the equations are optimized.
+	 */
+	if(!(flags & COMP_FRAMEWORK))
+		flags &= ~(COMP_HOIST | COMP_EQUATIONS | COMP_RETRY);
+	if(!(flags & COMP_RETRY))
+		return compile(basedir, patch_code, rmc, arg, symtab, flags,
+		    stats, NULL);
+
+	*unscheduled = 0;
+	p = compile(basedir, patch_code, rmc, arg, symtab, flags, stats,
+	    unscheduled);
+	if(p || !*unscheduled)
+		return p;
+	/* the messages of the patch have been reported already */
+	for(i=0;(retry = retry_flags(flags, i)) >= 0;i++) {
+		if(symtab)
+			symtab_free(symtab);
+		p = compile(basedir, patch_code, ignore_message, NULL, symtab,
+		    retry, stats, NULL);
+		if(p) {
+			report_retry(rmc, arg, flags, retry);
+			return p;
+		}
+	}
+	rmc(arg, unscheduled);
+	return NULL;
+}
+
 struct patch *patch_compile(const char *basedir, const char *patch_code,
-    report_message rmc)
+    report_message rmc, void *arg)
 {
-	return patch_do_compile(basedir, patch_code, rmc, 1);
+	return patch_do_compile(basedir, patch_code, rmc, arg, NULL,
+	    COMP_FRAMEWORK | COMP_OPTIMIZE, NULL);
 }
 
 struct patch *patch_compile_filename(const char *filename,
-    const char *patch_code, report_message rmc)
+    const char *patch_code, report_message rmc, void *arg)
 {
 	char *basedir;
 	char *c;
@@ -540,9 +1343,9 @@ struct patch *patch_compile_filename(const char *filename,
 	if(c != NULL) {
 		c++;
 		*c = 0;
-		p = patch_compile(basedir, patch_code, rmc);
+		p = patch_compile(basedir, patch_code, rmc, arg);
 	} else
-		p = patch_compile("/", patch_code, rmc);
+		p = patch_compile("/", patch_code, rmc, arg);
 	free(basedir);
 	return p;
 }
@@ -554,8 +1357,6 @@ struct stimuli *compiler_get_stimulus(struct compiler_sc *sc)
 	return sc->p->stim;
 }
 
-#ifndef STANDALONE
-
 struct patch *patch_copy(struct patch *p)
 {
 	struct patch *new_patch;
@@ -568,6 +1369,9 @@ struct patch *patch_copy(struct patch *p)
 	new_patch->ref = 1;
 	new_patch->original = p;
 	new_patch->next = NULL;
+	/* the copy has its own register files and lowers its own code */
+	new_patch->perframe_vprog = NULL;
+	new_patch->pervertex_vprog = NULL;
 	if(p->images) {
 		new_patch->images = malloc(p->n_images*sizeof(struct image));
 		for(i = 0; i != p->n_images; i++) {
@@ -586,17 +1390,15 @@ struct patch *patch_copy(struct patch *p)
 
 void patch_free(struct patch *p)
 {
-	struct image *img;
-
 	assert(p->ref);
-	if(--p->ref);
+	if(--p->ref)
 		return;
-	for(img = p->images; img != p->images+p->n_images; img++) {
-		pixbuf_dec_ref(img->pixbuf);
-		free((void *) img->filename);
-	}
-	free(p->images);
+	free_images(p);
 	stim_put(p->stim);
+#ifdef WITH_SOFTPFPU
+	vpfpu_free(p->perframe_vprog);
+	vpfpu_free(p->pervertex_vprog);
+#endif
 	free(p);
 }
 
@@ -617,5 +1419,3 @@ struct patch *patch_refresh(struct patch *p)
 	p->ref++;
 	return p;
 }
-
-#endif /* !STANDALONE */
@@ -32,6 +32,8 @@
 #include "../renderer/framedescriptor.h"
 #include "../renderer/stimuli.h"
 #include "../pixbuf/pixbuf.h"
+#include "symtab.h"
+#include "optimize.h"
 
 enum {
 	pfv_sx = 0,
@@ -88,6 +90,45 @@ enum {
 	pfv_mid_att,
 	pfv_treb_att,
 
+	pfv_band1,
+	pfv_band2,
+	pfv_band3,
+	pfv_band4,
+	pfv_band5,
+	pfv_band6,
+	pfv_band7,
+	pfv_band8,
+	pfv_band9,
+	pfv_band10,
+	pfv_band11,
+	pfv_band12,
+	pfv_band13,
+	pfv_band14,
+	pfv_band15,
+	pfv_band16,
+	pfv_band17,
+	pfv_band18,
+	pfv_band19,
+	pfv_band20,
+	pfv_band21,
+	pfv_band22,
+	pfv_band23,
+	pfv_band24,
+	pfv_band25,
+	pfv_band26,
+	pfv_band27,
+	pfv_band28,
+	pfv_band29,
+	pfv_band30,
+	pfv_band31,
+	pfv_band32,
+	pfv_peak,
+	pfv_rms,
+	pfv_onset,
+	pfv_beat,
+	pfv_beat_phase,
+	pfv_bpm,
+
 	pfv_warp,
 	pfv_warp_anim_speed,
 	pfv_warp_scale,
@@ -169,6 +210,45 @@ enum {
 	pvv_mid_att,
 	pvv_treb_att,
 
+	pvv_band1,
+	pvv_band2,
+	pvv_band3,
+	pvv_band4,
+	pvv_band5,
+	pvv_band6,
+	pvv_band7,
+	pvv_band8,
+	pvv_band9,
+	pvv_band10,
+	pvv_band11,
+	pvv_band12,
+	pvv_band13,
+	pvv_band14,
+	pvv_band15,
+	pvv_band16,
+	pvv_band17,
+	pvv_band18,
+	pvv_band19,
+	pvv_band20,
+	pvv_band21,
+	pvv_band22,
+	pvv_band23,
+	pvv_band24,
+	pvv_band25,
+	pvv_band26,
+	pvv_band27,
+	pvv_band28,
+	pvv_band29,
+	pvv_band30,
+	pvv_band31,
+	pvv_band32,
+	pvv_peak,
+	pvv_rms,
+	pvv_onset,
+	pvv_beat,
+	pvv_beat_phase,
+	pvv_bpm,
+
 	pvv_warp,
 	pvv_warp_anim_speed,
 	pvv_warp_scale,
@@ -199,11 +279,22 @@ enum {
 	COMP_PVV_COUNT /* must be last */
 };
 
+/*
+ * Bump whenever the same patch compiles to something different, so that
+ * the compiled patches cached on the flash (see patchcache.h) are dropped.
+ */
+#define COMP_VERSION	4
+
+/* at most this many per-vertex expressions are computed per frame */
+#define COMP_HOIST_MAX	16
+
 #define REQUIRE_DMX	(1 << 0)
 #define REQUIRE_OSC	(1 << 1)
 #define REQUIRE_STIM	(1 << 2)
 #define REQUIRE_VIDEO	(1 << 3)
 
+struct vpfpu_prog;
+
 struct image {
 	struct pixbuf *pixbuf;	/* NULL if unused */
 	const char *filename;	/* undefined if unused */
@@ -234,8 +325,21 @@ struct patch {
 						/* PFPU per-vertex microcode */
 	float pervertex_regs[PFPU_REG_COUNT];	/* PFPU initial per-vertex
 						   regf */
+	/* per-vertex expressions computed by the per-frame code */
+	int n_hoisted;				/* how many */
+	int hoisted_pfv[COMP_HOIST_MAX];	/* where they are computed in
+						   the per-frame regf */
+	int hoisted_pvv[COMP_HOIST_MAX];	/* where they are copied to in
+						   the per-vertex regf, -1 if
+						   unmapped */
+	/* software evaluation */
+	struct vpfpu_prog *perframe_vprog;	/* lowered per-frame code,
+						   NULL until first used */
+	struct vpfpu_prog *pervertex_vprog;	/* lowered per-vertex code,
+						   NULL until first used */
 	/* meta */
 	unsigned int require;	/* bitmask: dmx, osc, stim, video */
+	unsigned int disabled;	/* DISABLED_*, see framedescriptor.h */
 	void *original;		/* original patch (with initial register
 				   values) */
 	int ref;		/* reference count */
@@ -245,33 +349,115 @@ struct patch {
 	struct stimuli *stim;	/* control variable hierarchy */
 };
 
-typedef void (*report_message)(const char *);
+typedef void (*report_message)(void *arg, const char *msg);
+
+/* patch_do_compile flags */
+#define COMP_FRAMEWORK	(1 << 0)	/* wrap the patch in the framework */
+#define COMP_HOIST	(1 << 1)	/* compute the per-vertex expressions
+					   that are the same for all vertices
+					   in the per-frame code (needs
+					   COMP_FRAMEWORK) */
+/* the following need COMP_FRAMEWORK too, see optimize.h */
+#define COMP_SIMPLIFY	(1 << 2)	/* apply algebraic identities */
+#define COMP_CSE	(1 << 3)	/* compute common subexpressions once */
+#define COMP_DCE	(1 << 4)	/* drop assignments that can't reach
+					   an output */
+#define COMP_RETRY	(1 << 5)	/* if the code doesn't fit the PFPU,
+					   retry without COMP_CSE and with
+					   COMP_HOIST toggled */
+
+#define COMP_OPTIMIZE \
+	(COMP_HOIST | COMP_SIMPLIFY | COMP_CSE | COMP_DCE | COMP_RETRY)
+
+/* phases of the compilation, see struct comp_stats */
+enum {
+	COMP_PHASE_PARSE = 0,	/* scanning, parsing and hoisting */
+	COMP_PHASE_OPTIMIZE,	/* see optimize.h */
+	COMP_PHASE_ASSIGN,	/* FPVM code generation */
+	COMP_PHASE_SCHEDULE,	/* VLIW scheduling and register allocation */
+	COMP_PHASE_COUNT
+};
+
+struct comp_stats {
+	unsigned long long ns[COMP_PHASE_COUNT];	/* time spent */
+	int assignments;	/* equations handed to FPVM */
+};
+
+struct ast_node;
+struct pvv_value;
 
 struct compiler_sc {
 	struct patch *p;
 
 	const char *basedir;
 	report_message rmc;
+	void *rmc_arg;
 	int linenr;
+	int flags;
+	struct comp_stats *stats;	/* NULL if not requested */
+	char *unscheduled;	/* gets a scheduling failure instead of rmc,
+				   for COMP_RETRY; NULL if not retrying */
+
+	struct symtab *symtab;	/* own_symtab or the caller's */
+	struct symtab own_symtab;
 
 	struct fpvm_fragment pfv_fragment;
 	struct fpvm_fragment pvv_fragment;
+
+	/* hoisting of per-frame invariants */
+	struct sym *hoisted[COMP_HOIST_MAX];	/* temporaries */
+	struct ast_node *hoisted_ast[COMP_HOIST_MAX];
+						/* their expressions, in terms
+						   of the per-frame code */
+	struct pvv_value *pvv_values;		/* variables assigned to in
+						   the per-vertex code */
+	int n_pvv_values;
+
+	/* equations kept for optimize, see optimize.h */
+	struct equations pfv_eqs;
+	struct equations pvv_eqs;
+	int n_temps;				/* temporaries made by CSE */
+
+	/* per-frame variables that the code or the stimuli write */
+	int pfv_writes[COMP_PFV_COUNT];
 };
 
-void init_fpvm(struct fpvm_fragment *fragment, int vector_mode);
+void init_fpvm(struct symtab *st, struct fpvm_fragment *fragment,
+    int vector_mode);
 
 /*
- * Flickernoise only uses patch_compile. patch_do_compile allows disabling
- * the patch framework, which is useful for code analysis in ptest.
+ * Flickernoise only uses patch_compile, with COMP_FRAMEWORK | COMP_OPTIMIZE.
+ * patch_do_compile allows disabling the patch framework, which is useful for
+ * code analysis in ptest, or the optimizations, and compiling into a symbol
+ * table provided by the caller, who then frees it. With symtab NULL, a
+ * symbol table is created for the compilation.
+ *
+ * Image file names are relative to basedir. With basedir NULL, the images
+ * are not loaded, as ptest and rtest do by default.
+ *
+ * Patches can be compiled by several tasks at the same time, once
+ * compiler_init has been called (only in the firmware). Messages are
+ * reported with rmc(arg, msg), from the compiling task.
+ *
+ * If stats is not NULL, it receives the time spent in each phase, for
+ * benchmarks (see ptest -B).
+ *
+ * With COMP_RETRY, a patch whose code doesn't fit the PFPU is compiled again
+ * with the optimizations that cost registers turned off, and with per-vertex
+ * expressions moved to or from the per-frame code. If none of this helps, the
+ * scheduling failure of the first compilation is reported, with the lines
+ * whose equations cost the most operations and registers.
  */
 
+void compiler_init(void);
 struct patch *patch_do_compile(const char *basedir, const char *patch_code,
-    report_message rmc, int framework);
+    report_message rmc, void *arg, struct symtab *symtab, int flags,
+    struct comp_stats *stats);
 struct patch *patch_compile(const char *basedir, const char *patch_code,
-    report_message rmc);
+    report_message rmc, void *arg);
 
 struct patch *patch_compile_filename(const char *filename,
-    const char *patch_code, report_message rmc);
+    const char *patch_code, report_message rmc, void *arg);
 struct stimuli *compiler_get_stimulus(struct compiler_sc *sc);
 struct patch *patch_copy(struct patch *p);
 void patch_free(struct patch *p);
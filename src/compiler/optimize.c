@@ -0,0 +1,678 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <fpvm/fpvm.h>
+#include <fpvm/ast.h>
+
+#include "symtab.h"
+#include "parser_helper.h"
+#include "compiler.h"
+#include "optimize.h"
+
+void equations_init(struct equations *eqs, int bind_mode)
+{
+	eqs->head = NULL;
+	eqs->tail = &eqs->head;
+	eqs->bind_mode = bind_mode;
+}
+
+void equations_add(struct equations *eqs, struct sym *sym,
+    struct ast_node *node, int lineno)
+{
+	struct equation *eq;
+
+	eq = malloc(sizeof(struct equation));
+	eq->sym = sym;
+	eq->node = node;
+	eq->bind_mode = eqs->bind_mode;
+	eq->lineno = lineno;
+	eq->next = NULL;
+	*eqs->tail = eq;
+	eqs->tail = &eq->next;
+}
+
+void equations_free(struct equations *eqs)
+{
+	struct equation *next;
+
+	while(eqs->head) {
+		next = eqs->head->next;
+		parse_free(eqs->head->node);
+		free(eqs->head);
+		eqs->head = next;
+	}
+	eqs->tail = &eqs->head;
+}
+
+static struct ast_node **operand(struct ast_node *n, int i)
+{
+	switch(i) {
+	case 0:
+		return &n->contents.branches.a;
+	case 1:
+		return &n->contents.branches.b;
+	default:
+		return &n->contents.branches.c;
+	}
+}
+
+static bool same_tree(const struct ast_node *a, const struct ast_node *b)
+{
+	if(a == NULL || b == NULL)
+		return a == b;
+	if(a->op != b->op)
+		return false;
+	switch(a->op) {
+	case op_constant:
+		return !memcmp(&a->contents.constant, &b->contents.constant,
+		    sizeof(float));
+	case op_ident:
+		return a->sym == b->sym;
+	default:
+		return same_tree(a->contents.branches.a,
+		    b->contents.branches.a) &&
+		    same_tree(a->contents.branches.b,
+		    b->contents.branches.b) &&
+		    same_tree(a->contents.branches.c,
+		    b->contents.branches.c);
+	}
+}
+
+/* turns n into a reference to sym, freeing its operands */
+static void make_ident(struct ast_node *n, struct sym *sym)
+{
+	int i;
+
+	for(i=0;i<3;i++) {
+		parse_free(*operand(n, i));
+		*operand(n, i) = NULL;
+	}
+	n->op = op_ident;
+	n->sym = &sym->fpvm_sym;
+}
+
+/* ----- Algebraic identities ---------------------------------------------- */
+
+static bool is_constant(const struct ast_node *n, float f)
+{
+	return n->op == op_constant && n->contents.constant == f;
+}
+
+/* replaces n by its operand x */
+static struct ast_node *replace(struct ast_node *n, struct ast_node *x)
+{
+	int i;
+
+	for(i=0;i<3;i++)
+		if(*operand(n, i) == x)
+			*operand(n, i) = NULL;
+	parse_free(n);
+	return x;
+}
+
+static struct ast_node *simplify(struct ast_node *n)
+{
+	struct ast_node *a, *b;
+	float inv;
+	int i;
+
+	if(!node_is_op(n))
+		return n;
+	for(i=0;i<3;i++)
+		if(*operand(n, i))
+			*operand(n, i) = simplify(*operand(n, i));
+	a = n->contents.branches.a;
+	b = n->contents.branches.b;
+
+	switch(n->op) {
+	case op_plus:
+		if(is_constant(b, 0))
+			return replace(n, a);
+		if(is_constant(a, 0))
+			return replace(n, b);
+		break;
+	case op_minus:
+		if(is_constant(b, 0))
+			return replace(n, a);
+		break;
+	case op_multiply:
+		if(is_constant(b, 1))
+			return replace(n, a);
+		if(is_constant(a, 1))
+			return replace(n, b);
+		if(same_tree(a, b)) {
+			parse_free(b);
+			n->contents.branches.b = NULL;
+			n->op = op_sqr;
+		}
+		break;
+	case op_divide:
+		if(is_constant(b, 1))
+			return replace(n, a);
+		/* FPVM divides with a reciprocal square root and a multiply */
+		if(b->op == op_constant) {
+			inv = 1.0f/b->contents.constant;
+			if(isnormal(inv)) {
+				b->contents.constant = inv;
+				n->op = op_multiply;
+			}
+		}
+		break;
+	case op_negate:
+		if(a->op == op_negate) {
+			b = a->contents.branches.a;
+			a->contents.branches.a = NULL;
+			parse_free(n);
+			return b;
+		}
+		break;
+	default:
+		break;
+	}
+	return n;
+}
+
+/* ----- Value numbering --------------------------------------------------- */
+
+/*
+ * The value table maps the keys of expressions to value numbers: constants
+ * by their bits, operations by the value numbers of their operands, and the
+ * initial values of variables by symbol. It also holds the current value of
+ * each variable in each pass, and what the other optimizations know of each
+ * variable.
+ */
+
+#define	KEY_INIT	-1		/* initial value of sym */
+#define	KEY_CUR		-2		/* value of sym in pass */
+#define	KEY_LIVE	-3		/* sym reaches an output */
+#define	KEY_ASSIGNED	-4		/* sym is assigned vn times */
+#define	KEY_READ	-5		/* sym has been read */
+
+#define	INITIAL_TABLE	256
+
+struct key {
+	int op;
+	uintptr_t k[3];
+};
+
+struct entry {
+	bool used;
+	struct key key;
+	int vn;
+};
+
+struct value {
+	int count;			/* occurrences */
+	struct sym *temp;		/* temporary holding it, or NULL */
+	struct sym *holder;		/* first variable assigned it, or NULL */
+};
+
+struct state {
+	struct optimizer *opt;
+
+	struct entry *table;
+	int table_size;			/* power of two */
+	int table_used;
+
+	struct value *values;		/* by value number, 0 unused */
+	int n_values, max_values;
+
+	/* value number and size of the nodes of all the trees, in pre-order */
+	int *vns;
+	int *sizes;
+	int n_nodes, max_nodes;
+	int next_node;			/* when rewriting */
+
+	int pass;
+};
+
+static unsigned hash_key(const struct key *key)
+{
+	uintptr_t h = key->op;
+	int i;
+
+	for(i=0;i<3;i++)
+		h = h*0x9e3779b1u+key->k[i];
+	return h ^ (h >> 16);
+}
+
+static bool same_key(const struct key *a, const struct key *b)
+{
+	return a->op == b->op && a->k[0] == b->k[0] && a->k[1] == b->k[1] &&
+	    a->k[2] == b->k[2];
+}
+
+static struct entry *find(struct entry *table, int size, const struct key *key)
+{
+	struct entry *e;
+	unsigned i;
+
+	i = hash_key(key) & (size-1);
+	while(1) {
+		e = table+i;
+		if(!e->used || same_key(&e->key, key))
+			return e;
+		i = (i+1) & (size-1);
+	}
+}
+
+static void grow_table(struct state *s)
+{
+	struct entry *old = s->table, *e;
+	int old_size = s->table_size;
+
+	s->table_size = old_size ? 2*old_size : INITIAL_TABLE;
+	s->table = calloc(s->table_size, sizeof(struct entry));
+	for(e = old; e != old+old_size; e++)
+		if(e->used)
+			*find(s->table, s->table_size, &e->key) = *e;
+	free(old);
+}
+
+/* entry for key, with vn 0 if new */
+static struct entry *lookup(struct state *s, const struct key *key)
+{
+	struct entry *e;
+
+	if(2*(s->table_used+1) > s->table_size)
+		grow_table(s);
+	e = find(s->table, s->table_size, key);
+	if(!e->used) {
+		e->used = true;
+		e->key = *key;
+		e->vn = 0;
+		s->table_used++;
+	}
+	return e;
+}
+
+static int new_value(struct state *s)
+{
+	if(s->n_values == s->max_values) {
+		s->max_values = s->max_values ? 2*s->max_values : 64;
+		s->values = realloc(s->values,
+		    s->max_values*sizeof(struct value));
+	}
+	memset(s->values+s->n_values, 0, sizeof(struct value));
+	return s->n_values++;
+}
+
+static int value_of(struct state *s, const struct key *key)
+{
+	struct entry *e;
+	int vn;
+
+	e = lookup(s, key);
+	if(e->vn)
+		return e->vn;
+	vn = new_value(s);
+	/* new_value doesn't touch the table */
+	e->vn = vn;
+	return vn;
+}
+
+static struct key sym_key(int op, const struct sym *sym, int pass)
+{
+	struct key key = {
+		.op = op,
+		.k = { (uintptr_t) sym, pass, 0 },
+	};
+
+	return key;
+}
+
+/* value of sym at this point of the pass */
+static int current(struct state *s, const struct sym *sym)
+{
+	struct key cur = sym_key(KEY_CUR, sym, s->pass);
+	struct key init = sym_key(KEY_INIT, sym, 0);
+	int vn;
+
+	vn = lookup(s, &cur)->vn;
+	if(vn)
+		return vn;
+	vn = value_of(s, &init);
+	/* value_of may have moved the entry */
+	lookup(s, &cur)->vn = vn;
+	return vn;
+}
+
+static void set_current(struct state *s, const struct sym *sym, int vn)
+{
+	struct key key = sym_key(KEY_CUR, sym, s->pass);
+
+	lookup(s, &key)->vn = vn;
+}
+
+static int new_node(struct state *s)
+{
+	if(s->n_nodes == s->max_nodes) {
+		s->max_nodes = s->max_nodes ? 2*s->max_nodes : 256;
+		s->vns = realloc(s->vns, s->max_nodes*sizeof(int));
+		s->sizes = realloc(s->sizes, s->max_nodes*sizeof(int));
+	}
+	return s->n_nodes++;
+}
+
+static int number(struct state *s, const struct ast_node *n)
+{
+	struct key key = { .op = n->op };
+	uintptr_t tmp;
+	int idx, i;
+
+	idx = new_node(s);
+	switch(n->op) {
+	case op_constant:
+		memcpy(&key.k[0], &n->contents.constant, sizeof(float));
+		s->vns[idx] = value_of(s, &key);
+		break;
+	case op_ident:
+		s->vns[idx] = current(s, FPVM2SYM(n->sym));
+		break;
+	default:
+		for(i=0;i<3;i++)
+			if(*operand((struct ast_node *) n, i))
+				key.k[i] = number(s,
+				    *operand((struct ast_node *) n, i));
+		if((n->op == op_plus || n->op == op_multiply) &&
+		    key.k[0] > key.k[1]) {
+			tmp = key.k[0];
+			key.k[0] = key.k[1];
+			key.k[1] = tmp;
+		}
+		s->vns[idx] = value_of(s, &key);
+		s->values[s->vns[idx]].count++;
+		break;
+	}
+	s->sizes[idx] = s->n_nodes-idx;
+	return s->vns[idx];
+}
+
+static void free_state(struct state *s)
+{
+	free(s->table);
+	free(s->values);
+	free(s->vns);
+	free(s->sizes);
+}
+
+/* ----- Marks ------------------------------------------------------------ */
+
+static bool is_marked(struct state *s, const struct sym *sym, int op)
+{
+	struct key key = sym_key(op, sym, 0);
+
+	return find(s->table, s->table_size, &key)->used;
+}
+
+/* returns whether sym was not marked yet */
+static bool mark(struct state *s, const struct sym *sym, int op)
+{
+	struct key key = sym_key(op, sym, 0);
+	int used = s->table_used;
+
+	lookup(s, &key);
+	return s->table_used != used;
+}
+
+static bool mark_reads(struct state *s, const struct ast_node *n, int op)
+{
+	bool changed = false;
+	int i;
+
+	if(n == NULL)
+		return false;
+	if(n->op == op_ident)
+		return mark(s, FPVM2SYM(n->sym), op);
+	if(!node_is_op(n))
+		return false;
+	for(i=0;i<3;i++)
+		changed |= mark_reads(s,
+		    *operand((struct ast_node *) n, i), op);
+	return changed;
+}
+
+/* ----- Constant variables ------------------------------------------------ */
+
+static bool constant_value(const struct ast_node *n, float *f)
+{
+	if(n->op == op_constant) {
+		*f = n->contents.constant;
+		return true;
+	}
+	if(n->op == op_negate && n->contents.branches.a->op == op_constant) {
+		*f = -n->contents.branches.a->contents.constant;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * A variable assigned a constant once and not read before has that value
+ * wherever it is read. If it starts each run of the fragment with its initial
+ * value, the assignment can become the initial value.
+ */
+static void fold_constants(struct state *s, struct equations *eqs)
+{
+	struct optimizer *opt = s->opt;
+	struct equation *eq, **p;
+	struct key key;
+	float f;
+
+	grow_table(s);
+	for(eq = eqs->head; eq; eq = eq->next) {
+		key = sym_key(KEY_ASSIGNED, eq->sym, 0);
+		lookup(s, &key)->vn++;
+	}
+
+	p = &eqs->head;
+	while(*p) {
+		eq = *p;
+		key = sym_key(KEY_ASSIGNED, eq->sym, 0);
+		if(constant_value(eq->node, &f) &&
+		    lookup(s, &key)->vn == 1 &&
+		    !is_marked(s, eq->sym, KEY_READ) &&
+		    opt->initial(opt->arg, eq->sym, f)) {
+			*p = eq->next;
+			parse_free(eq->node);
+			free(eq);
+			continue;
+		}
+		mark_reads(s, eq->node, KEY_READ);
+		p = &eq->next;
+	}
+	eqs->tail = p;
+}
+
+/* ----- Dead assignments -------------------------------------------------- */
+
+/*
+ * Variables are live if they are outputs or if a live assignment reads them,
+ * wherever they are read. This doesn't see that an assignment is overwritten
+ * before it is read, but the variables of the user and the temporaries of
+ * the framework code are seldom reassigned.
+ */
+static void eliminate_dead(struct state *s, struct equations *eqs)
+{
+	struct optimizer *opt = s->opt;
+	struct equation *eq, **p;
+	bool changed;
+
+	grow_table(s);
+	for(eq = eqs->head; eq; eq = eq->next)
+		if(opt->output(opt->arg, eq->sym))
+			mark(s, eq->sym, KEY_LIVE);
+	do {
+		changed = false;
+		for(eq = eqs->head; eq; eq = eq->next)
+			if(is_marked(s, eq->sym, KEY_LIVE))
+				changed |= mark_reads(s, eq->node, KEY_LIVE);
+	} while(changed);
+
+	p = &eqs->head;
+	while(*p) {
+		eq = *p;
+		if(is_marked(s, eq->sym, KEY_LIVE)) {
+			p = &eq->next;
+			continue;
+		}
+		*p = eq->next;
+		parse_free(eq->node);
+		free(eq);
+	}
+	eqs->tail = p;
+}
+
+/* ----- Common subexpressions --------------------------------------------- */
+
+/* a variable holding value vn at this point, NULL if there is none */
+static struct sym *holding(struct state *s, int vn)
+{
+	struct value *v = s->values+vn;
+
+	if(v->temp)
+		return v->temp;
+	if(v->holder && current(s, v->holder) == vn)
+		return v->holder;
+	return NULL;
+}
+
+/* computes n into a new temporary before the current equation */
+static void to_temp(struct state *s, struct equation ***insert,
+    struct ast_node *n, int vn)
+{
+	struct optimizer *opt = s->opt;
+	struct ast_node *copy;
+	struct equation *eq;
+	char name[16];
+
+	/* not a name the scanner can produce */
+	sprintf(name, "%%c%d", opt->n_temps++);
+	s->values[vn].temp = unique(opt->symtab, name);
+
+	copy = malloc(sizeof(struct ast_node));
+	*copy = *n;
+	eq = malloc(sizeof(struct equation));
+	eq->sym = s->values[vn].temp;
+	eq->node = copy;
+	eq->bind_mode = FPVM_BIND_SOURCE;
+	eq->lineno = (**insert)->lineno;
+	eq->next = **insert;
+	**insert = eq;
+	*insert = &eq->next;
+
+	/* the operands now belong to the copy */
+	n->op = op_ident;
+	n->sym = &eq->sym->fpvm_sym;
+}
+
+static void rewrite(struct state *s, struct equation ***insert,
+    struct ast_node *n, bool root)
+{
+	int idx = s->next_node;
+	int vn = s->vns[idx];
+	struct sym *sym;
+	int i;
+
+	if(!node_is_op(n)) {
+		s->next_node++;
+		return;
+	}
+	if(s->values[vn].count > 1) {
+		sym = holding(s, vn);
+		if(sym) {
+			make_ident(n, sym);
+			s->next_node += s->sizes[idx];
+			return;
+		}
+	}
+	s->next_node++;
+	for(i=0;i<3;i++)
+		if(*operand(n, i))
+			rewrite(s, insert, *operand(n, i), false);
+	/* the variable assigned the value holds it, see eliminate_common */
+	if(s->values[vn].count > 1 && !root)
+		to_temp(s, insert, n, vn);
+}
+
+static void eliminate_common(struct state *s, struct equations *eqs)
+{
+	struct equation *eq, **p;
+	int first, vn;
+
+	s->pass = 1;
+	for(eq = eqs->head; eq; eq = eq->next)
+		set_current(s, eq->sym, number(s, eq->node));
+
+	s->pass = 2;
+	s->next_node = 0;
+	p = &eqs->head;
+	while(*p) {
+		first = s->next_node;
+		vn = s->vns[first];
+		rewrite(s, &p, (*p)->node, true);
+		eq = *p;
+		if(eq->node->op == op_ident && FPVM2SYM(eq->node->sym) == eq->sym) {
+			/* the variable already holds the value */
+			*p = eq->next;
+			parse_free(eq->node);
+			free(eq);
+			continue;
+		}
+		set_current(s, eq->sym, vn);
+		if(node_is_op(eq->node) && s->values[vn].count > 1)
+			s->values[vn].holder = eq->sym;
+		p = &eq->next;
+	}
+	eqs->tail = p;
+}
+
+void optimize_equations(struct optimizer *opt, struct equations *eqs)
+{
+	struct state s = {
+		.opt = opt,
+	};
+	struct equation *eq;
+
+	if(opt->flags & COMP_SIMPLIFY)
+		for(eq = eqs->head; eq; eq = eq->next)
+			eq->node = simplify(eq->node);
+	if((opt->flags & COMP_DCE) && opt->initial) {
+		fold_constants(&s, eqs);
+		free_state(&s);
+		memset(&s, 0, sizeof(s));
+		s.opt = opt;
+	}
+	if(opt->flags & COMP_DCE) {
+		eliminate_dead(&s, eqs);
+		free_state(&s);
+		memset(&s, 0, sizeof(s));
+		s.opt = opt;
+	}
+	if(opt->flags & COMP_CSE) {
+		new_value(&s);
+		eliminate_common(&s, eqs);
+	}
+	free_state(&s);
+}
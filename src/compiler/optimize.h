@@ -0,0 +1,77 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __OPTIMIZE_H
+#define __OPTIMIZE_H
+
+#include <stdbool.h>
+
+#include "symtab.h"
+
+struct ast_node;
+
+/*
+ * Optimization of the equations of a fragment, between the parser and FPVM.
+ *
+ * The equations of a fragment are kept until it is complete.
+ * optimize_equations then rewrites them, in this order:
+ * - COMP_SIMPLIFY applies algebraic identities: x+0, x-0, x*1 and x/1 are
+ *   x, x*x is sqr(x), -(-x) is x and x/c is x*(1/c) for constant c,
+ * - COMP_DCE turns the only assignment of a constant to a variable that is
+ *   not read before into the initial value of the variable, if initial
+ *   accepts it, then removes the assignments to variables whose value never
+ *   reaches an output of the fragment,
+ * - COMP_CSE numbers the values of all the subexpressions, across equations
+ *   and assignments. A value computed several times is computed once, into
+ *   the variable it is first assigned to if it is still there, or else into
+ *   a temporary assigned before its first use, on the line of that use.
+ */
+
+struct equation {
+	struct sym *sym;
+	struct ast_node *node;
+	int bind_mode;			/* FPVM_BIND_* in effect */
+	int lineno;			/* in the patch, 0 if not from it */
+	struct equation *next;
+};
+
+struct equations {
+	struct equation *head;
+	struct equation **tail;
+	int bind_mode;			/* for the next equation */
+};
+
+struct optimizer {
+	struct symtab *symtab;
+	int flags;			/* COMP_SIMPLIFY, COMP_DCE, COMP_CSE */
+	/* the value of sym is used outside of the fragment */
+	bool (*output)(void *arg, const struct sym *sym);
+	/* makes value the initial value of sym, or returns false; can be NULL */
+	bool (*initial)(void *arg, const struct sym *sym, float value);
+	void *arg;
+	int n_temps;			/* temporaries made so far */
+};
+
+void equations_init(struct equations *eqs, int bind_mode);
+/* takes node */
+void equations_add(struct equations *eqs, struct sym *sym,
+    struct ast_node *node, int lineno);
+void equations_free(struct equations *eqs);
+
+void optimize_equations(struct optimizer *opt, struct equations *eqs);
+
+#endif /* __OPTIMIZE_H */
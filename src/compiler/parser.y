@@ -40,14 +40,16 @@ static void yy_parse_failed(struct yyParser *yypParser);
 typedef const char *(*assign_callback)(struct parser_comm *comm,
 	    struct sym *sym, struct ast_node *node);
 
-static struct stim_db_midi *midi_dev;
-
 #define	FAIL(msg, ...)					\
 	do {						\
 		error(state, msg, ##__VA_ARGS__);	\
 		yy_parse_failed(yypParser);		\
 	} while (0)
 
+/* per-compilation state of a symbol, see symtab.h */
+#define	VAR(sym)	sym_var(state->comm->symtab, (sym))
+#define	VAR_W(sym)	sym_var_w(state->comm->symtab, (sym))
+
 #define	OTHER_STYLE_new_style	old_style
 #define	OTHER_STYLE_old_style	new_style
 
@@ -178,12 +180,12 @@ static struct ast_node *conditional(struct ast_node *a,
 	}
 }
 
-static struct id *symbolify(struct id *id)
+static struct id *symbolify(struct parser_state *state, struct id *id)
 {
 	const char *p;
 
 	for(p = id->label; isalnum(*p); p++);
-	id->sym = unique_n(id->label, p-id->label);
+	id->sym = unique_n(state->comm->symtab, id->label, p-id->label);
 	return id;
 }
 
@@ -279,8 +281,8 @@ start ::= TOK_START_ASSIGN sections. {
 	if(warn_undefined && state->style == old_style) {
 		const struct sym *sym;
 
-		foreach_sym(sym)
-			if(!(sym->flags & (SF_SYSTEM | SF_ASSIGNED)))
+		foreach_sym(state->comm->symtab, sym)
+			if(!(VAR(sym)->flags & (SF_SYSTEM | SF_ASSIGNED)))
 				warn(state,
 				    "variable %s is only read, never set",
 				    sym->fpvm_sym.name);
@@ -317,14 +319,14 @@ assignments ::= .
 
 
 assignment ::= ident(I) TOK_ASSIGN expr(N) opt_if(IF) opt_semi. {
-	I->sym->flags |= SF_ASSIGNED;
+	VAR_W(I->sym)->flags |= SF_ASSIGNED;
 	/*
 	 * The conditions are as follows:
 	 * - we must be outside compile_chunk (has different rules)
 	 * - must be in the initial section
 	 * - must not assign to a per-frame system variable
 	 */
-	if(I->sym->flags & SF_CONST) {
+	if(VAR(I->sym)->flags & SF_CONST) {
 		FAIL("\"%s\" is a constant", I->sym->fpvm_sym.name);
 		return;
 	}
@@ -352,6 +354,7 @@ assignment ::= ident(I) TOK_ASSIGN expr(N) opt_if(IF) opt_semi. {
 			var = node(I->token, I->sym, NULL, NULL, NULL);
 			N = conditional(IF, N, var);
 		}
+		state->comm->lineno = I->lineno;
 		msg = state->assign(state->comm, I->sym, N);
 		free(I);
 		if(msg) {
@@ -378,7 +381,7 @@ opt_if(IF) ::= TOK_IF expr(E).	{ IF = E; }
 assignment ::= midi_device TOK_LBRACE midi_inputs TOK_RBRACE opt_semi.
 
 midi_device ::= TOK_MIDI TOK_STRING(S). {
-	midi_dev = stim_db_midi(S->label);
+	state->midi_dev = stim_db_midi(&state->stim_db, S->label);
 	free(S);
 }
 
@@ -390,7 +393,7 @@ midi_input ::= ident(I) TOK_ASSIGN midi_dev_type(T) TOK_LPAREN midi_addr(M)
     TOK_RPAREN opt_semi. {
 	int ok;
 
-	ok = stim_db_midi_ctrl(midi_dev, I->sym, T, M.chan, M.ctrl);
+	ok = stim_db_midi_ctrl(state->midi_dev, I->sym, T, M.chan, M.ctrl);
 	if(!ok) {
 		FAIL("cannot add MIDI input \"%s\"", I->sym->fpvm_sym.name);
 		free(I);
@@ -441,17 +444,18 @@ midi_addr(M) ::= expr(A) opt_arg(B). {
 assignment ::= ident(I) TOK_ASSIGN midi_fn_type(T) TOK_LPAREN ident(D)
     TOK_RPAREN opt_semi.  {
 	struct sym *sym = I->sym;
+	struct sym *var = VAR_W(sym);
 	struct stimuli *stim = compiler_get_stimulus(state->comm->u.sc);
 	struct sym_stim *ref;
 
-	if(I->sym->flags & SF_CONST) {
+	if(var->flags & SF_CONST) {
 		FAIL("\"%s\" is a constant", I->sym->fpvm_sym.name);
 		free(I);
 		free(D);
 		return;
 	}
 	free(I);
-	if(sym->flags & SF_LIVE) {
+	if(var->flags & SF_LIVE) {
 		FAIL("\"%s\" cannot be used as control variable",
 		    sym->fpvm_sym.name);
 		free(D);
@@ -463,16 +467,16 @@ assignment ::= ident(I) TOK_ASSIGN midi_fn_type(T) TOK_LPAREN ident(D)
 		free(D);
 		return;
 	}
-	ref->regs = stim_bind(stim, D->sym, T);
+	ref->regs = stim_bind(&state->stim_db, stim, D->sym, T);
 	free(D);
 	if(!ref->regs) {
 		FAIL("cannot add stimulus for MIDI input \"%s\"",
 		    sym->fpvm_sym.name);
 		return;
 	}
-	ref->next = sym->stim;
-	sym->stim = ref;
-	sym->flags |= SF_ASSIGNED;
+	ref->next = var->stim;
+	var->stim = ref;
+	var->flags |= SF_ASSIGNED;
 }
 
 midi_fn_type(T) ::= TOK_RANGE.		{ T = ft_range; }
@@ -521,13 +525,15 @@ assignment ::= TOK_IMAGEFILES TOK_ASSIGN file_list(L) opt_semi. {
 			return;
 		}
 		if(p->tag) {
-			if(p->tag->flags & (SF_ASSIGNED | SF_SYSTEM)) {
+			struct sym *var = VAR_W(p->tag);
+
+			if(var->flags & (SF_ASSIGNED | SF_SYSTEM)) {
 				FAIL("tag \"%s\" is already in use",
 				    p->tag->fpvm_sym.name);
 				return;
 			}
-			p->tag->flags |= SF_ASSIGNED | SF_CONST;
-			p->tag->f = i;
+			var->flags |= SF_ASSIGNED | SF_CONST;
+			var->f = i;
 		}
 		i++;
 	}
@@ -796,11 +802,11 @@ primary_expr(N) ::= TOK_CONSTANT(C). {
 
 primary_expr(N) ::= ident(I). {
 	if(warn_undefined && state->style == new_style &&
-	    !(I->sym->flags & (SF_SYSTEM | SF_ASSIGNED)))
+	    !(VAR(I->sym)->flags & (SF_SYSTEM | SF_ASSIGNED)))
 		warn(state, "reading undefined variable %s",
 		    I->sym->fpvm_sym.name);
-	if(I->sym->flags & SF_CONST)
-		N = constant(I->sym->f);
+	if(VAR(I->sym)->flags & SF_CONST)
+		N = constant(VAR(I->sym)->f);
 	else
 		N = node(I->token, I->sym, NULL, NULL, NULL);
 	free(I);
@@ -836,19 +842,19 @@ ident(O) ::= TOK_IDENT(I). {
 	O = I;
 }
 
-ident(O) ::= unary(I).		{ O = symbolify(I); }
-ident(O) ::= unary_misc(I).	{ O = symbolify(I); }
-ident(O) ::= binary(I).		{ O = symbolify(I); }
-ident(O) ::= binary_misc(I).	{ O = symbolify(I); }
-ident(O) ::= TOK_MIDI(I).	{ O = symbolify(I); }
-ident(O) ::= TOK_FADER(I).	{ O = symbolify(I); }
-ident(O) ::= TOK_POT(I).	{ O = symbolify(I); }
-ident(O) ::= TOK_DIFF(I).	{ O = symbolify(I); }
-ident(O) ::= TOK_BUTTON(I).	{ O = symbolify(I); }
-ident(O) ::= TOK_SWITCH(I).	{ O = symbolify(I); }
-ident(O) ::= TOK_RANGE(I).	{ O = symbolify(I); }
-ident(O) ::= TOK_CYCLIC(I).	{ O = symbolify(I); }
-ident(O) ::= TOK_UNBOUNDED(I).	{ O = symbolify(I); }
+ident(O) ::= unary(I).		{ O = symbolify(state, I); }
+ident(O) ::= unary_misc(I).	{ O = symbolify(state, I); }
+ident(O) ::= binary(I).		{ O = symbolify(state, I); }
+ident(O) ::= binary_misc(I).	{ O = symbolify(state, I); }
+ident(O) ::= TOK_MIDI(I).	{ O = symbolify(state, I); }
+ident(O) ::= TOK_FADER(I).	{ O = symbolify(state, I); }
+ident(O) ::= TOK_POT(I).	{ O = symbolify(state, I); }
+ident(O) ::= TOK_DIFF(I).	{ O = symbolify(state, I); }
+ident(O) ::= TOK_BUTTON(I).	{ O = symbolify(state, I); }
+ident(O) ::= TOK_SWITCH(I).	{ O = symbolify(state, I); }
+ident(O) ::= TOK_RANGE(I).	{ O = symbolify(state, I); }
+ident(O) ::= TOK_CYCLIC(I).	{ O = symbolify(state, I); }
+ident(O) ::= TOK_UNBOUNDED(I).	{ O = symbolify(state, I); }
 
 unary_misc(O) ::= TOK_ABS(I).	{ O = I; }
 unary_misc(O) ::= TOK_COS(I).	{ O = I; }
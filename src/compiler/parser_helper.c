@@ -128,6 +128,7 @@ int parse(const char *expr, int start_token, struct parser_comm *comm)
 	char *error = NULL;
 
 	comm->msg = NULL;
+	stim_db_init(&state.stim_db);
 	s = new_scanner((unsigned char *)expr);
 	p = ParseAlloc(malloc);
 	Parse(p, start_token, NULL, &state);
@@ -139,6 +140,7 @@ int parse(const char *expr, int start_token, struct parser_comm *comm)
 			    s->lineno, printable_char(s->cursor[-1]));
 			ParseFree(p, free);
 			delete_scanner(s);
+			stim_db_free(&state.stim_db);
 			comm->msg = error;
 			return 0;
 		}
@@ -157,11 +159,11 @@ int parse(const char *expr, int start_token, struct parser_comm *comm)
 			identifier->label = identifier->fname;
 			break;
 		case TOK_IDENT:
-			identifier->sym = get_symbol(s);
+			identifier->sym = get_symbol(s, comm->symtab);
 			identifier->label = identifier->sym->fpvm_sym.name;
 			break;
 		case TOK_TAG:
-			identifier->sym = get_tag(s);
+			identifier->sym = get_tag(s, comm->symtab);
 			identifier->label = identifier->sym->fpvm_sym.name;
 			break;
 		case TOK_STRING:
@@ -186,6 +188,7 @@ int parse(const char *expr, int start_token, struct parser_comm *comm)
 	Parse(p, TOK_EOF, NULL, &state);
 	ParseFree(p, free);
 	delete_scanner(s);
+	stim_db_free(&state.stim_db);
 
 	free(identifier);
 
@@ -35,6 +35,7 @@ struct parser_comm {
 		struct fpvm_fragment *fragment;
 		struct compiler_sc *sc;
 	} u;
+	struct symtab *symtab;
 	const char *(*assign_default)(struct parser_comm *comm,
 	    struct sym *sym, struct ast_node *node);
 	const char *(*assign_per_frame)(struct parser_comm *comm,
@@ -43,6 +44,7 @@ struct parser_comm {
 	    struct sym *sym, struct ast_node *node);
 	const char *(*assign_image_name)(struct parser_comm *comm,
 	    int number, const char *name);
+	int lineno; /* of the assignment passed to assign_* */
 	const char *msg; /* NULL if neither error nor warning */
 };
 
@@ -47,6 +47,9 @@ struct parser_state {
 
 	const struct id *id;	/* input, for error handling */
 
+	struct stim_db stim_db;	/* MIDI devices declared so far */
+	struct stim_db_midi *midi_dev;
+
 	enum {
 		unknown_style,	/* haven't seen any fragment selection yet */
 		old_style,	/* patch uses per_frame=var=expr */
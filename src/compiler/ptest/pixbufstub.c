@@ -0,0 +1,114 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "../../pixbuf/pixbuf.h"
+#include "pixbufstub.h"
+
+/* ptest -P compiles with several threads */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pixbuf *head;
+
+void pixbuf_inc_ref(struct pixbuf *p)
+{
+	if(p == NULL)
+		return;
+	pthread_mutex_lock(&lock);
+	p->refcnt++;
+	pthread_mutex_unlock(&lock);
+}
+
+void pixbuf_dec_ref(struct pixbuf *p)
+{
+	struct pixbuf **anchor;
+
+	if(p == NULL)
+		return;
+	pthread_mutex_lock(&lock);
+	if(--p->refcnt) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	for(anchor = &head; *anchor != p; anchor = &(*anchor)->next);
+	*anchor = p->next;
+	pthread_mutex_unlock(&lock);
+	free(p->filename);
+	free(p);
+}
+
+struct pixbuf *pixbuf_get(char *filename)
+{
+	struct pixbuf *p;
+	struct stat st;
+
+	if(lstat(filename, &st) < 0)
+		return NULL;
+	pthread_mutex_lock(&lock);
+	for(p = head; p; p = p->next)
+		if(strcmp(p->filename, filename) == 0 &&
+		    st.st_mtime == p->st.st_mtime) {
+			p->refcnt++;
+			pthread_mutex_unlock(&lock);
+			return p;
+		}
+	pthread_mutex_unlock(&lock);
+
+	p = calloc(1, sizeof(struct pixbuf));
+	if(p == NULL)
+		return NULL;
+	p->filename = strdup(filename);
+	if(p->filename == NULL) {
+		free(p);
+		return NULL;
+	}
+	p->refcnt = 1;
+	p->st = st;
+	pthread_mutex_lock(&lock);
+	p->next = head;
+	head = p;
+	pthread_mutex_unlock(&lock);
+	return p;
+}
+
+struct pixbuf *pixbuf_update(struct pixbuf *p)
+{
+	struct stat st;
+
+	if(lstat(p->filename, &st) < 0)
+		return NULL;
+	if(st.st_mtime == p->st.st_mtime) {
+		pixbuf_inc_ref(p);
+		return p;
+	}
+	return pixbuf_get(p->filename);
+}
+
+int pixbuf_stub_count(void)
+{
+	struct pixbuf *p;
+	int n = 0;
+
+	pthread_mutex_lock(&lock);
+	for(p = head; p; p = p->next)
+		n++;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
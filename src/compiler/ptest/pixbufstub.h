@@ -0,0 +1,30 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PIXBUFSTUB_H
+#define __PIXBUFSTUB_H
+
+/*
+ * The pixbuf manager of the standalone builds (ptest and rtest). Any file
+ * can be "loaded": the pixbufs are shared and counted as on the board, but
+ * they have no pixels.
+ */
+
+/* pixbufs still referenced */
+int pixbuf_stub_count(void);
+
+#endif /* __PIXBUFSTUB_H */
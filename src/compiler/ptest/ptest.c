@@ -11,23 +11,43 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "fpvm/pfpu.h"
 #include "fpvm/schedulers.h"
 
 #include "../parser_helper.h"
 #include "../parser.h"
+#include "../scanner.h"
 #include "../compiler.h"
 #include "../symtab.h"
+#include "../../renderer/softpfpu.h"
+#include "../../renderer/vpfpu.h"
+#include "../../renderer/tilepool.h"
+#include "../../renderer/stimuli.h"
+#include "../../patchcache.h"
+#include "pixbufstub.h"
 
 
 static int quiet = 0;
 static int symbols = 0;
 static const char *fail = NULL;
 static const char *trace_var = NULL;
+static int execute = 0;
+static int mesh = 0;
+static unsigned hmeshlast = 0, vmeshlast = 0;
+static int threads = 0, tile_rows = 0;
+static int optimize = COMP_OPTIMIZE;
+static const char *cache_file = NULL;
+static char *image_dir = NULL;
 static const char *buffer;
+static struct symtab symtab;
 
 
 /* ----- Parse the patch into the AST -------------------------------------- */
@@ -201,13 +221,13 @@ static const char *assign_image_name(struct parser_comm *comm,
 }
 
 
-static void report(const char *s)
+static void report(void *arg, const char *s)
 {
 	fprintf(stderr, "%s\n", s);
 }
 
 
-static const char *read_stdin(void)
+static char *read_fd(int fd)
 {
 	char *buf = NULL;
 	int len = 0, size = 0;
@@ -222,7 +242,7 @@ static const char *read_stdin(void)
 				exit(1);
 			}
 		}
-		got = read(0, buf+len, size-len);
+		got = read(fd, buf+len, size-len);
 		if (got < 0) {
 			perror("read");
 			exit(1);
@@ -245,6 +265,7 @@ static void parse_only(const char *pgm)
 	};
 	struct parser_comm comm = {
 		.u.sc = &sc,
+		.symtab = &symtab,
 		.assign_default = assign_default,
 		.assign_per_frame = assign_per_frame,
 		.assign_per_vertex = assign_per_vertex,
@@ -252,25 +273,25 @@ static void parse_only(const char *pgm)
 	};
 	int ok;
 
-	symtab_init();
+	symtab_init(&symtab);
 	ok = parse(pgm, TOK_START_ASSIGN, &comm);
 	if (symbols) {
-		const struct sym *sym;
+		const struct sym *sym, *var;
 		int user = 0;
 
-		foreach_sym(sym) {
-			if (!user && !(sym->flags & SF_SYSTEM)) {
+		foreach_sym(&symtab, sym) {
+			var = sym_var(&symtab, sym);
+			if (!user && !(var->flags & SF_SYSTEM)) {
 				printf("\n");
 				user = 1;
 			}
-			if (sym->flags & SF_CONST)
-				printf("%s = %g\n", sym->fpvm_sym.name, sym->f);
+			if (var->flags & SF_CONST)
+				printf("%s = %g\n", sym->fpvm_sym.name, var->f);
 			else
 				printf("%s\n", sym->fpvm_sym.name);
 		}
 	}
-	symtab_free();
-	stim_db_free(); /* @@@ */
+	symtab_free(&symtab);
 	stim_put(patch.stim);
 	if (ok)
 		return;
@@ -295,7 +316,7 @@ static const char *lookup_name(int idx, struct sym *sym, const int *field)
 {
 	const struct sym *walk;
 
-	foreach_sym(walk) {
+	foreach_sym(&symtab, walk) {
 		*sym = *walk;
 		if (*field == idx)
 			return walk->fpvm_sym.name;
@@ -379,16 +400,17 @@ static void add_midi(const char *s)
 
 static void play_midi(struct patch *patch)
 {
-	struct sym *sym;
+	const struct sym *sym;
 	struct sym_stim *r;
 	float f = 0;
 
-	sym = unique(trace_var);
+	sym = unique(&symtab, trace_var);
 	if (!sym) {
 		fprintf(stderr, "can't find trace variable \"%s\"\n",
 		    trace_var);
 		exit(1);
 	}
+	sym = sym_var(&symtab, sym);
 	if (!sym->stim) {
 		fprintf(stderr, "\"%s\" is not a control variable\n",
 		    trace_var);
@@ -406,27 +428,316 @@ static void play_midi(struct patch *patch)
 }
 
 
-static void compile(const char *pgm, int framework)
+/* ----- Execute the compiled patch in the software PFPU ------------------- */
+
+
+#define	TEXSIZE	512	/* renderer_texsize */
+
+
+static float read_pfv(const struct patch *patch, int pfv)
+{
+	if (patch->pfv_allocation[pfv] < 0)
+		return patch->pfv_initial[pfv];
+	return patch->perframe_regs[patch->pfv_allocation[pfv]];
+}
+
+
+static void write_pvv(struct patch *patch, int pvv, float f)
+{
+	if (patch->pvv_allocation[pvv] >= 0)
+		patch->pervertex_regs[patch->pvv_allocation[pvv]] = f;
+}
+
+
+/*
+ * Same as transfer_pvv_regs in renderer/eval.c, but we let the symbol table
+ * tell us which variables exist in both fragments.
+ */
+
+static void transfer_regs(struct patch *patch)
+{
+	const struct sym *sym;
+	int i;
+
+	write_pvv(patch, pvv_texsize, TEXSIZE << TMU_FIXEDPOINT_SHIFT);
+	write_pvv(patch, pvv_hmeshsize, hmeshlast ? 1.0/hmeshlast : 0);
+	write_pvv(patch, pvv_vmeshsize, vmeshlast ? 1.0/vmeshlast : 0);
+	foreach_sym(&symtab, sym)
+		if (sym->pfv_idx >= 0 && sym->pvv_idx >= 0)
+			write_pvv(patch, sym->pvv_idx,
+			    read_pfv(patch, sym->pfv_idx));
+	for (i = 0; i != patch->n_hoisted; i++)
+		if (patch->hoisted_pfv[i] >= 0 && patch->hoisted_pvv[i] >= 0)
+			patch->pervertex_regs[patch->hoisted_pvv[i]] =
+			    patch->perframe_regs[patch->hoisted_pfv[i]];
+}
+
+
+static void run_patch(struct patch *patch)
+{
+	static unsigned pfv_out[2];
+	static struct tmu_vertex vertices[TMU_MESH_MAXSIZE*TMU_MESH_MAXSIZE];
+	struct pfpu_td td = {
+		.output = pfv_out,
+		.hmeshlast = 0,
+		.vmeshlast = 0,
+		.program = patch->perframe_prog,
+		.progsize = patch->perframe_prog_length,
+		.registers = patch->perframe_regs,
+		.update = true,
+		.invalidate = false,
+	};
+	struct sym sym;
+	unsigned x, y;
+	int i;
+
+	if (execute > 2) {
+		patch->perframe_vprog = vpfpu_new(patch->perframe_prog,
+		    patch->perframe_prog_length, true);
+		if (!patch->perframe_vprog) {
+			perror("vpfpu_new");
+			exit(1);
+		}
+		vpfpu_execute_frame(patch->perframe_vprog,
+		    patch->perframe_regs);
+	} else {
+		softpfpu_execute(&td);
+	}
+	for (i = 0; i != COMP_PFV_COUNT; i++)
+		if (patch->pfv_allocation[i] != -1)
+			printf("%s = %g\n", lookup_name(i, &sym, &sym.pfv_idx),
+			    patch->perframe_regs[patch->pfv_allocation[i]]);
+	if (!mesh)
+		return;
+
+	transfer_regs(patch);
+	if (execute > 1) {
+		static struct vpfpu_prog lowered;
+		struct vpfpu_prog *vp = &lowered;
+
+		if (execute > 2) {
+			vp = patch->pervertex_vprog =
+			    vpfpu_new(patch->pervertex_prog,
+			    patch->pervertex_prog_length, true);
+			if (!vp) {
+				perror("vpfpu_new");
+				exit(1);
+			}
+		} else {
+			vpfpu_lower(vp, patch->pervertex_prog,
+			    patch->pervertex_prog_length);
+		}
+		if (threads) {
+			struct tile_pool *pool;
+
+			pool = tile_pool_new(threads, tile_rows);
+			if (!pool) {
+				perror("tile_pool_new");
+				exit(1);
+			}
+			tile_pool_run(pool, vp, patch->pervertex_regs,
+			    vertices, hmeshlast, vmeshlast);
+			tile_pool_free(pool);
+		} else {
+			vpfpu_execute(vp, patch->pervertex_regs, vertices,
+			    hmeshlast, vmeshlast);
+		}
+	} else {
+		td.output = (unsigned *) vertices;
+		td.hmeshlast = hmeshlast;
+		td.vmeshlast = vmeshlast;
+		td.program = patch->pervertex_prog;
+		td.progsize = patch->pervertex_prog_length;
+		td.registers = patch->pervertex_regs;
+		td.update = false;
+		softpfpu_execute(&td);
+	}
+	for (y = 0; y <= vmeshlast; y++)
+		for (x = 0; x <= hmeshlast; x++)
+			printf("%u,%u: %d %d\n", x, y,
+			    vertices[y*TMU_MESH_MAXSIZE+x].x,
+			    vertices[y*TMU_MESH_MAXSIZE+x].y);
+}
+
+
+/* ----- Store the compiled patch in the patch cache and reload it --------- */
+
+
+static int cache_differs;
+
+
+static void differs(const char *what)
+{
+	printf("cache: %s differs\n", what);
+	cache_differs = 1;
+}
+
+
+static void cmp_cached(const char *what, const void *a, const void *b,
+    size_t size)
+{
+	if (memcmp(a, b, size))
+		differs(what);
+}
+
+
+static int reg_index(const float *reg, const float *regs)
+{
+	return reg ? reg-regs : -1;
+}
+
+
+static const struct s_midi_ctrl *midi_ctrls(const struct stimuli *s,
+    int chan, int ctrl)
+{
+	return s && s->midi[chan] ? s->midi[chan]->ctrl[ctrl] : NULL;
+}
+
+
+/*
+ * The MIDI controllers must be bound, in the same order, to the same
+ * processors and to the same registers of their patch.
+ */
+
+static void cmp_stim(const struct patch *a, const struct patch *b)
+{
+	const struct s_midi_ctrl *ca, *cb;
+	int chan, ctrl;
+
+	if (!a->stim != !b->stim) {
+		differs("stim");
+		return;
+	}
+	for (chan = 0; chan != MIDI_CHANS+1; chan++)
+		for (ctrl = 0; ctrl != MIDI_CTRLS; ctrl++) {
+			ca = midi_ctrls(a->stim, chan, ctrl);
+			cb = midi_ctrls(b->stim, chan, ctrl);
+			while (ca && cb) {
+				if (stim_proc_id(ca) != stim_proc_id(cb) ||
+				    reg_index(ca->regs.pfv, a->perframe_regs) !=
+				    reg_index(cb->regs.pfv, b->perframe_regs) ||
+				    reg_index(ca->regs.pvv, a->pervertex_regs) !=
+				    reg_index(cb->regs.pvv, b->pervertex_regs))
+					break;
+				ca = ca->next;
+				cb = cb->next;
+			}
+			if (ca || cb) {
+				differs("stim");
+				return;
+			}
+		}
+}
+
+
+static void cmp_patch(const struct patch *a, const struct patch *b)
+{
+	cmp_cached("pfv_initial", a->pfv_initial, b->pfv_initial,
+	    sizeof(a->pfv_initial));
+	cmp_cached("pfv_allocation", a->pfv_allocation, b->pfv_allocation,
+	    sizeof(a->pfv_allocation));
+	if (a->perframe_prog_length != b->perframe_prog_length)
+		differs("perframe_prog_length");
+	else
+		cmp_cached("perframe_prog", a->perframe_prog,
+		    b->perframe_prog,
+		    a->perframe_prog_length*sizeof(*a->perframe_prog));
+	cmp_cached("perframe_regs", a->perframe_regs, b->perframe_regs,
+	    sizeof(a->perframe_regs));
+	cmp_cached("pvv_allocation", a->pvv_allocation, b->pvv_allocation,
+	    sizeof(a->pvv_allocation));
+	if (a->pervertex_prog_length != b->pervertex_prog_length)
+		differs("pervertex_prog_length");
+	else
+		cmp_cached("pervertex_prog", a->pervertex_prog,
+		    b->pervertex_prog,
+		    a->pervertex_prog_length*sizeof(*a->pervertex_prog));
+	cmp_cached("pervertex_regs", a->pervertex_regs, b->pervertex_regs,
+	    sizeof(a->pervertex_regs));
+	if (a->n_hoisted != b->n_hoisted) {
+		differs("n_hoisted");
+	} else {
+		cmp_cached("hoisted_pfv", a->hoisted_pfv, b->hoisted_pfv,
+		    a->n_hoisted*sizeof(*a->hoisted_pfv));
+		cmp_cached("hoisted_pvv", a->hoisted_pvv, b->hoisted_pvv,
+		    a->n_hoisted*sizeof(*a->hoisted_pvv));
+	}
+	if (a->require != b->require)
+		differs("require");
+	if (a->disabled != b->disabled)
+		differs("disabled");
+	cmp_stim(a, b);
+}
+
+
+/*
+ * On a hit, the reloaded patch must be the one just compiled. On a miss,
+ * the patch is added to the cache.
+ */
+
+static void use_cache(const struct patch *patch, const char *pgm)
+{
+	struct patch *cached;
+
+	patchcache_load(cache_file);
+	cached = patchcache_lookup(image_dir ? image_dir : "/", pgm);
+	if (cached) {
+		cache_differs = 0;
+		cmp_patch(patch, cached);
+		if (!cache_differs)
+			printf("cache: hit\n");
+		patch_free(cached);
+	} else {
+		printf("cache: miss\n");
+		patchcache_store(image_dir ? image_dir : "/", pgm, patch);
+	}
+	if (!patchcache_save(cache_file)) {
+		perror(cache_file);
+		exit(1);
+	}
+	patchcache_free();
+}
+
+
+/* the images must go with the last patch that uses them */
+
+static void check_pixbufs(void)
+{
+	int n;
+
+	n = pixbuf_stub_count();
+	if (n) {
+		fprintf(stderr, "%d image(s) still referenced\n", n);
+		exit(1);
+	}
+}
+
+
+static void compile(const char *pgm, int flags)
 {
 	struct patch *patch;
 
-	patch = patch_do_compile("/", pgm, report, framework);
+	patch = patch_do_compile(image_dir, pgm, report, NULL, &symtab, flags,
+	    NULL);
 	if (!patch) {
-		symtab_free();
+		symtab_free(&symtab);
+		check_pixbufs();
 		exit(1);
 	}
 	if (!quiet)
 		show_patch(patch);
+	if (cache_file)
+		use_cache(patch, pgm);
 	if (trace_var)
 		play_midi(patch);
-	symtab_free();
-	stim_put(patch->stim);
-	/*
-	 * We can't use patch_free here because that function also accesses
-	 * image data, which isn't available in standalone builds. A simple
-	 * free(3) has the same effect in this case.
-	 */
-	free(patch);
+	if (execute)
+		run_patch(patch);
+	symtab_free(&symtab);
+	/* patch_free only knows about them with WITH_SOFTPFPU */
+	vpfpu_free(patch->perframe_vprog);
+	vpfpu_free(patch->pervertex_vprog);
+	patch_free(patch);
+	check_pixbufs();
 }
 
 
@@ -466,6 +777,7 @@ static void compile_vm(const char *pgm)
 	struct fpvm_fragment fragment;
 	struct parser_comm comm = {
 		.u.fragment = &fragment,
+		.symtab = &symtab,
 		.assign_default = assign_raw,
 		.assign_per_frame = assign_raw,
 		.assign_per_vertex = assign_raw_fail,
@@ -473,14 +785,14 @@ static void compile_vm(const char *pgm)
 	};
 	int ok;
 
-	init_fpvm(&fragment, 0);
+	symtab_init(&symtab);
+	init_fpvm(&symtab, &fragment, 0);
 	fpvm_set_bind_mode(&fragment, FPVM_BIND_ALL);
-	symtab_init();
 	ok = parse(pgm, TOK_START_ASSIGN, &comm);
 
 	if (ok)
 		fpvm_dump(&fragment);
-	symtab_free();
+	symtab_free(&symtab);
 	if (ok)
 		return;
 
@@ -491,6 +803,430 @@ static void compile_vm(const char *pgm)
 }
 
 
+/* ----- Compile patch files in parallel ---------------------------------- */
+
+
+struct job {
+	const char *name;
+	int ok;
+	const char *msg;	/* first message, malloc'ed; NULL if none */
+	int perframe, pervertex;	/* program lengths */
+	uint32_t hash;
+};
+
+static struct job *jobs = NULL;
+static int n_jobs = 0, next_job;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void report_job(void *arg, const char *s)
+{
+	struct job *job = arg;
+
+	if (!job->msg)
+		job->msg = strdup(s);
+}
+
+
+static void hash(uint32_t *h, const void *buf, size_t size)
+{
+	const uint8_t *p;
+
+	for (p = buf; p != (const uint8_t *) buf+size; p++)
+		*h = (*h ^ *p)*16777619;
+}
+
+
+/*
+ * Everything the compiler produces for the PFPU, so that parallel and
+ * sequential compilation can be compared.
+ */
+
+static uint32_t hash_patch(const struct patch *patch)
+{
+	uint32_t h = 2166136261u;
+
+	hash(&h, patch->pfv_initial, sizeof(patch->pfv_initial));
+	hash(&h, patch->pfv_allocation, sizeof(patch->pfv_allocation));
+	hash(&h, patch->perframe_prog,
+	    patch->perframe_prog_length*sizeof(*patch->perframe_prog));
+	hash(&h, patch->perframe_regs, sizeof(patch->perframe_regs));
+	hash(&h, patch->pvv_allocation, sizeof(patch->pvv_allocation));
+	hash(&h, patch->pervertex_prog,
+	    patch->pervertex_prog_length*sizeof(*patch->pervertex_prog));
+	hash(&h, patch->pervertex_regs, sizeof(patch->pervertex_regs));
+	hash(&h, patch->hoisted_pfv,
+	    patch->n_hoisted*sizeof(*patch->hoisted_pfv));
+	hash(&h, patch->hoisted_pvv,
+	    patch->n_hoisted*sizeof(*patch->hoisted_pvv));
+	return h;
+}
+
+
+static void run_job(struct job *job)
+{
+	struct patch *patch;
+	char *code;
+	int fd;
+
+	fd = open(job->name, O_RDONLY);
+	if (fd < 0) {
+		job->msg = strdup(strerror(errno));
+		return;
+	}
+	code = read_fd(fd);
+	close(fd);
+	patch = patch_do_compile(image_dir, code, report_job, job, NULL,
+	    COMP_FRAMEWORK | optimize, NULL);
+	free(code);
+	if (!patch)
+		return;
+	job->ok = 1;
+	job->perframe = patch->perframe_prog_length;
+	job->pervertex = patch->pervertex_prog_length;
+	job->hash = hash_patch(patch);
+	patch_free(patch);
+}
+
+
+static void *compile_jobs(void *arg)
+{
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&job_lock);
+		i = next_job++;
+		pthread_mutex_unlock(&job_lock);
+		if (i >= n_jobs)
+			return NULL;
+		run_job(jobs+i);
+	}
+}
+
+
+/* "names" holds one file name per line and is modified */
+
+static void add_jobs(char *names)
+{
+	char *s, *nl;
+
+	for (s = names; *s; s = nl) {
+		nl = strchr(s, '\n');
+		if (nl)
+			*nl++ = 0;
+		else
+			nl = strchr(s, 0);
+		if (!*s)
+			continue;
+		jobs = realloc(jobs, (n_jobs+1)*sizeof(*jobs));
+		if (!jobs) {
+			perror("realloc");
+			exit(1);
+		}
+		jobs[n_jobs].name = s;
+		n_jobs++;
+	}
+}
+
+
+/*
+ * Prints the number of per-frame and per-vertex instructions and the hash of
+ * each patch, or its first error, in the order of the file names.
+ */
+
+static void compile_files(int n_threads)
+{
+	pthread_t workers[n_threads];
+	struct job *job;
+	int i, failed = 0;
+
+	for (job = jobs; job != jobs+n_jobs; job++) {
+		job->ok = 0;
+		job->msg = NULL;
+	}
+	next_job = 0;
+	for (i = 0; i != n_threads; i++)
+		if (pthread_create(workers+i, NULL, compile_jobs, NULL)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	for (i = 0; i != n_threads; i++)
+		pthread_join(workers[i], NULL);
+
+	for (job = jobs; job != jobs+n_jobs; job++) {
+		if (job->ok)
+			printf("%s: %d %d %08x\n", job->name,
+			    job->perframe, job->pervertex, job->hash);
+		else {
+			printf("%s: %s\n", job->name,
+			    job->msg ? job->msg : "failed");
+			failed = 1;
+		}
+		free((void *) job->msg);
+	}
+	if (failed)
+		exit(1);
+}
+
+
+/* ----- Allocation counting ----------------------------------------------- */
+
+
+/*
+ * ptest is linked with --wrap for malloc, calloc and realloc (see Makefile),
+ * so that we see the allocations of the compiler and of libfpvm. Those made
+ * inside the C library, e.g., by strdup, are not counted.
+ */
+
+static unsigned long allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+
+void *__wrap_malloc(size_t size)
+{
+	__sync_fetch_and_add(&allocs, 1);
+	return __real_malloc(size);
+}
+
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__sync_fetch_and_add(&allocs, 1);
+	return __real_calloc(nmemb, size);
+}
+
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__sync_fetch_and_add(&allocs, 1);
+	return __real_realloc(ptr, size);
+}
+
+
+/* ----- Benchmark the compiler -------------------------------------------- */
+
+
+struct code_size {
+	int length;	/* VLIW instructions */
+	int ops;	/* instructions that are not NOPs */
+	int regs;	/* registers read or written */
+};
+
+
+static void code_size(struct code_size *size, const unsigned *prog,
+    int length)
+{
+	const pfpu_instruction *inst = (const pfpu_instruction *) prog;
+	uint8_t used[PFPU_REG_COUNT];
+	int pc, done, i;
+
+	memset(used, 0, sizeof(used));
+	size->length = length;
+	size->ops = 0;
+	for (pc = 0; pc != length; pc++) {
+		if (inst[pc].i.opcode == FPVM_OPCODE_NOP)
+			continue;
+		size->ops++;
+		used[inst[pc].i.opa] = used[inst[pc].i.opb] = 1;
+		if (inst[pc].i.opcode == FPVM_OPCODE_VECTOUT)
+			continue;
+		/* the destination is in the instruction word where it is done */
+		done = pc+pfpu_get_latency(inst[pc].i.opcode);
+		if (done < length)
+			used[inst[done].i.dest] = 1;
+	}
+	size->regs = 0;
+	for (i = 0; i != PFPU_REG_COUNT; i++)
+		size->regs += used[i];
+}
+
+
+static unsigned long long ns_since(const struct timespec *t0)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec-t0->tv_sec)*1000000000ULL+t.tv_nsec-t0->tv_nsec;
+}
+
+
+/* what the parser does besides parsing: tokens, constants and symbols */
+
+static unsigned long long scan_patch(const char *code)
+{
+	struct symtab st;
+	struct scanner *s;
+	struct timespec t0;
+	unsigned long long ns;
+	int tok;
+
+	symtab_init(&st);
+	s = new_scanner((unsigned char *) code);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (1) {
+		tok = scan(s);
+		if (tok == TOK_EOF || tok == TOK_ERROR)
+			break;
+		switch (tok) {
+		case TOK_CONSTANT:
+			get_constant(s);
+			break;
+		case TOK_FNAME:
+			free((void *) get_name(s));
+			break;
+		case TOK_IDENT:
+			get_symbol(s, &st);
+			break;
+		case TOK_TAG:
+			get_tag(s, &st);
+			break;
+		case TOK_STRING:
+			free((void *) get_string(s));
+			break;
+		default:
+			break;
+		}
+	}
+	ns = ns_since(&t0);
+	delete_scanner(s);
+	symtab_free(&st);
+	return ns;
+}
+
+
+struct bench {
+	struct code_size perframe, pervertex;
+	unsigned long allocs;
+	int assignments;
+	unsigned long long scan;
+	unsigned long long ns[COMP_PHASE_COUNT];
+};
+
+
+static void min_ns(unsigned long long *best, unsigned long long ns)
+{
+	if (ns < *best)
+		*best = ns;
+}
+
+
+/* the best time of each phase in "runs" compilations */
+
+static int bench_patch(struct job *job, struct bench *b, unsigned long runs)
+{
+	struct comp_stats stats;
+	struct patch *patch;
+	unsigned long before;
+	char *code;
+	int fd, i;
+
+	fd = open(job->name, O_RDONLY);
+	if (fd < 0) {
+		job->msg = strdup(strerror(errno));
+		return 0;
+	}
+	code = read_fd(fd);
+	close(fd);
+
+	memset(b, 0, sizeof(*b));
+	b->scan = ~0ULL;
+	for (i = 0; i != COMP_PHASE_COUNT; i++)
+		b->ns[i] = ~0ULL;
+	while (runs--) {
+		min_ns(&b->scan, scan_patch(code));
+		before = allocs;
+		patch = patch_do_compile(image_dir, code, report_job, job, NULL,
+		    COMP_FRAMEWORK | optimize, &stats);
+		b->allocs = allocs-before;
+		if (!patch) {
+			free(code);
+			return 0;
+		}
+		for (i = 0; i != COMP_PHASE_COUNT; i++)
+			min_ns(b->ns+i, stats.ns[i]);
+		b->assignments = stats.assignments;
+		code_size(&b->perframe, patch->perframe_prog,
+		    patch->perframe_prog_length);
+		code_size(&b->pervertex, patch->pervertex_prog,
+		    patch->pervertex_prog_length);
+		patch_free(patch);
+	}
+	free(code);
+	return 1;
+}
+
+
+static void print_bench(const char *name, const struct bench *b)
+{
+	int i;
+
+	printf("%s: %d %d %d %d %d %d %d %lu %.1f", name,
+	    b->perframe.length, b->perframe.ops, b->perframe.regs,
+	    b->pervertex.length, b->pervertex.ops, b->pervertex.regs,
+	    b->assignments, b->allocs, b->scan/1000.0);
+	for (i = 0; i != COMP_PHASE_COUNT; i++)
+		printf(" %.1f", b->ns[i]/1000.0);
+	putchar('\n');
+}
+
+
+static void add_bench(struct bench *sum, const struct bench *b)
+{
+	int i;
+
+	sum->perframe.length += b->perframe.length;
+	sum->perframe.ops += b->perframe.ops;
+	sum->perframe.regs += b->perframe.regs;
+	sum->pervertex.length += b->pervertex.length;
+	sum->pervertex.ops += b->pervertex.ops;
+	sum->pervertex.regs += b->pervertex.regs;
+	sum->assignments += b->assignments;
+	sum->allocs += b->allocs;
+	sum->scan += b->scan;
+	for (i = 0; i != COMP_PHASE_COUNT; i++)
+		sum->ns[i] += b->ns[i];
+}
+
+
+/*
+ * Prints, for each patch in the order of the file names, the length,
+ * operations and registers of the per-frame and the per-vertex code, the
+ * number of FPVM assignments and of allocations, and the time in
+ * microseconds spent scanning (also included in parsing), parsing,
+ * optimizing, generating FPVM code and scheduling. Then the sums over all
+ * the patches.
+ */
+
+static void bench_files(unsigned long runs)
+{
+	struct job *job;
+	struct bench b, sum;
+	int failed = 0;
+
+	memset(&sum, 0, sizeof(sum));
+	printf("# pfv: length ops regs, pvv: length ops regs, assignments, "
+	    "allocs,\n# us: scan parse optimize assign schedule\n");
+	for (job = jobs; job != jobs+n_jobs; job++) {
+		job->msg = NULL;
+		if (bench_patch(job, &b, runs)) {
+			print_bench(job->name, &b);
+			add_bench(&sum, &b);
+		} else {
+			printf("%s: %s\n", job->name,
+			    job->msg ? job->msg : "failed");
+			failed = 1;
+		}
+		free((void *) job->msg);
+	}
+	print_bench("total", &sum);
+	if (failed)
+		exit(1);
+}
+
+
 /* ----- Command-line processing ------------------------------------------- */
 
 
@@ -500,23 +1236,96 @@ static void free_buffer(void)
 }
 
 
+static int parse_optimize(const char *arg)
+{
+	static const struct {
+		const char *name;
+		int flag;
+	} opts[] = {
+		{ "hoist",	COMP_HOIST },
+		{ "simplify",	COMP_SIMPLIFY },
+		{ "cse",	COMP_CSE },
+		{ "dce",	COMP_DCE },
+		{ "retry",	COMP_RETRY },
+		{ NULL, }
+	};
+	const char *end;
+	int i;
+
+	if (!strcmp(arg, "0")) {
+		optimize = 0;
+		return 1;
+	}
+	if (!strcmp(arg, "1")) {
+		optimize = COMP_OPTIMIZE;
+		return 1;
+	}
+	optimize = 0;
+	while (1) {
+		end = strchr(arg, ',');
+		if (!end)
+			end = strchr(arg, 0);
+		for (i = 0; opts[i].name; i++)
+			if (strlen(opts[i].name) == end-arg &&
+			    !strncmp(opts[i].name, arg, end-arg))
+				break;
+		if (!opts[i].name)
+			return 0;
+		optimize |= opts[i].flag;
+		if (!*end)
+			return 1;
+		arg = end+1;
+	}
+}
+
+
 static void usage(const char *name)
 {
 	fprintf(stderr,
-"usage: %s [-c [-c [-c]]|-f error] [-m [chan.]ctrl=value ...] [-n runs]\n"
-"       %*s [-q] [-s] [-v var] [-Wwarning ...] [expr]\n\n"
+"usage: %s [-c [-c [-c]]|-f error] [-C cachefile] [-m [chan.]ctrl=value ...]\n"
+"       %*s [-I dir] [-n runs] [-O level] [-q] [-s] [-v var]\n"
+"       %*s [-x [-x [-x] [-j threads[,rows]]] [-M hmeshlast,vmeshlast]]\n"
+"       %*s [-Wwarning ...] [expr]\n"
+"       %s -c -P threads [-I dir] [-n runs] [-O level] <file-list\n"
+"       %s -c -B [-I dir] [-n runs] [-O level] <file-list\n\n"
+"  -B        compile the patch files named in file-list, one per line, and\n"
+"            print the size of their code, the allocations made and the\n"
+"            time spent in each phase of the compiler, the best of runs\n"
 "  -c        generate PFPU code and dump generated code (unless -q is set)\n"
 "  -c -c     generate and dump VM code\n"
 "  -c -c -c  generate and dump PFPU code (without patch framework)\n"
+"  -C cachefile\n"
+"            look the compiled patch up in the patch cache in cachefile and\n"
+"            print what differs from it, or store it if it is not there\n"
+"            (used with -c)\n"
 "  -f error  fail any assignment with specified error message\n"
+"  -I dir    load the image files of the patch from this directory (used\n"
+"            with -c or -c -c -c; default: the images are not loaded)\n"
+"  -j threads[,rows]\n"
+"            evaluate the mesh with this many threads, handing out tiles of\n"
+"            the given number of rows (default: 4; used with -x -x)\n"
+"  -M hmeshlast,vmeshlast\n"
+"            also run the per-vertex code on this mesh and dump the vertices\n"
 "  -m [chan.]ctrl=value\n"
 "            send a MIDI message to the stimuli subsystem\n"
 "  -n runs   run compilation repeatedly (default: run only once)\n"
+"  -O level  0 to compile without optimizations, 1 with all of them, or\n"
+"            a comma-separated list of hoist, simplify, cse, dce and retry\n"
+"            (default: 1)\n"
+"  -P threads\n"
+"            compile the patch files named in file-list, one per line, with\n"
+"            this many threads, and print the length and hash of their code\n"
 "  -q        quiet operation\n"
 "  -s        dump symbol table after parsing (only if -c is not set)\n"
 "  -v var    trace the specified variable (used with -m)\n"
+"  -x        run the PFPU code in the software PFPU and dump the per-frame\n"
+"            variables (used with -c)\n"
+"  -x -x     like -x, but run the per-vertex code in the vector evaluator\n"
+"  -x -x -x  like -x -x, but compile both programs to native code first\n"
+"            (interpreted if the host is not supported)\n"
 "  -Wwarning enable compiler warning (one of: section, undefined)\n"
-    , name, (int) strlen(name), "");
+    , name, (int) strlen(name), "", (int) strlen(name), "",
+    (int) strlen(name), "", name, name);
 	exit(1);
 }
 
@@ -525,20 +1334,52 @@ int main(int argc, char **argv)
 {
 	int c;
 	int codegen = 0;
+	int compile_threads = 0;
+	int bench = 0;
 	unsigned long repeat = 1;
 	char *end;
 
 	warn_section = 0;
 	warn_undefined = 0;
 
-	while ((c = getopt(argc, argv, "cf:m:n:qsv:W:")) != EOF)
+	while ((c = getopt(argc, argv, "BcC:f:I:j:M:m:n:O:P:qsv:W:x")) != EOF)
 		switch (c) {
+		case 'B':
+			bench = 1;
+			break;
 		case 'c':
 			codegen++;
 			break;
+		case 'C':
+			cache_file = optarg;
+			break;
 		case 'f':
 			fail = optarg;
 			break;
+		case 'I':
+			image_dir = malloc(strlen(optarg)+2);
+			if (!image_dir) {
+				perror("malloc");
+				exit(1);
+			}
+			strcpy(image_dir, optarg);
+			if (!*optarg || optarg[strlen(optarg)-1] != '/')
+				strcat(image_dir, "/");
+			break;
+		case 'j':
+			tile_rows = 4;
+			if (sscanf(optarg, "%d,%d", &threads, &tile_rows) < 1 ||
+			    threads < 1 || threads > TILE_POOL_MAX_THREADS ||
+			    tile_rows < 1)
+				usage(*argv);
+			break;
+		case 'M':
+			if (sscanf(optarg, "%u,%u", &hmeshlast, &vmeshlast)
+			    != 2 || hmeshlast >= TMU_MESH_MAXSIZE ||
+			    vmeshlast >= TMU_MESH_MAXSIZE)
+				usage(*argv);
+			mesh = 1;
+			break;
 		case 'm':
 			add_midi(optarg);
 			break;
@@ -547,6 +1388,15 @@ int main(int argc, char **argv)
 			if (*end)
 				usage(*argv);
 			break;
+		case 'O':
+			if (!parse_optimize(optarg))
+				usage(*argv);
+			break;
+		case 'P':
+			compile_threads = strtoul(optarg, &end, 0);
+			if (*end || compile_threads < 1)
+				usage(*argv);
+			break;
 		case 'q':
 			quiet = 1;
 			break;
@@ -556,6 +1406,9 @@ int main(int argc, char **argv)
 		case 'v':
 			trace_var = optarg;
 			break;
+		case 'x':
+			execute++;
+			break;
 		case 'W':
 			if (!strcmp(optarg, "section"))
 				warn_section = 1;
@@ -570,10 +1423,24 @@ int main(int argc, char **argv)
 
 	if (codegen && (fail || symbols))
 		usage(*argv);
+	if ((execute && codegen != 1 && codegen != 3) || (mesh && !execute))
+		usage(*argv);
+	if (threads && execute < 2)
+		usage(*argv);
+	if (cache_file && (codegen != 1 || compile_threads || bench))
+		usage(*argv);
+	if (image_dir && codegen != 1 && codegen != 3)
+		usage(*argv);
+	if (compile_threads &&
+	    (codegen != 1 || execute || trace_var || argc != optind))
+		usage(*argv);
+	if (bench && (codegen != 1 || execute || trace_var ||
+	    compile_threads || argc != optind))
+		usage(*argv);
 
 	switch (argc-optind) {
 	case 0:
-		buffer = read_stdin();
+		buffer = read_fd(0);
 		atexit(free_buffer);
 		break;
 	case 1:
@@ -583,19 +1450,33 @@ int main(int argc, char **argv)
 		usage(*argv);
 	}
 
+	if (bench) {
+		add_jobs((char *) buffer);
+		bench_files(repeat);
+		free(jobs);
+		return 0;
+	}
+	if (compile_threads) {
+		add_jobs((char *) buffer);
+		while (repeat--)
+			compile_files(compile_threads);
+		free(jobs);
+		return 0;
+	}
+
 	while (repeat--)
 		switch (codegen) {
 		case 0:
 			parse_only(buffer);
 			break;
 		case 1:
-			compile(buffer, 1);
+			compile(buffer, COMP_FRAMEWORK | optimize);
 			break;
 		case 2:
 			compile_vm(buffer);
 			break;
 		case 3:
-			compile(buffer, 0);
+			compile(buffer, optimize);
 			break;
 		default:
 			usage(*argv);
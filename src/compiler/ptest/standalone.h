@@ -1,6 +1,8 @@
 #ifndef STANDALONE_H
 #define	STANDALONE_H
 
+#include <stdbool.h>
+
 /*
  * From
  * /opt/rtems-4.11/lm32-rtems4.11/milkymist/lib/include/bsp/milkymist_pfpu.h
@@ -9,4 +11,75 @@
 #define PFPU_PROGSIZE	2048
 #define PFPU_REG_COUNT	128
 
+struct pfpu_td {
+	unsigned int *output;
+	unsigned int hmeshlast;
+	unsigned int vmeshlast;
+	unsigned int *program;
+	unsigned int progsize;
+	float *registers;
+	bool update;
+	bool invalidate;
+};
+
+/*
+ * From
+ * /opt/rtems-4.11/lm32-rtems4.11/milkymist/lib/include/bsp/milkymist_tmu.h
+ */
+
+#define TMU_EXECUTE		0x5400
+#define TMU_EXECUTE_NONBLOCK	0x5401
+#define TMU_EXECUTE_WAIT	0x5402
+
+#define TMU_BRIGHTNESS_MAX	63
+#define TMU_MASK_NOFILTER	0x3ffc0
+#define TMU_MASK_FULL		0x3ffff
+#define TMU_FIXEDPOINT_SHIFT	6
+#define TMU_ALPHA_MAX		63
+#define TMU_MESH_MAXSIZE	128
+
+#define TMU_FLAG_CHROMAKEY	2
+#define TMU_FLAG_ADDITIVE	4
+
+struct tmu_vertex {
+	int x;
+	int y;
+};
+
+struct tmu_td {
+	unsigned int flags;
+	unsigned int hmeshlast;
+	unsigned int vmeshlast;
+	unsigned int brightness;
+	unsigned short chromakey;
+	struct tmu_vertex *vertices;
+	unsigned short *texfbuf;
+	unsigned int texhres;
+	unsigned int texvres;
+	unsigned int texhmask;
+	unsigned int texvmask;
+	unsigned short *dstfbuf;
+	unsigned int dsthres;
+	unsigned int dstvres;
+	int dsthoffset;
+	int dstvoffset;
+	unsigned int dstsquarew;
+	unsigned int dstsquareh;
+	unsigned int alpha;
+
+	bool invalidate_before;
+	bool invalidate_after;
+};
+
+/*
+ * From
+ * /opt/rtems-4.11/lm32-rtems4.11/milkymist/lib/include/bsp/milkymist_ac97.h
+ */
+
+struct snd_buffer {
+	unsigned int nsamples;
+	void *user;
+	unsigned int samples[];
+};
+
 #endif /* !STANDALONE_H */
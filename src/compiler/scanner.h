@@ -53,11 +53,13 @@ void delete_scanner(struct scanner *s);
 /* get to the next token and return its type */
 int scan(struct scanner *s);
 
+struct symtab;
+
 /* get the symbol for the unique string comprising the current token
  */
-struct sym *get_symbol(struct scanner *s);
+struct sym *get_symbol(struct scanner *s, struct symtab *st);
 
-struct sym *get_tag(struct scanner *s);
+struct sym *get_tag(struct scanner *s, struct symtab *st);
 
 /* malloc'ed non-unique string */
 const char *get_name(struct scanner *s);
@@ -18,7 +18,7 @@
 #include "symtab.h"
 
 
-#define	INITIAL_ALLOC	256
+#define	INITIAL_HASH	64	/* buckets; a power of two */
 
 
 struct key_n {
@@ -29,12 +29,7 @@ struct key_n {
 struct sym well_known[] = {
 #include "fnp.inc"
 };
-int num_well_known;
-
-struct sym *user_syms = NULL;
-int num_user_syms = 0;
-
-static int allocated = 0;
+const int num_well_known = sizeof(well_known)/sizeof(*well_known);
 
 
 /*
@@ -65,86 +60,160 @@ static char *strdup_n(const char *s, int n)
 }
 
 
-static void grow_table(void)
+static int cmp_n(const void *a, const void *b)
 {
-	if(num_user_syms != allocated)
-		return;
+	const struct key_n *key = a;
+	const struct sym *sym = b;
 
-	allocated = allocated ? allocated*2 : INITIAL_ALLOC;
-	user_syms = realloc(user_syms, allocated*sizeof(*user_syms));
+	return strcmp_n(key->s, sym->fpvm_sym.name, key->n);
 }
 
 
-static int cmp(const void *a, const void *b)
+static int is_well_known(const struct sym *sym)
 {
-	const struct sym *sym = b;
-
-	return strcmp(a, sym->fpvm_sym.name);
+	return sym >= well_known && sym < well_known+num_well_known;
 }
 
 
-static int cmp_n(const void *a, const void *b)
+/* ----- User symbols ------------------------------------------------------ */
+
+
+/* FNV-1a */
+
+static unsigned hash_n(const char *s, int n)
 {
-	const struct key_n *key = a;
-	const struct sym *sym = b;
+	unsigned h = 2166136261u;
 
-	return strcmp_n(key->s, sym->fpvm_sym.name, key->n);
+	while(n--)
+		h = (h ^ (unsigned char) *s++)*16777619;
+	return h;
 }
 
 
-struct sym *unique(const char *s)
+static void grow_hash(struct symtab *st)
 {
-	struct sym *res, *walk, *new;
+	struct sym **hash, *sym, *next;
+	int size, i;
+
+	size = st->hash_size ? st->hash_size*2 : INITIAL_HASH;
+	hash = calloc(size, sizeof(*hash));
+	for(i = 0; i != st->hash_size; i++)
+		for(sym = st->hash[i]; sym; sym = next) {
+			next = sym->hash_next;
+			sym->hash_next = hash[sym->hash & (size-1)];
+			hash[sym->hash & (size-1)] = sym;
+		}
+	free(st->hash);
+	st->hash = hash;
+	st->hash_size = size;
+}
 
-	res = bsearch(s, well_known, num_well_known, sizeof(*well_known), cmp);
-	if(res)
-		return res;
-	for(walk = user_syms; walk != user_syms+num_user_syms; walk++)
-		if(!strcmp(walk->fpvm_sym.name, s))
-			return walk;
-	grow_table();
-	new = user_syms+num_user_syms++;
-	new->fpvm_sym.name = strdup(s);
-	new->pfv_idx = new->pvv_idx = -1;
-	new->flags = 0;
-	new->stim = NULL;
-	return new;
+
+static struct sym *user_sym(struct symtab *st, const char *s, int n)
+{
+	struct sym *sym;
+	unsigned h;
+
+	h = hash_n(s, n);
+	for(sym = st->hash ? st->hash[h & (st->hash_size-1)] : NULL; sym;
+	    sym = sym->hash_next)
+		if(sym->hash == h && !strcmp_n(s, sym->fpvm_sym.name, n))
+			return sym;
+
+	if(st->num_user_syms >= st->hash_size)
+		grow_hash(st);
+	sym = malloc(sizeof(struct sym));
+	sym->fpvm_sym.name = strdup_n(s, n);
+	sym->pfv_idx = sym->pvv_idx = -1;
+	sym->flags = 0;
+	sym->stim = NULL;
+	sym->hash = h;
+	sym->hash_next = st->hash[h & (st->hash_size-1)];
+	st->hash[h & (st->hash_size-1)] = sym;
+	sym->next = NULL;
+	*st->last_user = sym;
+	st->last_user = &sym->next;
+	st->num_user_syms++;
+	return sym;
 }
 
 
-struct sym *unique_n(const char *s, int n)
+/* ----- Lookup ------------------------------------------------------------ */
+
+
+struct sym *unique(struct symtab *st, const char *s)
+{
+	return unique_n(st, s, strlen(s));
+}
+
+
+struct sym *unique_n(struct symtab *st, const char *s, int n)
 {
 	struct key_n key = {
 		.s = s,
 		.n = n,
 	};
-	struct sym *res, *walk, *new;
+	struct sym *res;
 
 	assert(n);
 	res = bsearch(&key, well_known, num_well_known, sizeof(*well_known),
 	    cmp_n);
 	if(res)
 		return res;
-	for(walk = user_syms; walk != user_syms+num_user_syms; walk++)
-		if(!strcmp_n(s, walk->fpvm_sym.name, n))
-			return walk;
-	grow_table();
-	new = user_syms+num_user_syms++;
-	new->fpvm_sym.name = strdup_n(s, n);
-	new->pfv_idx = new->pvv_idx = -1;
-	new->flags = 0;
-	new->stim = NULL;
-	return new;
+	return user_sym(st, s, n);
 }
 
 
-void symtab_init(void)
+struct sym *sym_next(const struct symtab *st, const struct sym *sym)
 {
-	int i;
+	if(!is_well_known(sym))
+		return sym->next;
+	if(sym == well_known+num_well_known-1)
+		return st->user_syms;
+	return (struct sym *) sym+1;
+}
 
-	num_well_known = sizeof(well_known)/sizeof(*well_known);
-	for(i = 0; i != num_well_known; i++)
-		well_known[i].flags &= SF_FIXED;
+
+/* ----- Per-table state of the well-known symbols ------------------------- */
+
+
+const struct sym *sym_var(const struct symtab *st, const struct sym *sym)
+{
+	const struct sym *copy;
+
+	if(!is_well_known(sym))
+		return sym;
+	copy = st->wk[sym-well_known];
+	return copy ? copy : sym;
+}
+
+
+struct sym *sym_var_w(struct symtab *st, struct sym *sym)
+{
+	struct sym **copy;
+
+	if(!is_well_known(sym))
+		return sym;
+	copy = st->wk+(sym-well_known);
+	if(!*copy) {
+		*copy = malloc(sizeof(struct sym));
+		**copy = *sym;
+	}
+	return *copy;
+}
+
+
+/* ----- Setup and cleanup ------------------------------------------------- */
+
+
+void symtab_init(struct symtab *st)
+{
+	st->wk = calloc(num_well_known, sizeof(*st->wk));
+	st->hash = NULL;
+	st->hash_size = 0;
+	st->user_syms = NULL;
+	st->last_user = &st->user_syms;
+	st->num_user_syms = 0;
 }
 
 
@@ -160,17 +229,28 @@ static void free_stim(struct sym *sym)
 }
 
 
-void symtab_free(void)
+void symtab_free(struct symtab *st)
 {
+	struct sym *sym, *next;
 	int i;
 
 	for(i = 0; i != num_well_known; i++)
-		free_stim(well_known+i);
-	for(i = 0; i != num_user_syms; i++) {
-		free((void *) user_syms[i].fpvm_sym.name);
-		free_stim(user_syms+i);
+		if(st->wk[i]) {
+			free_stim(st->wk[i]);
+			free(st->wk[i]);
+		}
+	free(st->wk);
+	for(sym = st->user_syms; sym; sym = next) {
+		next = sym->next;
+		free((void *) sym->fpvm_sym.name);
+		free_stim(sym);
+		free(sym);
 	}
-	free(user_syms);
-	user_syms = NULL;
-	num_user_syms = allocated = 0;
+	free(st->hash);
+	st->wk = NULL;
+	st->hash = NULL;
+	st->hash_size = 0;
+	st->user_syms = NULL;
+	st->last_user = &st->user_syms;
+	st->num_user_syms = 0;
 }
@@ -32,23 +32,50 @@ struct sym {
 	struct sym_stim *stim;	/* NULL if not a control variable */
 	float f;		/* undefined unless SF_CONST */
 	int flags;
+
+	/* user symbols only */
+	unsigned hash;
+	struct sym *hash_next;	/* in the same hash bucket */
+	struct sym *next;	/* in order of creation */
+};
+
+/*
+ * A symbol table holds the symbols of one compilation, so that several
+ * patches can be compiled at the same time.
+ *
+ * The well-known symbols are shared by all symbol tables: the FPVM code
+ * refers to them by address. Their state (stim, f and flags) is read with
+ * sym_var(), which returns the shared, pristine symbol until the table has
+ * changed it. sym_var_w() makes the table's own copy first.
+ *
+ * User symbols belong to one table, hold their state themselves and never
+ * move. They are found through a hash table.
+ */
+
+struct symtab {
+	struct sym **wk;	/* copies of the well-known symbols, or NULL */
+	struct sym **hash;	/* user symbols */
+	int hash_size;
+	struct sym *user_syms;
+	struct sym **last_user;
+	int num_user_syms;
 };
 
 
 extern struct sym well_known[];
-extern int num_well_known;
-extern struct sym *user_syms;
-extern int num_user_syms;
+extern const int num_well_known;
 
 #define	FPVM2SYM(fpvm_sym)	((struct sym *) (fpvm_sym))
 
-#define	foreach_sym(p) \
-	for ((p) = well_known; (p) != user_syms+num_user_syms; \
-	    (p) = (p) == well_known+num_well_known-1 ? user_syms : (p)+1)
+#define	foreach_sym(st, p) \
+	for ((p) = well_known; (p); (p) = sym_next((st), (p)))
 
-void symtab_init(void);
-struct sym *unique(const char *s);
-struct sym *unique_n(const char *s, int n);
-void symtab_free(void);
+void symtab_init(struct symtab *st);
+struct sym *unique(struct symtab *st, const char *s);
+struct sym *unique_n(struct symtab *st, const char *s, int n);
+struct sym *sym_next(const struct symtab *st, const struct sym *sym);
+const struct sym *sym_var(const struct symtab *st, const struct sym *sym);
+struct sym *sym_var_w(struct symtab *st, struct sym *sym);
+void symtab_free(struct symtab *st);
 
 #endif /* !SYMTAB_H */
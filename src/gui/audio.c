@@ -35,6 +35,7 @@
 #include "audio.h"
 #include "resmgr.h"
 #include "../input.h"
+#include "../renderer/sndring.h"
 #include "../renderer/sampler.h"
 
 static int appid;
@@ -48,12 +49,15 @@ static int mic_mute;
 static int mic_boost;
 
 static float bass, mid, treb;
+static const struct snd_ring *ring;
+static unsigned int peak_pos;	/* sound up to there is on the meter */
 
 static void sampler_callback(struct frame_descriptor *frd)
 {
 	bass = frd->bass_att;
 	mid = frd->mid_att;
 	treb = frd->treb_att;
+	ring = frd->snd_ring;
 
 	sampler_return(frd);
 }
@@ -61,6 +65,21 @@ static void sampler_callback(struct frame_descriptor *frd)
 #define UPDATE_PERIOD 10
 static rtems_interval next_update;
 
+/* peak of the sound recorded since the last update, straight from the ring */
+static float get_peak(void)
+{
+	unsigned int written, n;
+
+	if(ring == NULL)
+		return 0.0;
+	written = ring->written;
+	n = written - peak_pos;
+	if(n > SND_RING_HISTORY)
+		n = SND_RING_HISTORY;
+	peak_pos = written;
+	return snd_ring_peak(ring, written - n, n)/32768.0;
+}
+
 static void monitor_update(mtk_event *e, int count)
 {
 	rtems_interval t;
@@ -70,6 +89,7 @@ static void monitor_update(mtk_event *e, int count)
 		mtk_cmdf(appid, "ld_bass.barconfig(load, -value %f)", bass);
 		mtk_cmdf(appid, "ld_mid.barconfig(load, -value %f)", mid);
 		mtk_cmdf(appid, "ld_treb.barconfig(load, -value %f)", treb);
+		mtk_cmdf(appid, "ld_peak.barconfig(load, -value %f)", get_peak());
 
 		next_update = t + UPDATE_PERIOD;
 	}
@@ -206,9 +226,11 @@ void init_audio(void)
 		"l_bass = new Label(-text \"\eBass\")",
 		"l_mid  = new Label(-text \"\eMid\")",
 		"l_treb = new Label(-text \"\eTreb\")",
+		"l_peak = new Label(-text \"\ePeak\")",
 		"ld_bass = new LoadDisplay(-from 3 -to 0 -orient vertical)",
 		"ld_mid  = new LoadDisplay(-from 6 -to 0 -orient vertical)",
 		"ld_treb = new LoadDisplay(-from 6 -to 0 -orient vertical)",
+		"ld_peak = new LoadDisplay(-from 1 -to 0 -orient vertical)",
 
 		"l_linevol = new Label(-text \"Line volume\")",
 		"s_linevol = new Scale(-from 0 -to 100 -value 0 -orient vertical)",
@@ -246,6 +268,8 @@ void init_audio(void)
 		"gb.place(ld_mid,  -column 2 -row 2)",
 		"gb.place(l_treb,  -column 3 -row 1)",
 		"gb.place(ld_treb, -column 3 -row 2)",
+		"gb.place(l_peak,  -column 4 -row 1)",
+		"gb.place(ld_peak, -column 4 -row 2)",
 
 		"gb.rowconfig(2, -size 180)",
 
@@ -298,6 +322,8 @@ void open_audio_window(void)
 	w_open = 1;
 	mtk_cmd(appid, "w.open()");
 	next_update = rtems_clock_get_ticks_since_boot() + UPDATE_PERIOD;
+	ring = NULL;
+	peak_pos = 0;
 	input_add_callback(monitor_update);
 	sampler_start(sampler_callback);
 }
@@ -34,6 +34,9 @@ static int w_open;
 static float time2, frame;
 static float bass, mid, treb;
 static float bass_att, mid_att, treb_att;
+static float band[BAND_COUNT];
+static float peak, rms, onset;
+static float beat, beat_phase, bpm;
 static float idmx[IDMX_COUNT];
 static float osc[OSC_COUNT];
 
@@ -52,6 +55,15 @@ static void sampler_callback(struct frame_descriptor *frd)
 	mid_att = frd->mid_att;
 	treb_att = frd->treb_att;
 
+	for(i=0;i<BAND_COUNT;i++)
+		band[i] = frd->band[i];
+	peak = frd->peak;
+	rms = frd->rms;
+	onset = frd->onset;
+	beat = frd->beat;
+	beat_phase = frd->beat_phase;
+	bpm = frd->bpm;
+
 	for(i=0;i<IDMX_COUNT;i++)
 		idmx[i] = frd->idmx[i];
 	for(i=0;i<OSC_COUNT;i++)
@@ -72,6 +84,15 @@ static float *get_variable(const char *name)
 	else if(strcmp(name, "mid_att") == 0) return &mid_att;
 	else if(strcmp(name, "treb_att") == 0) return &treb_att;
 
+	else if((strncmp(name, "band", 4) == 0) && (atoi(name+4) >= 1)
+	    && (atoi(name+4) <= BAND_COUNT)) return &band[atoi(name+4)-1];
+	else if(strcmp(name, "peak") == 0) return &peak;
+	else if(strcmp(name, "rms") == 0) return &rms;
+	else if(strcmp(name, "onset") == 0) return &onset;
+	else if(strcmp(name, "beat") == 0) return &beat;
+	else if(strcmp(name, "beat_phase") == 0) return &beat_phase;
+	else if(strcmp(name, "bpm") == 0) return &bpm;
+
 	else if(strcmp(name, "idmx1") == 0) return &idmx[0];
 	else if(strcmp(name, "idmx2") == 0) return &idmx[1];
 	else if(strcmp(name, "idmx3") == 0) return &idmx[2];
@@ -187,7 +187,7 @@ static void saveasok_callback(void *arg)
 	save_current();
 }
 
-static void rmc(const char *m)
+static void rmc(void *arg, const char *m)
 {
 	m = protect_string(m);
 	mtk_cmdf(appid, "status.set(-text \"%s\")", m);
@@ -201,7 +201,7 @@ static void run_callback(mtk_event *e, void *arg)
 
 	mtk_cmd(appid, "status.set(-text \"Ready.\")");
 	mtk_req(appid, code, sizeof(code), "ed.text");
-	p = patch_compile_filename(current_filename, code, rmc);
+	p = patch_compile_filename(current_filename, code, rmc, NULL);
 	if(p == NULL)
 		return;
 
@@ -34,7 +34,9 @@
 #include "messagebox.h"
 #include "../config.h"
 #include "../compiler/compiler.h"
+#include "../patchcache.h"
 #include "../renderer/renderer.h"
+#include "../renderer/sampler.h"
 #include "guirender.h"
 #include "performance.h"
 #include "../renderer/osd.h"
@@ -45,6 +47,7 @@ struct patch_info {
 	char filename[FILENAME_LEN];
 	struct patch *p;
 	struct stat st;
+	char *error;	/* why the patch failed to compile, or NULL */
 	struct patch_info *prev, *next;
 };
 
@@ -58,6 +61,7 @@ static int dt_mode;
 static int as_mode;
 static int input_video;
 static int showing_title;
+static rtems_id comp_lock;
 
 static struct patch_info *add_patch(const char *filename)
 {
@@ -72,6 +76,7 @@ static struct patch_info *add_patch(const char *filename)
 		return NULL;
 	strcpy(pi->filename, filename);
 	pi->p = NULL;
+	pi->error = NULL;
 	if(last_patch)
 		last_patch->next = pi;
 	else
@@ -248,6 +253,8 @@ static void go_callback(mtk_event *e, void *arg)
 
 void init_performance(void)
 {
+	rtems_status_code sc;
+
 	appid = mtk_init_app("Performance");
 
 	mtk_cmd_seq(appid,
@@ -296,30 +303,74 @@ void init_performance(void)
 	mtk_bind(appid, "b_close", "commit", close_callback, NULL);
 
 	mtk_bind(appid, "w", "close", close_callback, NULL);
+
+	sc = rtems_semaphore_create(
+		rtems_build_name('C', 'O', 'M', 'P'),
+		1,
+		RTEMS_SIMPLE_BINARY_SEMAPHORE,
+		0,
+		&comp_lock);
+	assert(sc == RTEMS_SUCCESSFUL);
 }
 
+/*
+ * Patches are compiled by COMP_WORKERS tasks, which take the next patch
+ * from comp_next. comp_lock protects comp_next, the counters and the patch
+ * cache. A patch that fails to compile does not stop the others: its
+ * first error goes into its patch_info.
+ */
+
+#define COMP_WORKERS 2
+
+static struct patch_info *comp_next;
 static int compiled_patches;
-struct patch_info *error_patch;
+static int failed_patches;
+static int comp_running;
 #define UPDATE_PERIOD 20
 static rtems_interval next_update;
 
-static void dummy_rmc(const char *msg)
+static void comp_lock_obtain(void)
 {
+	rtems_semaphore_obtain(comp_lock, RTEMS_WAIT, RTEMS_NO_TIMEOUT);
 }
 
-static struct patch *compile_patch(const char *filename, const struct stat *st)
+static void comp_lock_release(void)
+{
+	rtems_semaphore_release(comp_lock);
+}
+
+static void report_error(void *arg, const char *msg)
+{
+	struct patch_info *pi = arg;
+	char *c;
+
+	if(pi->error)
+		return;
+	pi->error = strdup(msg);
+	if(!pi->error)
+		return;
+	/* it goes into MTK strings */
+	for(c = pi->error; *c; c++)
+		if(*c == '"')
+			*c = '\'';
+}
+
+static struct patch *compile_patch(struct patch_info *pi)
 {
 	FILE *file;
 	int r;
 	char *buf = NULL;
 	struct patch *p;
 
-	file = fopen(filename, "r");
-	if(file == NULL)
+	file = fopen(pi->filename, "r");
+	if(file == NULL) {
+		report_error(pi, "cannot open file");
 		return NULL;
-	buf = malloc(st->st_size+1);
-	r = fread(buf, 1, st->st_size, file);
+	}
+	buf = malloc(pi->st.st_size+1);
+	r = fread(buf, 1, pi->st.st_size, file);
 	if(r <= 0) {
+		report_error(pi, "cannot read file");
 		free(buf);
 		fclose(file);
 		return NULL;
@@ -328,7 +379,17 @@ static struct patch *compile_patch(const char *filename, const struct stat *st)
 	buf[r] = 0;
 	fclose(file);
 
-	p = patch_compile_filename(filename, buf, dummy_rmc);
+	comp_lock_obtain();
+	p = patchcache_lookup(pi->filename, buf);
+	comp_lock_release();
+	if(!p) {
+		p = patch_compile_filename(pi->filename, buf, report_error, pi);
+		if(p) {
+			comp_lock_obtain();
+			patchcache_store(pi->filename, buf, p);
+			comp_lock_release();
+		}
+	}
 	free(buf);
 	return p;
 }
@@ -348,20 +409,42 @@ static rtems_task comp_task(rtems_task_argument argument)
 {
 	struct patch_info *pi;
 
-	for(pi = patches; pi; pi = pi->next) {
+	while(1) {
+		comp_lock_obtain();
+		pi = comp_next;
+		if(pi)
+			comp_next = pi->next;
+		comp_lock_release();
+		if(!pi)
+			break;
+
 		if(lstat(pi->filename, &pi->st) < 0) {
+			report_error(pi, "file not found");
 			pi->p = NULL;
 		} else {
+			comp_lock_obtain();
 			pi->p = cache_lookup(pi);
+			comp_lock_release();
 			if(!pi->p)
-				pi->p = compile_patch(pi->filename, &pi->st);
-		}
-		if(!pi->p) {
-			error_patch = pi;
-			break;
+				pi->p = compile_patch(pi);
 		}
-		compiled_patches++;
+
+		comp_lock_obtain();
+		if(pi->p)
+			compiled_patches++;
+		else
+			failed_patches++;
+		comp_lock_release();
 	}
+
+	comp_lock_obtain();
+	if(comp_running == 1) {
+		/* last one out */
+		patchcache_save(PATCHCACHE_FILE);
+		patchcache_free();
+	}
+	comp_running--;
+	comp_lock_release();
 	rtems_task_delete(RTEMS_SELF);
 }
 
@@ -373,6 +456,7 @@ static void free_patches(struct patch_info *list)
 		next = list->next;
 		if(list->p)
 			patch_free(list->p);
+		free(list->error);
 		free(list);
 		list = next;
 	}
@@ -412,16 +496,44 @@ static int keycode_to_index(int keycode)
 	}
 }
 
-static rtems_interval next_as_time;
+/*
+ * Auto switch: after AUTOSWITCH_PERIOD_MIN, the next patch comes in on the
+ * beat that ends a phrase of AUTOSWITCH_PHRASE beats since the last switch.
+ * When no tempo is found, it comes in at AUTOSWITCH_PERIOD_MAX.
+ */
+static rtems_interval next_as_time, last_as_time;
+static unsigned int as_beat;
 #define AUTOSWITCH_PERIOD_MIN (2*60*100)
 #define AUTOSWITCH_PERIOD_MAX (4*60*100)
+#define AUTOSWITCH_PHRASE (32)
 static void update_next_as_time(void)
 {
 	rtems_interval t;
+	float bpm;
 	
 	t = rtems_clock_get_ticks_since_boot();
-	next_as_time = t + AUTOSWITCH_PERIOD_MIN +
-	    (rand() % (AUTOSWITCH_PERIOD_MAX - AUTOSWITCH_PERIOD_MIN));
+	next_as_time = t + AUTOSWITCH_PERIOD_MIN;
+	last_as_time = t + AUTOSWITCH_PERIOD_MAX;
+	sampler_get_beat(&as_beat, &bpm);
+}
+
+static int as_due(void)
+{
+	rtems_interval t;
+	unsigned int beat;
+	float bpm;
+
+	t = rtems_clock_get_ticks_since_boot();
+	if(t >= last_as_time)
+		return 1;
+	if(t < next_as_time)
+		return 0;
+	sampler_get_beat(&beat, &bpm);
+	/* the sampler restarted */
+	if(beat < as_beat)
+		as_beat = beat;
+	return (bpm > 0.0f) && (beat != as_beat)
+	    && ((beat - as_beat) % AUTOSWITCH_PHRASE == 0);
 }
 
 static int suitable_for_simple(struct patch *p)
@@ -542,7 +654,6 @@ static void event_callback(mtk_event *e, int count)
 {
 	int i;
 	int next;
-	rtems_interval t;
 
 	if(simple_mode) {
 		/*
@@ -554,11 +665,8 @@ static void event_callback(mtk_event *e, int count)
 		next = 0;
 		for(i=0;i<count;i++)
 			simple_mode_event(e+i, &next);
-		if(as_mode) {
-			t = rtems_clock_get_ticks_since_boot();
-			if(t >= next_as_time)
-				next = 1;
-		}
+		if(as_mode && as_due())
+			next = 1;
 		if(next)
 			simple_mode_next(next);
 	} else {
@@ -597,6 +705,41 @@ static void start_rendering(void)
 		stop_callback();
 }
 
+#define ERRORS_LEN 1024
+
+static void report_failures(void)
+{
+	const struct patch_info *pi, *first = NULL;
+	char errors[ERRORS_LEN];
+	const char *name;
+	int len = 0;
+
+	for(pi = patches; pi; pi = pi->next) {
+		if(pi->p)
+			continue;
+		if(!first)
+			first = pi;
+		name = strrchr(pi->filename, '/');
+		name = name ? name+1 : pi->filename;
+		if(len < ERRORS_LEN)
+			len += snprintf(errors+len, ERRORS_LEN-len, "%s%s: %s",
+			    len ? "\n" : "", name,
+			    pi->error ? pi->error : "out of memory");
+	}
+	if(len >= ERRORS_LEN)
+		strcpy(errors+ERRORS_LEN-4, "...");
+
+	if(failed_patches == 1)
+		mtk_cmdf(appid,
+		    "l_status.set(-text \"Failed to compile patch %s\")",
+		    first->filename);
+	else
+		mtk_cmdf(appid,
+		    "l_status.set(-text \"Failed to compile %d of %d patches\")",
+		    failed_patches, npatches);
+	messagebox("Compilation failed", errors);
+}
+
 static void refresh_callback(mtk_event *e, int count)
 {
 	rtems_interval t;
@@ -604,28 +747,33 @@ static void refresh_callback(mtk_event *e, int count)
 	t = rtems_clock_get_ticks_since_boot();
 	if(t < next_update)
 		return;
-	if(!error_patch) {
-		mtk_cmdf(appid, "progress.barconfig(load, -value %d)",
-		    (100*compiled_patches)/npatches);
-		if(compiled_patches == npatches) {
-			/* All patches compiled. Start rendering. */
-			input_delete_callback(refresh_callback);
-			start_rendering();
-			return;
-		}
-	} else {
-		mtk_cmdf(appid,
-		    "l_status.set(-text \"Failed to compile patch %s\")",
-		    error_patch->filename);
-		input_delete_callback(refresh_callback);
-		started = 0;
-		free_patches(patches);
-		patches = NULL;
-		last_patch = NULL;
-		fb_unblank();
+	mtk_cmdf(appid, "progress.barconfig(load, -value %d)",
+	    (100*(compiled_patches+failed_patches))/npatches);
+	if(comp_running) {
+		if(failed_patches)
+			mtk_cmdf(appid, "l_status.set(-text \"Compiling patches... "
+			    "%d/%d, %d failed\")",
+			    compiled_patches+failed_patches, npatches,
+			    failed_patches);
+		else
+			mtk_cmdf(appid, "l_status.set(-text \"Compiling patches... "
+			    "%d/%d\")", compiled_patches, npatches);
+		next_update = t + UPDATE_PERIOD;
+		return;
+	}
+
+	input_delete_callback(refresh_callback);
+	if(!failed_patches) {
+		/* All patches compiled. Start rendering. */
+		start_rendering();
 		return;
 	}
-	next_update = t + UPDATE_PERIOD;
+	report_failures();
+	started = 0;
+	free_patches(patches);
+	patches = NULL;
+	last_patch = NULL;
+	fb_unblank();
 }
 
 void open_performance_window(void)
@@ -634,8 +782,6 @@ void open_performance_window(void)
 	mtk_cmd(appid, "w.open()");
 }
 
-static rtems_id comp_task_id;
-
 static int check_input_video(void)
 {
 	int fd;
@@ -655,6 +801,8 @@ static int check_input_video(void)
 void start_performance(int simple, int dt, int as)
 {
 	rtems_status_code sc;
+	rtems_id id;
+	int i;
 	
 	if(started) return;
 	started = 1;
@@ -691,18 +839,23 @@ void start_performance(int simple, int dt, int as)
 	}
 	simple_mode_current = patches;
 
-	/* start patch compilation task */
+	/* start patch compilation tasks */
+	comp_next = patches;
 	compiled_patches = 0;
-	error_patch = NULL;
+	failed_patches = 0;
+	comp_running = COMP_WORKERS;
+	patchcache_load(PATCHCACHE_FILE);
 	mtk_cmd(appid, "l_status.set(-text \"Compiling patches...\")");
 	mtk_cmd(appid, "progress.barconfig(load, -value 0)");
 	next_update = rtems_clock_get_ticks_since_boot() + UPDATE_PERIOD;
 	input_add_callback(refresh_callback);
-	sc = rtems_task_create(rtems_build_name('C', 'O', 'M', 'P'),
-	    20, 300*1024,
-	    RTEMS_PREEMPT | RTEMS_NO_TIMESLICE | RTEMS_NO_ASR,
-	    0, &comp_task_id);
-	assert(sc == RTEMS_SUCCESSFUL);
-	sc = rtems_task_start(comp_task_id, comp_task, 0);
-	assert(sc == RTEMS_SUCCESSFUL);
+	for(i=0;i<COMP_WORKERS;i++) {
+		sc = rtems_task_create(rtems_build_name('C', 'O', 'M', '0'+i),
+		    20, 300*1024,
+		    RTEMS_PREEMPT | RTEMS_NO_TIMESLICE | RTEMS_NO_ASR,
+		    0, &id);
+		assert(sc == RTEMS_SUCCESSFUL);
+		sc = rtems_task_start(id, comp_task, 0);
+		assert(sc == RTEMS_SUCCESSFUL);
+	}
 }
@@ -201,7 +201,7 @@ static void close_videoin_window(void)
 	resmgr_release(RESOURCE_VIDEOIN);
 }
 
-static void dummy_rmc(const char *msg)
+static void dummy_rmc(void *arg, const char *msg)
 {
 }
 
@@ -226,7 +226,7 @@ static void fullscreen_callback(mtk_event *e, void *arg)
 	char *dummy_filename = "FS";
 	char *code = "video_a=1;decay=0;";
 
-	p = patch_compile_filename(dummy_filename, code, dummy_rmc);
+	p = patch_compile_filename(dummy_filename, code, dummy_rmc, NULL);
 	if(p == NULL)
 		return;
 
@@ -54,6 +54,7 @@
 #include "usbfirmware.h"
 #include "renderer/videoinreconf.h"
 #include "renderer/renderer.h"
+#include "pixbuf/pixbuf.h"
 #include "shellext.h"
 #include "sysconfig.h"
 #include "fb.h"
@@ -205,6 +206,8 @@ rtems_task Init(rtems_task_argument argument)
 	init_videoinreconf();
 
 	sysconfig_load();
+	pixbuf_init();
+	compiler_init();
 	rtems_bsdnet_initialize_network();
 	rtems_initialize_ftpd();
 	rtems_telnetd_initialize();
@@ -325,6 +328,11 @@ const rtems_filesystem_table_t rtems_filesystem_table[] = {
 #define CONFIGURE_MAXIMUM_TASKS 32
 #define CONFIGURE_MAXIMUM_MESSAGE_QUEUES 16
 #define CONFIGURE_MAXIMUM_SEMAPHORES 32
+#ifdef WITH_SOFTPFPU
+#define CONFIGURE_MAXIMUM_POSIX_THREADS 32
+#define CONFIGURE_MAXIMUM_POSIX_MUTEXES 16
+#define CONFIGURE_MAXIMUM_POSIX_CONDITION_VARIABLES 8
+#endif
 
 #define CONFIGURE_TICKS_PER_TIMESLICE 3
 #define CONFIGURE_MICROSECONDS_PER_TICK 10000
@@ -29,6 +29,7 @@
 #include "input.h"
 #include "renderer/framedescriptor.h"
 #include "renderer/osd.h"
+#include "renderer/framestats.h"
 
 #include "osc.h"
 
@@ -88,6 +89,61 @@ static int osd_method(const char *path, const char *types,
 	return 0;
 }
 
+static void send_handler(const char *msg, size_t len, void *arg);
+
+static void send_message(lop_message m, const char *path)
+{
+	char buf[256];
+	size_t len;
+
+	len = sizeof(buf);
+	if(lop_message_serialise(m, path, buf, &len) != NULL)
+		send_handler(buf, len, NULL);
+	lop_message_free(m);
+}
+
+/*
+ * Replies with one /framestats/stage message per stage (name, then min,
+ * avg, p99 and max in milliseconds) and a /framestats/frames message
+ * (recorded and dropped frames).
+ */
+static int framestats_method(const char *path, const char *types,
+	lop_arg **argv, int argc, lop_message msg,
+	void *user_data)
+{
+	struct framestats_summary s;
+	lop_message m;
+	int i;
+
+	framestats_get(&s);
+	for(i=0;i<FRAMESTATS_STAGE_COUNT;i++) {
+		m = lop_message_new();
+		if(m == NULL)
+			return 0;
+		lop_message_add_string(m, framestats_stage_names[i]);
+		lop_message_add_float(m, s.stages[i].min/1000.0);
+		lop_message_add_float(m, s.stages[i].avg/1000.0);
+		lop_message_add_float(m, s.stages[i].p99/1000.0);
+		lop_message_add_float(m, s.stages[i].max/1000.0);
+		send_message(m, "/framestats/stage");
+	}
+	m = lop_message_new();
+	if(m == NULL)
+		return 0;
+	lop_message_add_int32(m, s.frames);
+	lop_message_add_int32(m, s.dropped);
+	send_message(m, "/framestats/frames");
+	return 0;
+}
+
+static int framestats_reset_method(const char *path, const char *types,
+	lop_arg **argv, int argc, lop_message msg,
+	void *user_data)
+{
+	framestats_reset();
+	return 0;
+}
+
 static void error_handler(int num, const char *msg, const char *where)
 {
 	printf("liboscparse error in %s: %s\n", where, msg);
@@ -129,6 +185,8 @@ static rtems_task osc_task(rtems_task_argument argument)
 	lop_server_add_method(server, "/patch", "i", patch_method, NULL);
 	lop_server_add_method(server, "/variable", "if", variable_method, NULL);
 	lop_server_add_method(server, "/osd", "s", osd_method, NULL);
+	lop_server_add_method(server, "/framestats", "", framestats_method, NULL);
+	lop_server_add_method(server, "/framestats/reset", "", framestats_reset_method, NULL);
 	
 	udpsocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	if(udpsocket == -1) {
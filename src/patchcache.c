@@ -0,0 +1,580 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "pixbuf/pixbuf.h"
+#include "renderer/stimuli.h"
+#include "patchcache.h"
+
+/*
+ * File format, in the byte order of the board:
+ *
+ *   header: PATCHCACHE_MAGIC, PATCHCACHE_VERSION, COMP_VERSION,
+ *           COMP_PFV_COUNT, COMP_PVV_COUNT, PFPU_PROGSIZE, PFPU_REG_COUNT,
+ *           number of entries
+ *   entry:  hash (64 bits), length of the source, length of the record,
+ *           record
+ *
+ * An entry is only used if both the hash and the length of the source
+ * match. The records are read as they are written by save_patch.
+ */
+#define PATCHCACHE_MAGIC	0x464e5043	/* FNPC */
+#define PATCHCACHE_VERSION	4
+
+struct entry {
+	uint64_t hash;
+	int code_len;
+	int len;
+	char *record;
+	bool used;
+};
+
+static struct entry entries[PATCHCACHE_MAX];
+static int n_entries;
+static bool dirty;
+
+/* ----- Hashing ----------------------------------------------------------- */
+
+/* FNV-1a */
+#define FNV_OFFSET	14695981039346656037ULL
+#define FNV_PRIME	1099511628211ULL
+
+static uint64_t hash_bytes(uint64_t h, const char *data, int len)
+{
+	int i;
+
+	for(i=0;i<len;i++) {
+		h ^= (unsigned char)data[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static uint64_t hash_patch(const char *filename, const char *code)
+{
+	const char *c;
+	uint64_t h;
+
+	c = strrchr(filename, '/');
+	h = hash_bytes(FNV_OFFSET, filename, c == NULL ? 0 : c-filename+1);
+	h = hash_bytes(h, "", 1);
+	return hash_bytes(h, code, strlen(code));
+}
+
+/* ----- Records ----------------------------------------------------------- */
+
+struct writer {
+	char *data;
+	int len, size;
+	bool error;
+};
+
+static void put(struct writer *w, const void *data, int n)
+{
+	char *d;
+	int size;
+
+	if(w->error)
+		return;
+	if(w->len + n > w->size) {
+		size = 2*w->size;
+		if(size < w->len + n)
+			size = w->len + n;
+		d = realloc(w->data, size);
+		if(d == NULL) {
+			w->error = true;
+			return;
+		}
+		w->data = d;
+		w->size = size;
+	}
+	memcpy(w->data + w->len, data, n);
+	w->len += n;
+}
+
+static void put_int(struct writer *w, int x)
+{
+	put(w, &x, sizeof(x));
+}
+
+static void put_ll(struct writer *w, long long x)
+{
+	put(w, &x, sizeof(x));
+}
+
+struct reader {
+	const char *data, *end;
+	bool error;
+};
+
+static void get(struct reader *r, void *data, int n)
+{
+	if(r->error || (r->end - r->data < n)) {
+		r->error = true;
+		memset(data, 0, n);
+		return;
+	}
+	memcpy(data, r->data, n);
+	r->data += n;
+}
+
+static int get_int(struct reader *r)
+{
+	int x;
+
+	get(r, &x, sizeof(x));
+	return x;
+}
+
+static long long get_ll(struct reader *r)
+{
+	long long x;
+
+	get(r, &x, sizeof(x));
+	return x;
+}
+
+/* in the order stim_restore puts them back: the head of the list last */
+static void save_ctrls(struct writer *w, const struct patch *target,
+    const struct s_midi_ctrl *ct)
+{
+	int proc;
+
+	if(ct == NULL)
+		return;
+	save_ctrls(w, target, ct->next);
+	proc = stim_proc_id(ct);
+	if(proc < 0)
+		w->error = true;
+	put_int(w, proc);
+	put_int(w, ct->regs.pfv ? ct->regs.pfv - target->perframe_regs : -1);
+	put_int(w, ct->regs.pvv ? ct->regs.pvv - target->pervertex_regs : -1);
+}
+
+static void save_stim(struct writer *w, const struct stimuli *s)
+{
+	const struct s_midi_ctrl *ct;
+	int i, j, n;
+
+	put_int(w, s != NULL);
+	if(s == NULL)
+		return;
+	for(i=0;i<MIDI_CHANS+1;i++) {
+		if(s->midi[i] == NULL)
+			continue;
+		for(j=0;j<MIDI_CTRLS;j++) {
+			n = 0;
+			for(ct = s->midi[i]->ctrl[j]; ct; ct = ct->next)
+				n++;
+			if(n == 0)
+				continue;
+			put_int(w, i);
+			put_int(w, j);
+			put_int(w, n);
+			save_ctrls(w, s->target, s->midi[i]->ctrl[j]);
+		}
+	}
+	put_int(w, -1);
+}
+
+static void save_patch(struct writer *w, const struct patch *p)
+{
+	const struct image *img;
+	int len;
+
+	put_int(w, p->n_images);
+	for(img = p->images; img != p->images+p->n_images; img++) {
+		if(img->filename == NULL) {
+			put_int(w, -1);
+			continue;
+		}
+		len = strlen(img->filename);
+		put_int(w, len);
+		put(w, img->filename, len);
+		put_ll(w, img->st.st_mtime);
+		put_ll(w, img->st.st_size);
+	}
+
+	put(w, p->pfv_initial, sizeof(p->pfv_initial));
+	put(w, p->pfv_allocation, sizeof(p->pfv_allocation));
+	put_int(w, p->perframe_prog_length);
+	put(w, p->perframe_prog, 4*p->perframe_prog_length);
+	put(w, p->perframe_regs, sizeof(p->perframe_regs));
+
+	put(w, p->pvv_allocation, sizeof(p->pvv_allocation));
+	put_int(w, p->pervertex_prog_length);
+	put(w, p->pervertex_prog, 4*p->pervertex_prog_length);
+	put(w, p->pervertex_regs, sizeof(p->pervertex_regs));
+
+	put_int(w, p->n_hoisted);
+	put(w, p->hoisted_pfv, sizeof(int)*p->n_hoisted);
+	put(w, p->hoisted_pvv, sizeof(int)*p->n_hoisted);
+
+	put_int(w, p->require);
+	put_int(w, p->disabled);
+	save_stim(w, p->stim);
+}
+
+static bool load_image(struct reader *r, struct image *img)
+{
+	struct stat st;
+	char *filename;
+	long long mtime, size;
+	int len;
+
+	len = get_int(r);
+	if(len < 0)
+		return !r->error;
+	if(r->error || (len > r->end - r->data))
+		return false;
+	filename = malloc(len+1);
+	if(filename == NULL)
+		return false;
+	get(r, filename, len);
+	filename[len] = 0;
+	mtime = get_ll(r);
+	size = get_ll(r);
+	if(r->error || (lstat(filename, &st) < 0)
+	    || (st.st_mtime != mtime) || (st.st_size != size)) {
+		free(filename);
+		return false;
+	}
+	img->pixbuf = pixbuf_get(filename);
+	if(img->pixbuf == NULL) {
+		free(filename);
+		return false;
+	}
+	img->filename = filename;
+	img->st = st;
+	return true;
+}
+
+static bool load_reg(struct reader *r, float *regs, float **reg)
+{
+	int n;
+
+	n = get_int(r);
+	if(n < 0)
+		return true;
+	if(n >= PFPU_REG_COUNT)
+		return false;
+	*reg = regs+n;
+	return true;
+}
+
+static bool load_stim(struct reader *r, struct patch *p)
+{
+	struct stim_regs *regs;
+	int chan, ctrl, n, proc;
+
+	if(!get_int(r))
+		return !r->error;
+	p->stim = stim_new(p);
+	if(p->stim == NULL)
+		return false;
+	while(1) {
+		chan = get_int(r);
+		if(r->error)
+			return false;
+		if(chan < 0)
+			return true;
+		ctrl = get_int(r);
+		n = get_int(r);
+		while(n-- > 0) {
+			proc = get_int(r);
+			if(r->error)
+				return false;
+			regs = stim_restore(p->stim, chan, ctrl, proc);
+			if(regs == NULL)
+				return false;
+			if(!load_reg(r, p->perframe_regs, &regs->pfv))
+				return false;
+			if(!load_reg(r, p->pervertex_regs, &regs->pvv))
+				return false;
+		}
+	}
+}
+
+static bool load_prog(struct reader *r, int *length, unsigned int *prog)
+{
+	*length = get_int(r);
+	if((*length < 0) || (*length > PFPU_PROGSIZE))
+		return false;
+	get(r, prog, 4**length);
+	return !r->error;
+}
+
+/* NULL if the record is damaged or out of date */
+static struct patch *load_patch(struct reader *r)
+{
+	struct patch *p;
+	int i, n;
+
+	p = calloc(1, sizeof(struct patch));
+	if(p == NULL)
+		return NULL;
+	p->ref = 1;
+
+	n = get_int(r);
+	if(r->error || (n < 0) || (n > r->end - r->data))
+		goto fail;
+	if(n > 0) {
+		p->images = calloc(n, sizeof(struct image));
+		if(p->images == NULL)
+			goto fail;
+	}
+	p->n_images = n;
+	for(i=0;i<n;i++)
+		if(!load_image(r, p->images+i))
+			goto fail;
+
+	get(r, p->pfv_initial, sizeof(p->pfv_initial));
+	get(r, p->pfv_allocation, sizeof(p->pfv_allocation));
+	if(!load_prog(r, &p->perframe_prog_length, p->perframe_prog))
+		goto fail;
+	get(r, p->perframe_regs, sizeof(p->perframe_regs));
+
+	get(r, p->pvv_allocation, sizeof(p->pvv_allocation));
+	if(!load_prog(r, &p->pervertex_prog_length, p->pervertex_prog))
+		goto fail;
+	get(r, p->pervertex_regs, sizeof(p->pervertex_regs));
+
+	n = get_int(r);
+	if((n < 0) || (n > COMP_HOIST_MAX))
+		goto fail;
+	p->n_hoisted = n;
+	get(r, p->hoisted_pfv, sizeof(int)*n);
+	get(r, p->hoisted_pvv, sizeof(int)*n);
+	for(i=0;i<n;i++)
+		if((p->hoisted_pfv[i] >= PFPU_REG_COUNT)
+		    || (p->hoisted_pvv[i] >= PFPU_REG_COUNT))
+			goto fail;
+
+	p->require = get_int(r);
+	p->disabled = get_int(r);
+	if(!load_stim(r, p))
+		goto fail;
+	if(r->error || (r->data != r->end))
+		goto fail;
+	return p;
+
+fail:
+	patch_free(p);
+	return NULL;
+}
+
+/* ----- Cache ------------------------------------------------------------- */
+
+static void drop_entry(int i)
+{
+	free(entries[i].record);
+	n_entries--;
+	memmove(&entries[i], &entries[i+1], (n_entries-i)*sizeof(struct entry));
+	dirty = true;
+}
+
+static void add_entry(uint64_t hash, int code_len, char *record, int len)
+{
+	if(n_entries == PATCHCACHE_MAX) {
+		/* the least recently used is last */
+		free(entries[n_entries-1].record);
+		n_entries--;
+	}
+	memmove(&entries[1], &entries[0], n_entries*sizeof(struct entry));
+	entries[0].hash = hash;
+	entries[0].code_len = code_len;
+	entries[0].len = len;
+	entries[0].record = record;
+	entries[0].used = true;
+	n_entries++;
+}
+
+static int find_entry(uint64_t hash, int code_len)
+{
+	int i;
+
+	for(i=0;i<n_entries;i++)
+		if((entries[i].hash == hash)
+		    && (entries[i].code_len == code_len))
+			return i;
+	return -1;
+}
+
+static const int header[] = {
+	PATCHCACHE_MAGIC, PATCHCACHE_VERSION, COMP_VERSION,
+	COMP_PFV_COUNT, COMP_PVV_COUNT, PFPU_PROGSIZE, PFPU_REG_COUNT
+};
+
+#define HEADER_LEN	((int)(sizeof(header)/sizeof(header[0])))
+
+void patchcache_load(const char *cachename)
+{
+	FILE *fd;
+	uint64_t hash;
+	char *record;
+	int h[HEADER_LEN];
+	int i, n, code_len, len;
+
+	patchcache_free();
+
+	fd = fopen(cachename, "rb");
+	if(fd == NULL)
+		return;
+	if((fread(h, sizeof(h), 1, fd) != 1)
+	    || (memcmp(h, header, sizeof(h)) != 0)
+	    || (fread(&n, sizeof(n), 1, fd) != 1)) {
+		/* from another firmware: start over */
+		dirty = true;
+		fclose(fd);
+		return;
+	}
+	if(n > PATCHCACHE_MAX)
+		n = PATCHCACHE_MAX;
+	for(i=0;i<n;i++) {
+		if((fread(&hash, sizeof(hash), 1, fd) != 1)
+		    || (fread(&code_len, sizeof(code_len), 1, fd) != 1)
+		    || (fread(&len, sizeof(len), 1, fd) != 1)
+		    || (len < 0) || (len > 1024*1024))
+			break;
+		record = malloc(len);
+		if(record == NULL)
+			break;
+		if(fread(record, 1, len, fd) != len) {
+			free(record);
+			break;
+		}
+		entries[n_entries].hash = hash;
+		entries[n_entries].code_len = code_len;
+		entries[n_entries].len = len;
+		entries[n_entries].record = record;
+		entries[n_entries].used = false;
+		n_entries++;
+	}
+	if(i != n)
+		dirty = true;
+	fclose(fd);
+}
+
+static void write_entries(FILE *fd, bool used)
+{
+	int i;
+
+	for(i=0;i<n_entries;i++) {
+		if(entries[i].used != used)
+			continue;
+		fwrite(&entries[i].hash, sizeof(entries[i].hash), 1, fd);
+		fwrite(&entries[i].code_len, sizeof(entries[i].code_len), 1,
+		    fd);
+		fwrite(&entries[i].len, sizeof(entries[i].len), 1, fd);
+		fwrite(entries[i].record, 1, entries[i].len, fd);
+	}
+}
+
+int patchcache_save(const char *cachename)
+{
+	FILE *fd;
+	char tmpname[384];
+
+	if(!dirty)
+		return 1;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.new", cachename);
+	fd = fopen(tmpname, "wb");
+	if(fd == NULL) return 0;
+	fwrite(header, sizeof(header), 1, fd);
+	fwrite(&n_entries, sizeof(n_entries), 1, fd);
+	/* most recently used first */
+	write_entries(fd, true);
+	write_entries(fd, false);
+	if(ferror(fd)) {
+		fclose(fd);
+		remove(tmpname);
+		return 0;
+	}
+	if(fclose(fd) != 0) {
+		remove(tmpname);
+		return 0;
+	}
+	if(rename(tmpname, cachename) < 0) {
+		remove(tmpname);
+		return 0;
+	}
+	dirty = false;
+	return 1;
+}
+
+void patchcache_free(void)
+{
+	int i;
+
+	for(i=0;i<n_entries;i++)
+		free(entries[i].record);
+	n_entries = 0;
+	dirty = false;
+}
+
+struct patch *patchcache_lookup(const char *filename, const char *code)
+{
+	struct reader r;
+	struct patch *p;
+	int i;
+
+	i = find_entry(hash_patch(filename, code), strlen(code));
+	if(i < 0)
+		return NULL;
+	r.data = entries[i].record;
+	r.end = entries[i].record + entries[i].len;
+	r.error = false;
+	p = load_patch(&r);
+	if(p == NULL) {
+		drop_entry(i);
+		return NULL;
+	}
+	entries[i].used = true;
+	return p;
+}
+
+void patchcache_store(const char *filename, const char *code,
+    const struct patch *p)
+{
+	struct writer w;
+	uint64_t hash;
+	int i;
+
+	w.data = NULL;
+	w.len = 0;
+	w.size = 0;
+	w.error = false;
+	save_patch(&w, p);
+	if(w.error) {
+		free(w.data);
+		return;
+	}
+
+	hash = hash_patch(filename, code);
+	i = find_entry(hash, strlen(code));
+	if(i >= 0)
+		drop_entry(i);
+	add_entry(hash, strlen(code), w.data, w.len);
+	dirty = true;
+}
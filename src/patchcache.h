@@ -0,0 +1,49 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PATCHCACHE_H
+#define __PATCHCACHE_H
+
+#include "compiler/compiler.h"
+
+/*
+ * Compiled patches, kept on the flash across reboots.
+ *
+ * An entry holds everything patch_compile produces (microcode, register
+ * files, variable allocations, images and MIDI bindings) and is found by a
+ * hash of the patch source and of the directory it is in (image names are
+ * relative to it), checked against the length of the source. An entry is
+ * only used if its images still have the modification time and the size
+ * they had when the patch was compiled.
+ *
+ * The whole cache file is dropped when its format, the compiler output
+ * (COMP_VERSION) or the PFPU layout change. The most recently used
+ * PATCHCACHE_MAX entries are kept.
+ */
+
+#define PATCHCACHE_FILE		"/ssd/patches.cache"
+#define PATCHCACHE_MAX		256
+
+void patchcache_load(const char *cachename);
+int patchcache_save(const char *cachename);
+void patchcache_free(void);
+
+struct patch *patchcache_lookup(const char *filename, const char *code);
+void patchcache_store(const char *filename, const char *code,
+    const struct patch *p);
+
+#endif /* __PATCHCACHE_H */
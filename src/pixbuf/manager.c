@@ -18,13 +18,40 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <assert.h>
 #include <sys/stat.h>
+#include <rtems.h>
 
 #include "pixbuf.h"
 #include "loaders.h"
 
+/* patches are compiled by several tasks, which all load images */
+static rtems_id lock;
 static struct pixbuf *head;
 
+void pixbuf_init(void)
+{
+	rtems_status_code sc;
+
+	sc = rtems_semaphore_create(
+		rtems_build_name('P', 'I', 'X', 'B'),
+		1,
+		RTEMS_SIMPLE_BINARY_SEMAPHORE,
+		0,
+		&lock);
+	assert(sc == RTEMS_SUCCESSFUL);
+}
+
+static void lock_obtain(void)
+{
+	rtems_semaphore_obtain(lock, RTEMS_WAIT, RTEMS_NO_TIMEOUT);
+}
+
+static void lock_release(void)
+{
+	rtems_semaphore_release(lock);
+}
+
 struct pixbuf *pixbuf_new(int width, int height)
 {
 	struct pixbuf *p;
@@ -33,13 +60,27 @@ struct pixbuf *pixbuf_new(int width, int height)
 	if(p == NULL) return NULL;
 	p->refcnt = 1;
 	p->filename = NULL;
-	p->next = head;
 	p->width = width;
 	p->height = height;
+	lock_obtain();
+	p->next = head;
 	head = p;
+	lock_release();
 	return p;
 }
 
+/* must be called with the lock held */
+static struct pixbuf *find(const char *filename, const struct stat *st)
+{
+	struct pixbuf *p;
+
+	for(p = head; p; p = p->next)
+		if(p->filename && strcmp(p->filename, filename) == 0 &&
+		    st->st_mtime == p->st.st_mtime)
+			return p;
+	return NULL;
+}
+
 struct pixbuf *pixbuf_search(char *filename)
 {
 	struct pixbuf *p;
@@ -47,17 +88,19 @@ struct pixbuf *pixbuf_search(char *filename)
 
 	if(lstat(filename, &st) < 0)
 		return NULL;
-	for(p = head; p; p = p->next)
-		if(strcmp(p->filename, filename) == 0 &&
-		    st.st_mtime == p->st.st_mtime)
-			return p;
-	return NULL;
+	lock_obtain();
+	p = find(filename, &st);
+	lock_release();
+	return p;
 }
 
 void pixbuf_inc_ref(struct pixbuf *p)
 {
-	if(p != NULL)
-		p->refcnt++;
+	if(p == NULL)
+		return;
+	lock_obtain();
+	p->refcnt++;
+	lock_release();
 }
 
 void pixbuf_dec_ref(struct pixbuf *p)
@@ -66,10 +109,14 @@ void pixbuf_dec_ref(struct pixbuf *p)
 	
 	if(!p)
 		return;
-	if(--p->refcnt)
+	lock_obtain();
+	if(--p->refcnt) {
+		lock_release();
 		return;
+	}
 	for(anchor = &head; *anchor != p; anchor = &(*anchor)->next);
 	*anchor = p->next;
+	lock_release();
 	free(p->filename);
 	free(p);
 }
@@ -77,12 +124,17 @@ void pixbuf_dec_ref(struct pixbuf *p)
 struct pixbuf *pixbuf_get(char *filename)
 {
 	struct pixbuf *p;
+	struct stat st;
 	FILE *file;
 
-	p = pixbuf_search(filename);
-	if(p != NULL) {
-		pixbuf_inc_ref(p);
-		return p;
+	if(lstat(filename, &st) == 0) {
+		lock_obtain();
+		p = find(filename, &st);
+		if(p != NULL)
+			p->refcnt++;
+		lock_release();
+		if(p != NULL)
+			return p;
 	}
 
 	file = fopen(filename, "rb");
@@ -96,10 +148,12 @@ struct pixbuf *pixbuf_get(char *filename)
 		p = pixbuf_load_jpeg(file);
 	}
 	if(p) {
-		p->filename = strdup(filename);
 		fstat(fileno(file), &p->st);
+		lock_obtain();
+		p->filename = strdup(filename);
+		lock_release();
 		if(!p->filename) {
-			free(p);
+			pixbuf_dec_ref(p);
 			p = NULL;
 		}
 	}
@@ -114,7 +168,7 @@ struct pixbuf *pixbuf_update(struct pixbuf *p)
 	if(lstat(p->filename, &st) < 0)
 		return NULL;
 	if(st.st_mtime == p->st.st_mtime) {
-		p->refcnt++;
+		pixbuf_inc_ref(p);
 		return p;
 	}
 	return pixbuf_get(p->filename);
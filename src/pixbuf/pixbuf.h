@@ -29,6 +29,8 @@ struct pixbuf {
 	unsigned short pixels[];
 };
 
+void pixbuf_init(void);
+
 struct pixbuf *pixbuf_new(int width, int height);
 struct pixbuf *pixbuf_search(char *filename);
 void pixbuf_inc_ref(struct pixbuf *p);
@@ -16,7 +16,11 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 
+#include "framedescriptor.h"
+#include "sndring.h"
 #include "analyzer.h"
 
 #include "bandfilters.h"
@@ -70,3 +74,147 @@ void analyzer_put_sample(struct analyzer_state *sc, int left, int right)
 	sc->spointer--;
 	if(sc->spointer == -1) sc->spointer = BANDFILTER_NCOEF-1;
 }
+
+typedef int vint __attribute__((vector_size(ANALYZER_LANES*sizeof(int))));
+
+static vint vload(const int *p)
+{
+	vint v;
+
+	memcpy(&v, p, sizeof(vint));
+	return v;
+}
+
+static int vsum(vint v)
+{
+	union {
+		vint v;
+		int l[ANALYZER_LANES];
+	} u;
+	int i, r;
+
+	u.v = v;
+	r = 0;
+	for(i=0;i<ANALYZER_LANES;i++)
+		r += u.l[i];
+	return r;
+}
+
+static void put_chunk(struct analyzer_state *sc, const short *samples, int n)
+{
+	/* mono samples, newest first: the chunk, then the history */
+	int w[ANALYZER_BLOCK+BANDFILTER_NCOEF-1];
+	const int *x;
+	vint s, v_bass, v_mid, v_treb;
+	int r_bass, r_mid, r_treb;
+	int i, j;
+
+	for(i=0;i<n;i++)
+		w[i] = (samples[2*(n-1-i)] + samples[2*(n-1-i)+1]) >> 1;
+	for(i=0;i<BANDFILTER_NCOEF-1;i++)
+		w[n+i] = sc->last_samples[sc->spointer+1+i];
+
+	/*
+	 * Every term is shifted before the sum, as in analyzer_put_sample,
+	 * so that the lanes can be summed in any order.
+	 */
+	for(j=BANDFILTER_DECIMATION-1-sc->decimation;j<n;j+=BANDFILTER_DECIMATION) {
+		x = &w[n-1-j];
+		v_bass = v_mid = v_treb = (vint){};
+		for(i=0;i<BANDFILTER_NCOEF;i+=ANALYZER_LANES) {
+			s = vload(&x[i]);
+			v_bass += (vload(&bass_filter[i])*s) >> 15;
+			v_mid += (vload(&mid_filter[i])*s) >> 15;
+			v_treb += (vload(&treb_filter[i])*s) >> 15;
+		}
+		r_bass = vsum(v_bass);
+		r_mid = vsum(v_mid);
+		r_treb = vsum(v_treb);
+
+		sc->bass_acc += (r_bass*r_bass) >> 15;
+		sc->mid_acc += (r_mid*r_mid) >> 15;
+		sc->treb_acc += (r_treb*r_treb) >> 15;
+	}
+	sc->decimation = (sc->decimation + n) % BANDFILTER_DECIMATION;
+
+	/* the slot of the next sample is at spointer, the history after it */
+	sc->spointer = BANDFILTER_NCOEF-1;
+	for(i=0;i<BANDFILTER_NCOEF;i++) {
+		sc->last_samples[i] = w[i];
+		sc->last_samples[i+BANDFILTER_NCOEF] = w[i];
+	}
+}
+
+void analyzer_put_block(struct analyzer_state *sc, const short *samples, int n)
+{
+	int c;
+
+	while(n > 0) {
+		c = n < ANALYZER_BLOCK ? n : ANALYZER_BLOCK;
+		put_chunk(sc, samples, c);
+		samples += 2*c;
+		n -= c;
+	}
+}
+
+void analyzer_init_history(struct snd_history *history)
+{
+	analyzer_init(&history->analyzer);
+	history->streaming = true;
+	history->pos = 0;
+	history->bass_att = 0.0;
+	history->mid_att = 0.0;
+	history->treb_att = 0.0;
+	history->keep = 0.6;
+}
+
+void analyzer_set_frame_rate(struct snd_history *history, int fps)
+{
+	history->keep = pow(0.6, (double)FPS/(double)fps);
+	history->streaming = fps == FPS;
+}
+
+static void put_ring(struct analyzer_state *sc, const struct snd_ring *r,
+	unsigned int pos, int n)
+{
+	const short *samples;
+	int c;
+
+	while(n > 0) {
+		c = snd_ring_get(r, pos, n, &samples);
+		analyzer_put_block(sc, samples, c);
+		pos += c;
+		n -= c;
+	}
+}
+
+void analyze_snd(struct frame_descriptor *frd, struct snd_history *history)
+{
+	struct analyzer_state *analyzer = &history->analyzer;
+	unsigned int start, gap;
+
+	start = frd->snd_end - FRD_AUDIO_NSAMPLES;
+	if(history->streaming) {
+		/* sound of dropped frames, if still in the ring */
+		gap = start - history->pos;
+		if((gap > 0) && (gap <= SND_RING_HISTORY - FRD_AUDIO_NSAMPLES))
+			put_ring(analyzer, frd->snd_ring, history->pos, gap);
+		history->pos = frd->snd_end;
+		analyzer->bass_acc = 0;
+		analyzer->mid_acc = 0;
+		analyzer->treb_acc = 0;
+	} else
+		analyzer_init(analyzer);
+	put_ring(analyzer, frd->snd_ring, start, FRD_AUDIO_NSAMPLES);
+
+	frd->bass = ((float)analyzer->bass_acc)/1200000.0;
+	frd->mid = ((float)analyzer->mid_acc)/400000.0;
+	frd->treb = ((float)analyzer->treb_acc)/252000.0;
+
+	history->treb_att = history->keep*history->treb_att + (1.0-history->keep)*frd->treb;
+	history->mid_att = history->keep*history->mid_att + (1.0-history->keep)*frd->mid;
+	history->bass_att = history->keep*history->bass_att + (1.0-history->keep)*frd->bass;
+	frd->treb_att = history->treb_att;
+	frd->mid_att = history->mid_att;
+	frd->bass_att = history->bass_att;
+}
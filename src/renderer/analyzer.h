@@ -18,6 +18,8 @@
 #ifndef __ANALYZER_H
 #define __ANALYZER_H
 
+#include "framedescriptor.h"
+
 #define BANDFILTER_NCOEF	(128)
 #define BANDFILTER_DECIMATION	(8)
 
@@ -33,4 +35,43 @@ struct analyzer_state {
 void analyzer_init(struct analyzer_state *sc);
 void analyzer_put_sample(struct analyzer_state *sc, int left, int right);
 
+/*
+ * Same as calling analyzer_put_sample on each of the n interleaved stereo
+ * samples, with the same results, but computing the filters over whole
+ * blocks of ANALYZER_BLOCK samples at a time.
+ */
+#define ANALYZER_BLOCK		(128)
+#define ANALYZER_LANES		(4)
+
+void analyzer_put_block(struct analyzer_state *sc, const short *samples, int n);
+
+/*
+ * Per-frame band levels: analyze_snd runs the band filters over the sound
+ * of a frame descriptor, read from the sound ring, and sets its bass, mid
+ * and treb variables, and their attenuated versions from the history of
+ * the previous frames.
+ *
+ * At FPS frames per second, the sounds of consecutive frames follow each
+ * other and the filters run as one stream across frames: each frame gets
+ * the energy of the filter outputs due during its sound, as if the sound
+ * had been analyzed in one piece. The filters also run over the sound of
+ * frames that were dropped in between. At other rates, the sounds overlap
+ * and each one is analyzed from silence.
+ *
+ * The attenuation is tuned for FPS frames per second;
+ * analyzer_set_frame_rate keeps its time constant at other rates.
+ */
+
+struct snd_history {
+	struct analyzer_state analyzer;
+	bool streaming;
+	unsigned int pos;	/* end of the sound the filters have run over */
+	float bass_att, mid_att, treb_att;
+	double keep;	/* weight of the previous attenuated levels */
+};
+
+void analyzer_init_history(struct snd_history *history);
+void analyzer_set_frame_rate(struct snd_history *history, int fps);
+void analyze_snd(struct frame_descriptor *frd, struct snd_history *history);
+
 #endif /* __ANALYZER_H */
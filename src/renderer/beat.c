@@ -0,0 +1,279 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "framedescriptor.h"
+#include "beat.h"
+
+/* onset envelope, on integers for the autocorrelation */
+#define ENV_SCALE		(256.0f)
+#define ENV_MAX			(1023)	/* sums of 1024 products fit in 32 bits */
+
+#define RISE_KEEP		(0.8f)	/* at FPS frames per second */
+
+#define UPDATES_PER_SECOND	(4)
+
+/* candidate periods are tried in steps of 1/PERIOD_STEPS frame */
+#define PERIOD_STEPS		(16)
+#define MULTIPLES		(4)
+
+/* tempo preference, in octaves around BEAT_BPM_CENTER */
+#define BEAT_BPM_CENTER		(120.0f)
+#define BEAT_OCTAVE_WIDTH	(1.0f)
+
+/* score of the best period relative to the energy of the envelope */
+#define BEAT_CONFIDENCE		(0.15f)
+
+/* tempos within this fraction of the clock only adjust it */
+#define BEAT_TOLERANCE		(0.08f)
+#define BEAT_TEMPO_GAIN		(0.25f)
+
+/* onsets that pull the clock, and how much */
+#define BEAT_WINDOW		(0.25f)
+#define BEAT_PHASE_GAIN		(0.3f)
+#define BEAT_PERIOD_GAIN	(0.02f)
+
+/* how much the phase of the envelope pulls the clock */
+#define BEAT_ALIGN_GAIN		(0.5f)
+
+/* too large for the stack of the sampler task */
+static unsigned short lin[BEAT_HISTORY];
+static float acf[BEAT_HISTORY/2+2];
+
+void beat_init(struct beat_state *st, int fps)
+{
+	st->fps = fps;
+	st->length = BEAT_HISTORY_SECONDS*fps;
+	if(st->length > BEAT_HISTORY)
+		st->length = BEAT_HISTORY;
+	memset(st->env, 0, sizeof(st->env));
+	st->pos = 0;
+	st->filled = 0;
+	st->next_update = fps/UPDATES_PER_SECOND;
+	st->bass = 0.0f;
+	st->mid = 0.0f;
+	st->treb = 0.0f;
+	st->rise_keep = powf(RISE_KEEP, (float)FPS/fps);
+	st->rise_avg = 0.0f;
+	st->period = 60.0f*fps/BEAT_BPM_CENTER;
+	st->candidate = 0.0f;
+	st->bpm = 0.0f;
+	st->phase = 0.0f;
+	st->last_time = 0.0f;
+	st->clock = 0;
+	st->lead = 0.0f;
+	st->count = 0;
+}
+
+void beat_set_lead(struct beat_state *st, float seconds)
+{
+	st->lead = seconds > 0.0f ? seconds : 0.0f;
+}
+
+static float autocorrelation(int n, int lag)
+{
+	unsigned int sum;
+	int i;
+
+	sum = 0;
+	for(i=lag;i<n;i++)
+		sum += lin[i]*lin[i-lag];
+	return (float)sum/(n - lag);
+}
+
+/*
+ * Beats rarely fall on frame boundaries: the pairs of beats a fractional
+ * lag apart are split between the two nearest whole lags.
+ */
+static float acf_at(float lag)
+{
+	int i = lag;
+
+	if(i == lag)
+		return acf[i];
+	return acf[i] + acf[i+1];
+}
+
+/*
+ * Period of the envelope in frames, or 0. Each period is scored on its
+ * first MULTIPLES multiples, which also gives it to a fraction of a frame.
+ */
+static float estimate_period(struct beat_state *st)
+{
+	int n, i, k, lag_max, max;
+	float p, p_min, p_max, score, best_score, best, w;
+
+	n = st->filled;
+	for(i=0;i<n;i++)
+		lin[i] = st->env[(st->pos - n + i + st->length) % st->length];
+	lag_max = n/2;
+	for(i=0;i<=lag_max+1;i++)
+		acf[i] = autocorrelation(n, i);
+	if(acf[0] == 0.0f)
+		return 0.0f;
+
+	p_min = 60.0f*st->fps/BEAT_BPM_MAX;
+	if(p_min < 2.0f)
+		p_min = 2.0f;
+	p_max = 60.0f*st->fps/BEAT_BPM_MIN;
+	if(p_max > (float)lag_max/MULTIPLES)
+		p_max = (float)lag_max/MULTIPLES;
+
+	best = 0.0f;
+	best_score = 0.0f;
+	max = (p_max - p_min)*PERIOD_STEPS;
+	for(i=0;i<=max;i++) {
+		p = p_min + (float)i/PERIOD_STEPS;
+		score = 0.0f;
+		for(k=1;k<=MULTIPLES;k++)
+			score += acf_at(k*p);
+		score /= MULTIPLES;
+		w = log2f(60.0f*st->fps/(p*BEAT_BPM_CENTER))/BEAT_OCTAVE_WIDTH;
+		score *= expf(-0.5f*w*w);
+		if(score > best_score) {
+			best_score = score;
+			best = p;
+		}
+	}
+	if(best_score < BEAT_CONFIDENCE*acf[0])
+		return 0.0f;
+	return best;
+}
+
+/*
+ * Phase of the envelope at the last frame, from the offset that best
+ * lines up MULTIPLES of its beats. Uses lin from estimate_period.
+ */
+static float estimate_phase(struct beat_state *st)
+{
+	int n, o, k, i, sum, best, best_sum;
+
+	n = st->filled;
+	best = 0;
+	best_sum = -1;
+	for(o=0;o<st->period;o++) {
+		sum = 0;
+		for(k=0;k<MULTIPLES;k++) {
+			i = n - 1 - o - lrintf(k*st->period);
+			if(i >= 0)
+				sum += lin[i];
+		}
+		if(sum > best_sum) {
+			best_sum = sum;
+			best = o;
+		}
+	}
+	return best/st->period;
+}
+
+static void update_tempo(struct beat_state *st)
+{
+	float period, d;
+
+	period = estimate_period(st);
+	if(period == 0.0f) {
+		st->bpm = 0.0f;
+		st->candidate = 0.0f;
+		return;
+	}
+	if(fabsf(period - st->period) < BEAT_TOLERANCE*st->period) {
+		st->period += BEAT_TEMPO_GAIN*(period - st->period);
+		st->candidate = 0.0f;
+	} else if((st->bpm == 0.0f) || ((st->candidate != 0.0f)
+	    && (fabsf(period - st->candidate) < BEAT_TOLERANCE*st->candidate))) {
+		/* a new tempo, found twice in a row */
+		st->period = period;
+		st->candidate = 0.0f;
+	} else {
+		st->candidate = period;
+		return;
+	}
+	st->bpm = 60.0f*st->fps/st->period;
+
+	d = estimate_phase(st) - st->phase;
+	d -= floorf(d + 0.5f);
+	st->phase += BEAT_ALIGN_GAIN*d;
+	if(st->phase < 0.0f)
+		st->phase += 1.0f;
+}
+
+static float rise(float level, float last, float att)
+{
+	return level > last ? (level - last)/(att + 0.01f) : 0.0f;
+}
+
+void beat_track(struct frame_descriptor *frd, struct beat_state *st)
+{
+	float r, x, dt, err, ahead, n;
+
+	/* envelope: how much the band levels rise, above its recent average */
+	r = (rise(frd->bass, st->bass, frd->bass_att)
+	    + rise(frd->mid, st->mid, frd->mid_att)
+	    + rise(frd->treb, st->treb, frd->treb_att))/3.0f;
+	st->bass = frd->bass;
+	st->mid = frd->mid;
+	st->treb = frd->treb;
+	x = r - st->rise_avg;
+	st->rise_avg = st->rise_keep*st->rise_avg + (1.0f - st->rise_keep)*r;
+	x = x > 0.0f ? x*ENV_SCALE : 0.0f;
+	st->env[st->pos] = x > ENV_MAX ? ENV_MAX : x;
+	st->pos = (st->pos + 1) % st->length;
+	if(st->filled < st->length)
+		st->filled++;
+
+	if(--st->next_update <= 0) {
+		st->next_update = st->fps/UPDATES_PER_SECOND;
+		if(st->filled >= st->length/2)
+			update_tempo(st);
+	}
+
+	/* the clock follows the time of the frames, which may be late */
+	dt = frd->time - st->last_time;
+	if((dt <= 0.0f) || (dt > 1.0f))
+		dt = 1.0f/st->fps;
+	st->last_time = frd->time;
+	st->phase += dt*st->fps/st->period;
+	if((frd->onset > 0.0f) && (st->bpm > 0.0f)) {
+		err = st->phase - floorf(st->phase + 0.5f);
+		if(fabsf(err) < BEAT_WINDOW) {
+			st->phase -= BEAT_PHASE_GAIN*err;
+			st->period += BEAT_PERIOD_GAIN*err*st->period;
+			st->bpm = 60.0f*st->fps/st->period;
+		}
+	}
+	if(st->phase >= 1.0f) {
+		st->phase -= floorf(st->phase);
+		st->clock++;
+	}
+
+	/* a beat is output once, even if the clock is pulled back after it */
+	ahead = st->lead*st->fps/st->period;
+	if(ahead > 0.99f)
+		ahead = 0.99f;
+	ahead += st->phase;
+	n = floorf(ahead);
+	frd->beat = 0.0f;
+	if((int)(st->clock + (int)n - st->count) > 0) {
+		frd->beat = 1.0f;
+		st->count = st->clock + (int)n;
+	}
+	frd->beat_phase = ahead - n;
+	frd->bpm = st->bpm;
+}
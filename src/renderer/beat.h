@@ -0,0 +1,78 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BEAT_H
+#define __BEAT_H
+
+#include "framedescriptor.h"
+
+/*
+ * Beat and tempo tracking, from the band levels and onsets of each frame:
+ * beat_track must be called after analyze_snd and spectrum_analyze.
+ *
+ * The onset envelope is the flux of the bass, mid and treb levels: how
+ * much they rise from one frame to the next, relative to their attenuated
+ * versions. Unlike the FFT, the band filters see the whole sound buffer,
+ * so the envelope does not depend on where the beats fall in the frames.
+ * A few times per second, the tempo is estimated from the autocorrelation
+ * of the last BEAT_HISTORY_SECONDS of the envelope between BEAT_BPM_MIN
+ * and BEAT_BPM_MAX, weighted towards the tempos of most music. A beat clock
+ * runs at that tempo, and the onsets of the spectrum analysis that fall
+ * close to its beats pull it into phase and tempo.
+ *
+ * bpm is the tempo, or 0 as long as none stands out of the envelope (e.g.
+ * silence or ambient sound). beat is 1 on the frames where a beat falls and
+ * 0 otherwise, and beat_phase rises from 0 to 1 between two beats. Without
+ * a tempo, the clock keeps running at the last one found (120 at first).
+ * As with any tracker, music can be followed at half or twice its tempo,
+ * e.g. 170 as 85.
+ *
+ * beat_set_lead makes the outputs run ahead of the clock by up to almost a
+ * beat, to make up for the time the frames take to reach the screen (see
+ * lookahead.h).
+ */
+
+#define BEAT_BPM_MIN		(60)
+#define BEAT_BPM_MAX		(180)
+#define BEAT_HISTORY_SECONDS	(8)
+#define BEAT_HISTORY		(8*128)	/* up to 128 frames per second */
+
+struct beat_state {
+	int fps;
+	int length;			/* frames in the envelope */
+	unsigned short env[BEAT_HISTORY];
+	int pos;			/* where the next frame goes */
+	int filled;
+	int next_update;		/* frames before the next estimation */
+	float bass, mid, treb;		/* levels of the previous frame */
+	float rise_keep;
+	float rise_avg;
+	float period;			/* of the clock, in frames */
+	float candidate;		/* tempo that disagrees with the clock */
+	float bpm;
+	float phase;
+	float last_time;
+	unsigned int clock;		/* beats of the clock */
+	float lead;			/* in seconds */
+	unsigned int count;		/* beats since beat_init */
+};
+
+void beat_init(struct beat_state *st, int fps);
+void beat_set_lead(struct beat_state *st, float seconds);
+void beat_track(struct frame_descriptor *frd, struct beat_state *st);
+
+#endif /* __BEAT_H */
@@ -0,0 +1,34 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2010, 2011, 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EVALVARS_H
+#define __EVALVARS_H
+
+#include "../compiler/compiler.h"
+#include "framedescriptor.h"
+
+/*
+ * Transfer of variables between frame descriptors and the register files
+ * of a patch, around the evaluation of its per-frame and per-vertex code.
+ */
+
+void reinit_all_pfv(struct patch *p);
+void set_pfv_from_frd(struct patch *p, struct frame_descriptor *frd);
+void set_frd_from_pfv(struct patch *p, struct frame_descriptor *frd);
+void transfer_pvv_regs(struct patch *p);
+
+#endif /* __EVALVARS_H */
@@ -15,11 +15,15 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdbool.h>
 #include <stdlib.h>
+#ifndef STANDALONE
 #include <rtems.h>
 #include <bsp/milkymist_tmu.h>
+#endif
 
 #include "framedescriptor.h"
+#include "framestats.h"
 
 struct frame_descriptor *new_frame_descriptor(void)
 {
@@ -29,19 +33,14 @@ struct frame_descriptor *new_frame_descriptor(void)
 	if(frd == NULL)
 		return NULL;
 
-	frd->status = FRD_STATUS_NEW;
-
-	frd->snd_buf = malloc(sizeof(struct snd_buffer)+4*FRD_AUDIO_NSAMPLES);
-	if(frd->snd_buf == NULL) {
-		free(frd);
-		return NULL;
-	}
-	frd->snd_buf->nsamples = FRD_AUDIO_NSAMPLES;
-	frd->snd_buf->user = frd;
+	frd_set_status(frd, FRD_STATUS_NEW);
+	frd->snd_ring = NULL;
+	frd->snd_end = 0;
+	frd->snd_time = 0;
+	frd->disabled = 0;
 
 	if(posix_memalign((void **)&frd->vertices, sizeof(struct tmu_vertex),
 		sizeof(struct tmu_vertex)*TMU_MESH_MAXSIZE*TMU_MESH_MAXSIZE) != 0) {
-		free(frd->snd_buf);
 		free(frd);
 		return NULL;
 	}
@@ -52,6 +51,69 @@ struct frame_descriptor *new_frame_descriptor(void)
 void free_frame_descriptor(struct frame_descriptor *frd)
 {
 	free(frd->vertices);
-	free(frd->snd_buf);
 	free(frd);
 }
+
+void frd_set_status(struct frame_descriptor *frd, int status)
+{
+	frd->status_time[status] = framestats_now();
+	frd->status = status;
+}
+
+void frd_mark(struct frame_descriptor *frd, int mark)
+{
+	frd->mark_time[mark] = framestats_now();
+}
+
+static int clamp(int x, int min, int max)
+{
+	if(x < min)
+		return min;
+	if(x > max)
+		return max;
+	return x;
+}
+
+void frd_depth_init(struct frd_depth *d, int base, int max, int live_max,
+	int fps)
+{
+	d->max = clamp(max, FRD_COUNT_MIN, FRD_COUNT_MAX);
+	d->base = clamp(base, FRD_COUNT_MIN, d->max);
+	d->live_max = clamp(live_max, FRD_COUNT_MIN, d->max);
+	d->fps = fps;
+	d->count = d->base;
+	d->frames = 0;
+	d->stalls = 0;
+	d->calm = 0;
+}
+
+void frd_depth_stall(struct frd_depth *d)
+{
+	d->stalls++;
+}
+
+int frd_depth_update(struct frd_depth *d, bool live)
+{
+	int limit;
+
+	limit = live ? d->live_max : d->max;
+	if(++d->frames >= d->fps) {
+		if(d->stalls > 0) {
+			d->calm = 0;
+			if(d->count < limit)
+				d->count++;
+		} else if(++d->calm >= FRD_DEPTH_CALM) {
+			d->calm = 0;
+			if(d->count > d->base)
+				d->count--;
+		}
+		d->frames = 0;
+		d->stalls = 0;
+	}
+	/* back to base as soon as the limit allows, e.g. after live video */
+	if(d->count < d->base)
+		d->count = d->base;
+	if(d->count > limit)
+		d->count = limit;
+	return d->count;
+}
@@ -18,6 +18,8 @@
 #ifndef __FRAMEDESCRIPTOR_H
 #define __FRAMEDESCRIPTOR_H
 
+#include <stdbool.h>
+
 #ifndef STANDALONE
 #include <rtems.h>
 #include <bsp/milkymist_ac97.h>
@@ -26,9 +28,13 @@
 #endif /* STANDALONE */
 
 #include "../pixbuf/pixbuf.h"
+#include "sndring.h"
 
 #define FPS			24
-#define FRD_COUNT 		(4)
+#define FRD_COUNT_MIN		(2)
+#define FRD_COUNT_DEFAULT	(4)
+#define FRD_COUNT_MAX		(8)
+/* sound of each frame, up to its position in the ring */
 #define FRD_AUDIO_NSAMPLES	(48000/FPS)
 
 enum {
@@ -36,22 +42,55 @@ enum {
 	FRD_STATUS_SAMPLING,
 	FRD_STATUS_SAMPLED,
 	FRD_STATUS_EVALUATED,
-	FRD_STATUS_USED
+	FRD_STATUS_USED,
+	FRD_STATUS_COUNT
+};
+
+/* timestamped points in the tasks other than status changes */
+enum {
+	FRD_MARK_EVAL_START = 0,
+	FRD_MARK_RASTER_START,
+	FRD_MARK_WARPED,
+	FRD_MARK_DRAWN,
+	FRD_MARK_SWAPPED,
+	FRD_MARK_COUNT
 };
 
 #define IDMX_COUNT	8
 #define OSC_COUNT	4
 #define DMX_COUNT	8
 #define IMAGE_COUNT	2
+#define BAND_COUNT	32
+
+/*
+ * Features that the patch can't turn on, because what enables them keeps the
+ * same value in all frames, see patch_do_compile. Their parameters may not be
+ * computed.
+ */
+#define DISABLED_MV		(1 << 0)	/* motion vectors */
+#define DISABLED_BORDERS	(1 << 1)	/* outer and inner borders */
+#define DISABLED_WAVE		(1 << 2)
+#define DISABLED_VECHO		(1 << 3)	/* video echo */
+#define DISABLED_VIDEO		(1 << 4)	/* live video */
+#define DISABLED_IMAGE1		(1 << 5)
+#define DISABLED_IMAGE2		(1 << 6)
+#define DISABLED_DMX		(1 << 7)	/* DMX outputs are constant */
 
 struct frame_descriptor {
 	int status;
+	unsigned int status_time[FRD_STATUS_COUNT];	/* see framestats.h */
+	unsigned int mark_time[FRD_MARK_COUNT];
 
 	float time;
 	float frame;
-	struct snd_buffer *snd_buf;
+	const struct snd_ring *snd_ring;
+	unsigned int snd_end;	/* position after the sound of the frame */
+	unsigned int snd_time;	/* capture of the middle of the sound */
 	float bass, mid, treb;
 	float bass_att, mid_att, treb_att;
+	float band[BAND_COUNT];	/* see spectrum.h */
+	float peak, rms, onset;
+	float beat, beat_phase, bpm;	/* see beat.h */
 	float idmx[IDMX_COUNT];
 	float osc[OSC_COUNT];
 
@@ -83,6 +122,7 @@ struct frame_descriptor {
 	float image_x[IMAGE_COUNT], image_y[IMAGE_COUNT];
 	float image_zoom[IMAGE_COUNT];
 	int image_index[IMAGE_COUNT];
+	unsigned int disabled;		/* DISABLED_*, from the patch */
 
 	struct tmu_vertex *vertices;
 };
@@ -91,5 +131,39 @@ typedef void (*frd_callback)(struct frame_descriptor *);
 
 struct frame_descriptor *new_frame_descriptor(void);
 void free_frame_descriptor(struct frame_descriptor *frd);
+void frd_set_status(struct frame_descriptor *frd, int status);
+void frd_mark(struct frame_descriptor *frd, int mark);
+
+/*
+ * Depth of the pipeline, i.e. how many frame descriptors are in flight.
+ *
+ * The depth starts at base. After a second in which the sampler had to
+ * wait for a frame descriptor to come back from downstream (losing audio,
+ * or a frame at rates other than FPS), it grows by one, up to max. After
+ * FRD_DEPTH_CALM seconds without waiting, it goes back down by one toward
+ * base. While the patch uses live video, latency matters more and the
+ * depth is kept at or below live_max.
+ *
+ * The sampler calls frd_depth_stall each time it waits, and
+ * frd_depth_update once per frame to get the depth to use.
+ */
+
+#define FRD_DEPTH_CALM		(10)
+
+struct frd_depth {
+	int count;	/* current depth */
+	int base;
+	int max;
+	int live_max;
+	int fps;
+	int frames;	/* frames in the current second */
+	int stalls;	/* waits in the current second */
+	int calm;	/* seconds in a row without waiting */
+};
+
+void frd_depth_init(struct frd_depth *d, int base, int max, int live_max,
+	int fps);
+void frd_depth_stall(struct frd_depth *d);
+int frd_depth_update(struct frd_depth *d, bool live);
 
 #endif /* __FRAMEDESCRIPTOR_H */
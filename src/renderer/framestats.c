@@ -0,0 +1,191 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifndef STANDALONE
+#include <rtems.h>
+#endif
+
+#include "framedescriptor.h"
+#include "framestats.h"
+
+const char *framestats_stage_names[FRAMESTATS_STAGE_COUNT] = {
+	"audio",
+	"eval wait",
+	"eval",
+	"raster wait",
+	"warp",
+	"draw",
+	"output",
+	"latency",
+	"sync",
+	"interval"
+};
+
+struct frame_sample {
+	unsigned int t[FRAMESTATS_STAGE_COUNT];
+};
+
+static struct frame_sample history[FRAMESTATS_HISTORY];
+static unsigned int recorded;		/* frames since reset */
+static unsigned int dropped;
+static unsigned int min[FRAMESTATS_STAGE_COUNT];
+static unsigned int max[FRAMESTATS_STAGE_COUNT];
+static unsigned long long sum[FRAMESTATS_STAGE_COUNT];
+static unsigned int last_used;
+static unsigned int frame_rate = FPS;
+static unsigned int frame_period = 1000000/FPS;
+static volatile int reset_request = 1;
+static volatile unsigned int sync_avg;	/* over the last few frames */
+
+unsigned int framestats_now(void)
+{
+	struct timespec ts;
+
+#ifdef STANDALONE
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	rtems_clock_get_uptime(&ts);
+#endif
+	return (unsigned int)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void do_reset(void)
+{
+	int i;
+
+	recorded = 0;
+	dropped = 0;
+	for(i=0;i<FRAMESTATS_STAGE_COUNT;i++) {
+		min[i] = ~0;
+		max[i] = 0;
+		sum[i] = 0;
+	}
+}
+
+void framestats_record(const struct frame_descriptor *frd)
+{
+	struct frame_sample *s;
+	const unsigned int *st = frd->status_time;
+	const unsigned int *mt = frd->mark_time;
+	unsigned int used;
+	int i;
+
+	if(reset_request) {
+		reset_request = 0;
+		do_reset();
+	}
+
+	used = st[FRD_STATUS_USED];
+	s = &history[recorded % FRAMESTATS_HISTORY];
+	s->t[FRAMESTATS_AUDIO] = st[FRD_STATUS_SAMPLED] - st[FRD_STATUS_SAMPLING];
+	s->t[FRAMESTATS_EVAL_WAIT] = mt[FRD_MARK_EVAL_START] - st[FRD_STATUS_SAMPLED];
+	s->t[FRAMESTATS_EVAL] = st[FRD_STATUS_EVALUATED] - mt[FRD_MARK_EVAL_START];
+	s->t[FRAMESTATS_RASTER_WAIT] = mt[FRD_MARK_RASTER_START] - st[FRD_STATUS_EVALUATED];
+	s->t[FRAMESTATS_WARP] = mt[FRD_MARK_WARPED] - mt[FRD_MARK_RASTER_START];
+	s->t[FRAMESTATS_DRAW] = mt[FRD_MARK_DRAWN] - mt[FRD_MARK_WARPED];
+	s->t[FRAMESTATS_OUTPUT] = mt[FRD_MARK_SWAPPED] - mt[FRD_MARK_DRAWN];
+	s->t[FRAMESTATS_LATENCY] = used - st[FRD_STATUS_SAMPLED];
+	s->t[FRAMESTATS_SYNC] = used - frd->snd_time;
+	if(recorded)
+		sync_avg += ((int)s->t[FRAMESTATS_SYNC] - (int)sync_avg)/8;
+	else
+		sync_avg = s->t[FRAMESTATS_SYNC];
+	/* the first frame has no predecessor: count it as on time */
+	s->t[FRAMESTATS_INTERVAL] = recorded ? used - last_used : frame_period;
+	last_used = used;
+
+	/* a frame shown more than half a period late took the slot of another */
+	if(s->t[FRAMESTATS_INTERVAL] > frame_period + frame_period/2)
+		dropped += (s->t[FRAMESTATS_INTERVAL] + frame_period/2)/frame_period - 1;
+
+	for(i=0;i<FRAMESTATS_STAGE_COUNT;i++) {
+		if(s->t[i] < min[i])
+			min[i] = s->t[i];
+		if(s->t[i] > max[i])
+			max[i] = s->t[i];
+		sum[i] += s->t[i];
+	}
+	recorded++;
+}
+
+void framestats_reset(void)
+{
+	reset_request = 1;
+}
+
+void framestats_set_frame_rate(int fps)
+{
+	frame_rate = fps;
+	frame_period = 1000000/fps;
+	reset_request = 1;
+}
+
+unsigned int framestats_get_sync(void)
+{
+	return sync_avg;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+void framestats_get(struct framestats_summary *s)
+{
+	unsigned int values[FRAMESTATS_HISTORY];
+	unsigned int n;
+	int i, j;
+
+	memset(s, 0, sizeof(struct framestats_summary));
+	if(reset_request)
+		return;
+	s->frames = recorded;
+	s->dropped = dropped;
+	if(s->frames == 0)
+		return;
+	n = s->frames < FRAMESTATS_HISTORY ? s->frames : FRAMESTATS_HISTORY;
+	for(i=0;i<FRAMESTATS_STAGE_COUNT;i++) {
+		s->stages[i].min = min[i];
+		s->stages[i].avg = sum[i]/s->frames;
+		s->stages[i].max = max[i];
+		for(j=0;j<n;j++)
+			values[j] = history[j].t[i];
+		qsort(values, n, sizeof(unsigned int), cmp_uint);
+		s->stages[i].p99 = values[(99*n + 99)/100 - 1];
+	}
+}
+
+void framestats_print(void)
+{
+	struct framestats_summary s;
+	int i;
+
+	framestats_get(&s);
+	printf("%-12s %9s %9s %9s %9s  (ms)\n", "", "min", "avg", "p99", "max");
+	for(i=0;i<FRAMESTATS_STAGE_COUNT;i++)
+		printf("%-12s %9.3f %9.3f %9.3f %9.3f\n", framestats_stage_names[i],
+			s.stages[i].min/1000.0, s.stages[i].avg/1000.0,
+			s.stages[i].p99/1000.0, s.stages[i].max/1000.0);
+	printf("%u frames, %u dropped at %u fps\n", s.frames, s.dropped, frame_rate);
+}
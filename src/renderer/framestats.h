@@ -0,0 +1,89 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FRAMESTATS_H
+#define __FRAMESTATS_H
+
+#include "framedescriptor.h"
+
+/*
+ * Frame timing statistics.
+ *
+ * Frame descriptors are timestamped at each status change and at a few
+ * points inside the eval and raster tasks (see frd_set_status and
+ * frd_mark). When the raster task is done with a frame, framestats_record
+ * turns its timestamps into the durations of the stages below and keeps
+ * them in a ring of the last FRAMESTATS_HISTORY frames.
+ *
+ * framestats_get summarizes them: min, average and max over all frames
+ * since the last reset, and the 99th percentile over the ring. A frame is
+ * counted as dropped for each frame period missed between two consecutive
+ * frames, at the rate given by framestats_set_frame_rate (FPS by default).
+ *
+ * The sync stage is how late the visuals are on the music: from the
+ * capture of the middle of the sound of a frame (snd_time) to its display.
+ * framestats_get_sync follows it closely, for the look-ahead of the
+ * sampler (see lookahead.h).
+ *
+ * framestats_record must only be called from one task; the other functions
+ * may be called from anywhere. A summary taken while a frame is being
+ * recorded may include that frame partially.
+ */
+
+#define FRAMESTATS_HISTORY	(256)
+
+enum {
+	FRAMESTATS_AUDIO = 0,	/* SAMPLING to SAMPLED */
+	FRAMESTATS_EVAL_WAIT,	/* SAMPLED to eval start */
+	FRAMESTATS_EVAL,	/* eval start to EVALUATED */
+	FRAMESTATS_RASTER_WAIT,	/* EVALUATED to raster start */
+	FRAMESTATS_WARP,	/* raster start to warped */
+	FRAMESTATS_DRAW,	/* warped to drawn (waves, video, images) */
+	FRAMESTATS_OUTPUT,	/* drawn to swapped (scaling, OSD, swap) */
+	FRAMESTATS_LATENCY,	/* SAMPLED to USED */
+	FRAMESTATS_SYNC,	/* snd_time to USED */
+	FRAMESTATS_INTERVAL,	/* USED to USED of the next frame */
+	FRAMESTATS_STAGE_COUNT
+};
+
+extern const char *framestats_stage_names[FRAMESTATS_STAGE_COUNT];
+
+/* all times in microseconds */
+struct framestats_stage {
+	unsigned int min;
+	unsigned int avg;
+	unsigned int p99;
+	unsigned int max;
+};
+
+struct framestats_summary {
+	unsigned int frames;	/* recorded since the last reset */
+	unsigned int dropped;
+	struct framestats_stage stages[FRAMESTATS_STAGE_COUNT];
+};
+
+/* monotonic time in microseconds, wrapping around */
+unsigned int framestats_now(void);
+
+void framestats_record(const struct frame_descriptor *frd);
+void framestats_reset(void);
+void framestats_set_frame_rate(int fps);
+void framestats_get(struct framestats_summary *s);
+unsigned int framestats_get_sync(void);
+void framestats_print(void);
+
+#endif /* __FRAMESTATS_H */
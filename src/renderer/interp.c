@@ -0,0 +1,404 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifndef STANDALONE
+#include <rtems.h>
+#include <bsp/milkymist_tmu.h>
+#endif
+
+#include "framedescriptor.h"
+#include "framestats.h"
+#include "renderer.h"
+
+#include "interp.h"
+
+/****************************************************************/
+/* KEY FRAMES                                                   */
+/****************************************************************/
+
+static struct frame_descriptor *key[2];	/* older, newer */
+static int keys;
+static unsigned int key_time;		/* arrival of key[1] */
+static unsigned int last_frame;
+
+int interp_init(void)
+{
+	key[0] = new_frame_descriptor();
+	key[1] = new_frame_descriptor();
+	if((key[0] == NULL) || (key[1] == NULL)) {
+		interp_free();
+		return 0;
+	}
+	keys = 0;
+	return 1;
+}
+
+void interp_free(void)
+{
+	int i;
+
+	for(i=0;i<2;i++) {
+		if(key[i] != NULL)
+			free_frame_descriptor(key[i]);
+		key[i] = NULL;
+	}
+}
+
+/* copies everything but the mesh, keeping the buffer of dst */
+static void copy_fields(struct frame_descriptor *dst,
+	const struct frame_descriptor *src)
+{
+	struct tmu_vertex *vertices = dst->vertices;
+
+	*dst = *src;
+	dst->vertices = vertices;
+}
+
+static void copy_vertices(struct tmu_vertex *dst, const struct tmu_vertex *src)
+{
+	int y;
+
+	for(y=0;y<=renderer_vmeshlast;y++)
+		memcpy(&dst[y*TMU_MESH_MAXSIZE], &src[y*TMU_MESH_MAXSIZE],
+			(renderer_hmeshlast+1)*sizeof(struct tmu_vertex));
+}
+
+void interp_key(const struct frame_descriptor *frd, unsigned int now)
+{
+	struct frame_descriptor *k;
+
+	k = key[0];
+	key[0] = key[1];
+	key[1] = k;
+	copy_fields(key[1], frd);
+	copy_vertices(key[1]->vertices, frd->vertices);
+	if(keys == 0) {
+		copy_fields(key[0], frd);
+		copy_vertices(key[0]->vertices, frd->vertices);
+		last_frame = now;
+	}
+	if(keys < 2)
+		keys++;
+	key_time = now;
+}
+
+/****************************************************************/
+/* SYNTHESIS                                                    */
+/****************************************************************/
+
+#define FIELD(f) { offsetof(struct frame_descriptor, f), \
+	sizeof(((struct frame_descriptor *)0)->f)/sizeof(float) }
+
+/* per-frame outputs that vary continuously */
+static const struct {
+	size_t offset;
+	int n;
+} lerp_fields[] = {
+	FIELD(time),
+	FIELD(bass), FIELD(mid), FIELD(treb),
+	FIELD(bass_att), FIELD(mid_att), FIELD(treb_att),
+	FIELD(band), FIELD(peak), FIELD(rms), FIELD(bpm),
+	FIELD(idmx), FIELD(osc),
+	FIELD(decay),
+	FIELD(wave_scale), FIELD(wave_x), FIELD(wave_y),
+	FIELD(wave_r), FIELD(wave_g), FIELD(wave_b), FIELD(wave_a),
+	FIELD(ob_size), FIELD(ob_r), FIELD(ob_g), FIELD(ob_b), FIELD(ob_a),
+	FIELD(ib_size), FIELD(ib_r), FIELD(ib_g), FIELD(ib_b), FIELD(ib_a),
+	FIELD(mv_dx), FIELD(mv_dy), FIELD(mv_l),
+	FIELD(mv_r), FIELD(mv_g), FIELD(mv_b), FIELD(mv_a),
+	FIELD(vecho_alpha), FIELD(vecho_zoom),
+	FIELD(dmx), FIELD(video_a),
+	FIELD(image_a), FIELD(image_x), FIELD(image_y), FIELD(image_zoom)
+};
+
+#define LERP_FIELD_COUNT (sizeof(lerp_fields)/sizeof(lerp_fields[0]))
+
+static void lerp_vertices(struct tmu_vertex *out, const struct tmu_vertex *a,
+	const struct tmu_vertex *b, float t, float step)
+{
+	int x, y, o;
+	float ix, iy, vx, vy;
+
+	for(y=0;y<=renderer_vmeshlast;y++) {
+		iy = (float)((y*renderer_squareh) << TMU_FIXEDPOINT_SHIFT);
+		for(x=0;x<=renderer_hmeshlast;x++) {
+			o = y*TMU_MESH_MAXSIZE + x;
+			ix = (float)((x*renderer_squarew) << TMU_FIXEDPOINT_SHIFT);
+			vx = a[o].x + (b[o].x - a[o].x)*t;
+			vy = a[o].y + (b[o].y - a[o].y)*t;
+			/* same fraction of the displacement as of the period */
+			out[o].x = ix + (vx - ix)*step;
+			out[o].y = iy + (vy - iy)*step;
+		}
+	}
+}
+
+void interp_frame(struct frame_descriptor *out, unsigned int now)
+{
+	const struct frame_descriptor *a = key[0];
+	const struct frame_descriptor *b = key[1];
+	float span, t, step;
+	const float *fa, *fb;
+	float *fo;
+	int i, j;
+
+	span = b->time - a->time;
+	if(span <= 0.0f)
+		span = 1.0f/FPS;
+	t = (now - key_time)/(1000000.0f*span);
+	if(t > 1.0f + INTERP_EXTRAPOLATE)
+		t = 1.0f + INTERP_EXTRAPOLATE;
+	step = (now - last_frame)/(1000000.0f*span);
+	if((step <= 0.0f) || (step > 1.0f))
+		step = 1.0f;
+	last_frame = now;
+
+	copy_fields(out, t < 0.5f ? a : b);
+	for(i=0;i<LERP_FIELD_COUNT;i++) {
+		fa = (const float *)((const char *)a + lerp_fields[i].offset);
+		fb = (const float *)((const char *)b + lerp_fields[i].offset);
+		fo = (float *)((char *)out + lerp_fields[i].offset);
+		for(j=0;j<lerp_fields[i].n;j++)
+			fo[j] = fa[j] + (fb[j] - fa[j])*t;
+	}
+	if(out->decay > 0.0f)
+		out->decay = powf(out->decay, step);
+	/* the wave follows the sound, which is not there yet past b */
+	out->snd_end = a->snd_end
+	    + (int)((int)(b->snd_end - a->snd_end)*(t < 1.0f ? t : 1.0f));
+	out->snd_time = a->snd_time
+	    + (int)((int)(b->snd_time - a->snd_time)*(t < 1.0f ? t : 1.0f));
+	lerp_vertices(out->vertices, a->vertices, b->vertices, t, step);
+}
+
+/****************************************************************/
+/* TASK                                                         */
+/****************************************************************/
+
+#ifndef STANDALONE
+
+/* synthesized frames in flight to the raster task */
+#define INTERP_COUNT	(3)
+
+struct interp_task_param {
+	int fps;
+	frd_callback callback;
+	frd_callback return_callback;
+};
+
+static rtems_id interp_q;
+static rtems_id interp_terminated;
+
+static int find_frame(struct frame_descriptor **frames, bool *busy,
+	struct frame_descriptor *frd)
+{
+	int i;
+
+	for(i=0;i<INTERP_COUNT;i++) {
+		if(frd == NULL ? !busy[i] : frames[i] == frd)
+			return i;
+	}
+	return -1;
+}
+
+static rtems_task interp_task(rtems_task_argument argument)
+{
+	struct interp_task_param *param = (struct interp_task_param *)argument;
+	struct frame_descriptor *frames[INTERP_COUNT];
+	bool busy[INTERP_COUNT];
+	struct frame_descriptor *frd;
+	rtems_interval timeout;
+	rtems_status_code sc;
+	unsigned int now, next, period;
+	bool started;
+	size_t s;
+	int i;
+
+	for(i=0;i<INTERP_COUNT;i++) {
+		frames[i] = new_frame_descriptor();
+		busy[i] = false;
+	}
+	for(i=0;i<INTERP_COUNT;i++) {
+		if(frames[i] == NULL) {
+			printf("Unable to allocate interpolated frames\n");
+			goto end;
+		}
+	}
+	if(!interp_init()) {
+		printf("Unable to allocate key frames\n");
+		goto end;
+	}
+
+	period = 1000000/param->fps;
+	next = 0;
+	started = false;
+	while(1) {
+		timeout = RTEMS_NO_TIMEOUT;
+		if(started && (find_frame(frames, busy, NULL) != -1)) {
+			now = framestats_now();
+			if((int)(next - now) <= 0) {
+				i = find_frame(frames, busy, NULL);
+				/* keeps the status and timestamps of a key frame */
+				interp_frame(frames[i], now);
+				busy[i] = true;
+				next += period;
+				if((int)(now - next) >= 0)
+					next = now + period;
+				param->callback(frames[i]);
+				continue;
+			}
+			timeout = ((next - now)*rtems_clock_get_ticks_per_second()
+				+ 999999)/1000000;
+		}
+
+		sc = rtems_message_queue_receive(
+			interp_q,
+			&frd,
+			&s,
+			RTEMS_WAIT,
+			timeout
+		);
+		if(sc == RTEMS_TIMEOUT)
+			continue;
+		/* Task termination is requested by sending a NULL frd */
+		if(frd == NULL)
+			break;
+		i = find_frame(frames, busy, frd);
+		if(i != -1) {
+			/* Returned by raster */
+			busy[i] = false;
+			continue;
+		}
+
+		assert(frd->status == FRD_STATUS_EVALUATED);
+#ifndef WITH_SOFTPFPU
+		/* the PFPU wrote the mesh behind the data cache */
+		rtems_cache_invalidate_multiple_data_lines(frd->vertices,
+			sizeof(struct tmu_vertex)*TMU_MESH_MAXSIZE*(renderer_vmeshlast+1));
+#endif
+		now = framestats_now();
+		interp_key(frd, now);
+		if(!started) {
+			/* the sampler has set up the statistics by now */
+			framestats_set_frame_rate(param->fps);
+			next = now;
+			started = true;
+		}
+		frd_set_status(frd, FRD_STATUS_USED);
+		param->return_callback(frd);
+	}
+
+	/* Wait for raster to be done with our frames */
+	while(1) {
+		bool all_returned;
+
+		all_returned = true;
+		for(i=0;i<INTERP_COUNT;i++) {
+			if(busy[i]) {
+				all_returned = false;
+				break;
+			}
+		}
+		if(all_returned)
+			break;
+
+		rtems_message_queue_receive(
+			interp_q,
+			&frd,
+			&s,
+			RTEMS_WAIT,
+			RTEMS_NO_TIMEOUT
+		);
+		i = find_frame(frames, busy, frd);
+		if(i != -1)
+			busy[i] = false;
+	}
+
+	interp_free();
+end:
+	for(i=0;i<INTERP_COUNT;i++)
+		if(frames[i] != NULL)
+			free_frame_descriptor(frames[i]);
+	free(param);
+	rtems_semaphore_release(interp_terminated);
+	rtems_task_delete(RTEMS_SELF);
+}
+
+static rtems_id interp_task_id;
+
+void interp_start(int fps, frd_callback callback, frd_callback return_callback)
+{
+	struct interp_task_param *param;
+	rtems_status_code sc;
+
+	sc = rtems_message_queue_create(
+		rtems_build_name('I', 'N', 'T', 'P'),
+		FRD_COUNT_MAX + INTERP_COUNT,
+		sizeof(void *),
+		0,
+		&interp_q);
+	assert(sc == RTEMS_SUCCESSFUL);
+
+	sc = rtems_semaphore_create(
+		rtems_build_name('I', 'N', 'T', 'P'),
+		0,
+		RTEMS_SIMPLE_BINARY_SEMAPHORE,
+		0,
+		&interp_terminated);
+	assert(sc == RTEMS_SUCCESSFUL);
+
+	param = malloc(sizeof(struct interp_task_param));
+	assert(param != NULL);
+	param->fps = fps;
+	param->callback = callback;
+	param->return_callback = return_callback;
+
+	sc = rtems_task_create(rtems_build_name('I', 'N', 'T', 'P'), 10, RTEMS_MINIMUM_STACK_SIZE,
+		RTEMS_PREEMPT | RTEMS_NO_TIMESLICE | RTEMS_NO_ASR,
+		0, &interp_task_id);
+	assert(sc == RTEMS_SUCCESSFUL);
+	sc = rtems_task_start(interp_task_id, interp_task, (rtems_task_argument)param);
+	assert(sc == RTEMS_SUCCESSFUL);
+}
+
+void interp_input(struct frame_descriptor *frd)
+{
+	rtems_message_queue_send(interp_q, &frd, sizeof(void *));
+}
+
+void interp_stop(void)
+{
+	void *dummy;
+
+	dummy = NULL;
+	rtems_message_queue_send(interp_q, &dummy, sizeof(void *));
+
+	rtems_semaphore_obtain(interp_terminated, RTEMS_WAIT, RTEMS_NO_TIMEOUT);
+
+	/* task self-deleted and freed interp_task_param */
+	rtems_semaphore_delete(interp_terminated);
+	rtems_message_queue_delete(interp_q);
+}
+
+#endif /* STANDALONE */
@@ -0,0 +1,57 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INTERP_H
+#define __INTERP_H
+
+#include "framedescriptor.h"
+
+/*
+ * Optional stage between eval and raster that presents frames at a display
+ * rate of its own.
+ *
+ * Each evaluated frame is copied into a key frame and given back to the
+ * sampler at once. At each display period, a frame is synthesized between
+ * the last two key frames, one evaluation period behind them: continuous
+ * per-frame outputs and mesh vertices are interpolated linearly, discrete
+ * ones (wave mode, texture wrap, images, ...) and the sound are taken from
+ * the nearest key frame. When the next key frame is late, the last two are
+ * extrapolated for up to INTERP_EXTRAPOLATE evaluation periods.
+ *
+ * Since the raster stage applies the decay and the warp once per frame
+ * shown, both are scaled down to the fraction of an evaluation period
+ * covered by each synthesized frame, so that the feedback runs at the same
+ * speed whatever the display rate.
+ */
+
+#define INTERP_EXTRAPOLATE	(0.5f)
+
+/* portable part, also used on the host */
+int interp_init(void);
+void interp_free(void);
+void interp_key(const struct frame_descriptor *frd, unsigned int now);
+void interp_frame(struct frame_descriptor *out, unsigned int now);
+
+/*
+ * Task: frames from eval and frames returned by raster both go to
+ * interp_input. Evaluated frames are given back through return_callback.
+ */
+void interp_start(int fps, frd_callback callback, frd_callback return_callback);
+void interp_input(struct frame_descriptor *frd);
+void interp_stop(void);
+
+#endif /* __INTERP_H */
@@ -0,0 +1,358 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <fpvm/fpvm.h>
+#include <fpvm/pfpu.h>
+
+#include "softpfpu.h"
+#include "vpfpu.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && (VPFPU_LANES % 4 == 0)
+
+#include <sys/mman.h>
+
+/*
+ * Calling convention (System V): rdi = register file, rsi = VECTOUT
+ * operands, rdx = SIN table. Only rax and xmm0-xmm2 are used, which are
+ * all caller-saved, so there is no prologue.
+ */
+#define RDI	7
+#define RSI	6
+
+#define VREG_SIZE	(VPFPU_LANES*4)
+#define CHUNKS		(VPFPU_LANES/4)
+
+/* worst case: SIN/COS, 25 bytes per lane */
+#define MAX_OP_SIZE	(128*CHUNKS)
+
+enum {
+	K_ABS,		/* 0x7fffffff */
+	K_SIGN,		/* 0x80000000 */
+	K_ONE,		/* 1.0f */
+	K_MAGIC,	/* QUAKE constant */
+	K_COUNT
+};
+
+static const unsigned int constants[K_COUNT] = {
+	0x7fffffff, 0x80000000, 0x3f800000, 0x5f3759df
+};
+
+struct fixup {
+	int pos;	/* position of the rip-relative displacement */
+	int k;		/* constant it refers to */
+};
+
+struct jit_buf {
+	unsigned char *code;
+	int len;
+	struct fixup *fixups;
+	int n_fixups;
+};
+
+struct jit_code {
+	void *code;
+	size_t size;
+	bool vectout;	/* program has a VECTOUT */
+};
+
+static void byte(struct jit_buf *b, unsigned char c)
+{
+	b->code[b->len++] = c;
+}
+
+static void u32(struct jit_buf *b, unsigned int v)
+{
+	byte(b, v);
+	byte(b, v >> 8);
+	byte(b, v >> 16);
+	byte(b, v >> 24);
+}
+
+/* op xmm, [base+disp32] (or the reverse for stores) */
+static void sse_mem(struct jit_buf *b, int prefix, int opc, int xmm,
+    int base, int disp)
+{
+	if(prefix)
+		byte(b, prefix);
+	byte(b, 0x0f);
+	byte(b, opc);
+	byte(b, 0x80 | (xmm << 3) | base);
+	u32(b, disp);
+}
+
+/* op xmm, xmm */
+static void sse_reg(struct jit_buf *b, int prefix, int opc, int dst, int src)
+{
+	if(prefix)
+		byte(b, prefix);
+	byte(b, 0x0f);
+	byte(b, opc);
+	byte(b, 0xc0 | (dst << 3) | src);
+}
+
+/* op xmm, [rip+constant] */
+static void sse_const(struct jit_buf *b, int opc, int xmm, int k)
+{
+	byte(b, 0x0f);
+	byte(b, opc);
+	byte(b, (xmm << 3) | 5);
+	b->fixups[b->n_fixups].pos = b->len;
+	b->fixups[b->n_fixups].k = k;
+	b->n_fixups++;
+	u32(b, 0);
+}
+
+#define MOVAPS_LOAD	0x28
+#define MOVAPS_STORE	0x29
+#define CVTDQ2PS	0x5b	/* CVTTPS2DQ with the F3 prefix */
+#define ANDPS		0x54
+#define ANDNPS		0x55
+#define ORPS		0x56
+#define XORPS		0x57
+#define ADDPS		0x58
+#define MULPS		0x59
+#define SUBPS		0x5c
+#define CMPPS		0xc2
+#define PCMPEQD		0x76	/* with the 66 prefix, as the two below */
+#define PXOR		0xef
+#define PSUBD		0xfa
+
+#define DISP(r, c)	((r)*VREG_SIZE + (c)*16)
+
+static void load(struct jit_buf *b, int xmm, int r, int c)
+{
+	sse_mem(b, 0, MOVAPS_LOAD, xmm, RDI, DISP(r, c));
+}
+
+static void store(struct jit_buf *b, int xmm, int r, int c)
+{
+	sse_mem(b, 0, MOVAPS_STORE, xmm, RDI, DISP(r, c));
+}
+
+static void trig(struct jit_buf *b, const struct vpfpu_op *op, int c,
+    bool cos)
+{
+	int l, src, dst;
+
+	for(l=0;l<4;l++) {
+		src = DISP(op->opa, c) + 4*l;
+		dst = DISP(op->dest, c) + 4*l;
+		/* mov eax, [rdi+src] */
+		byte(b, 0x8b);
+		byte(b, 0x87);
+		u32(b, src);
+		/* add eax, quarter turn */
+		if(cos) {
+			byte(b, 0x05);
+			u32(b, SOFTPFPU_TRIG_STEPS/4);
+		}
+		/* and eax, steps-1 */
+		byte(b, 0x25);
+		u32(b, SOFTPFPU_TRIG_STEPS-1);
+		/* mov eax, [rdx+rax*4] */
+		byte(b, 0x8b);
+		byte(b, 0x04);
+		byte(b, 0x82);
+		/* mov [rdi+dst], eax */
+		byte(b, 0x89);
+		byte(b, 0x87);
+		u32(b, dst);
+	}
+}
+
+static void translate(struct jit_buf *b, const struct vpfpu_op *op, int c)
+{
+	switch(op->opcode) {
+		case FPVM_OPCODE_FADD:
+			load(b, 0, op->opa, c);
+			sse_mem(b, 0, ADDPS, 0, RDI, DISP(op->opb, c));
+			break;
+		case FPVM_OPCODE_FSUB:
+			load(b, 0, op->opa, c);
+			sse_mem(b, 0, SUBPS, 0, RDI, DISP(op->opb, c));
+			break;
+		case FPVM_OPCODE_FMUL:
+			load(b, 0, op->opa, c);
+			sse_mem(b, 0, MULPS, 0, RDI, DISP(op->opb, c));
+			break;
+		case FPVM_OPCODE_FABS:
+			load(b, 0, op->opa, c);
+			sse_const(b, ANDPS, 0, K_ABS);
+			break;
+		case FPVM_OPCODE_F2I:
+			load(b, 0, op->opa, c);
+			sse_reg(b, 0xf3, CVTDQ2PS, 0, 0);
+			break;
+		case FPVM_OPCODE_I2F:
+			load(b, 0, op->opa, c);
+			sse_reg(b, 0, CVTDQ2PS, 0, 0);
+			break;
+		case FPVM_OPCODE_SIN:
+		case FPVM_OPCODE_COS:
+			trig(b, op, c, op->opcode == FPVM_OPCODE_COS);
+			return;
+		case FPVM_OPCODE_ABOVE:
+			/* a > b is b < a */
+			load(b, 0, op->opb, c);
+			sse_mem(b, 0, CMPPS, 0, RDI, DISP(op->opa, c));
+			byte(b, 1);
+			sse_const(b, ANDPS, 0, K_ONE);
+			break;
+		case FPVM_OPCODE_EQUAL:
+			load(b, 0, op->opa, c);
+			sse_mem(b, 0, CMPPS, 0, RDI, DISP(op->opb, c));
+			byte(b, 0);
+			sse_const(b, ANDPS, 0, K_ONE);
+			break;
+		case FPVM_OPCODE_COPY:
+			load(b, 0, op->opa, c);
+			break;
+		case FPVM_OPCODE_IF:
+			/* xmm2 = lanes where IFB is zero */
+			load(b, 1, SOFTPFPU_REG_IFB, c);
+			sse_reg(b, 0x66, PXOR, 2, 2);
+			sse_reg(b, 0x66, PCMPEQD, 2, 1);
+			load(b, 0, op->opb, c);
+			sse_reg(b, 0, ANDPS, 0, 2);
+			sse_mem(b, 0, ANDNPS, 2, RDI, DISP(op->opa, c));
+			sse_reg(b, 0, ORPS, 0, 2);
+			break;
+		case FPVM_OPCODE_TSIGN:
+			load(b, 0, op->opa, c);
+			sse_const(b, ANDPS, 0, K_ABS);
+			load(b, 1, op->opb, c);
+			sse_const(b, ANDPS, 1, K_SIGN);
+			sse_reg(b, 0, ORPS, 0, 1);
+			break;
+		case FPVM_OPCODE_QUAKE:
+			load(b, 1, op->opa, c);
+			/* psrld xmm1, 1 */
+			byte(b, 0x66);
+			byte(b, 0x0f);
+			byte(b, 0x72);
+			byte(b, 0xd1);
+			byte(b, 1);
+			sse_const(b, MOVAPS_LOAD, 0, K_MAGIC);
+			sse_reg(b, 0x66, PSUBD, 0, 1);
+			break;
+		case FPVM_OPCODE_VECTOUT:
+			load(b, 0, op->opa, c);
+			sse_mem(b, 0, MOVAPS_STORE, 0, RSI, c*16);
+			load(b, 0, op->opb, c);
+			sse_mem(b, 0, MOVAPS_STORE, 0, RSI, VREG_SIZE + c*16);
+			return;
+		default:
+			sse_reg(b, 0, XORPS, 0, 0);
+			break;
+	}
+	store(b, 0, op->dest, c);
+}
+
+struct jit_code *jit_compile(const struct vpfpu_prog *vp)
+{
+	struct jit_code *jc;
+	struct jit_buf b;
+	size_t size;
+	int i, c, pool, disp;
+
+	size = vp->n_ops*MAX_OP_SIZE + 16 + K_COUNT*16;
+	b.code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(b.code == MAP_FAILED)
+		return NULL;
+	/* at most two constants per op and chunk */
+	b.fixups = malloc((2*vp->n_ops*CHUNKS + 1)*sizeof(struct fixup));
+	if(b.fixups == NULL) {
+		munmap(b.code, size);
+		return NULL;
+	}
+	b.len = 0;
+	b.n_fixups = 0;
+
+	for(i=0;i<vp->n_ops;i++)
+		for(c=0;c<CHUNKS;c++)
+			translate(&b, &vp->ops[i], c);
+	byte(&b, 0xc3);	/* ret */
+
+	/* constant pool, 16-byte aligned after the code */
+	pool = (b.len + 15) & ~15;
+	for(i=0;i<K_COUNT;i++)
+		for(c=0;c<4;c++)
+			*(unsigned int *)(b.code + pool + 16*i + 4*c) =
+			    constants[i];
+	for(i=0;i<b.n_fixups;i++) {
+		disp = pool + 16*b.fixups[i].k - (b.fixups[i].pos + 4);
+		*(int *)(b.code + b.fixups[i].pos) = disp;
+	}
+	free(b.fixups);
+
+	if(mprotect(b.code, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(b.code, size);
+		return NULL;
+	}
+
+	jc = malloc(sizeof(struct jit_code));
+	if(jc == NULL) {
+		munmap(b.code, size);
+		return NULL;
+	}
+	jc->code = b.code;
+	jc->size = size;
+	jc->vectout = false;
+	for(i=0;i<vp->n_ops;i++)
+		if(vp->ops[i].opcode == FPVM_OPCODE_VECTOUT)
+			jc->vectout = true;
+	return jc;
+}
+
+typedef void (*jit_fn)(void *regs, void *out, const float *sin_table);
+
+bool jit_run(const struct jit_code *jc, void *regs, void *out)
+{
+	((jit_fn)jc->code)(regs, out, softpfpu_sin_table);
+	return jc->vectout;
+}
+
+void jit_free(struct jit_code *jc)
+{
+	if(jc == NULL)
+		return;
+	munmap(jc->code, jc->size);
+	free(jc);
+}
+
+#else /* __x86_64__ */
+
+struct jit_code *jit_compile(const struct vpfpu_prog *vp)
+{
+	return NULL;
+}
+
+bool jit_run(const struct jit_code *jc, void *regs, void *out)
+{
+	return false;
+}
+
+void jit_free(struct jit_code *jc)
+{
+}
+
+#endif /* __x86_64__ */
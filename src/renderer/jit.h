@@ -0,0 +1,45 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __JIT_H
+#define __JIT_H
+
+#include <stdbool.h>
+
+#include "vpfpu.h"
+
+/*
+ * Native code generator for lowered PFPU programs.
+ *
+ * jit_compile translates the operations of a vpfpu_prog into straight-line
+ * SSE2 code working on the same vector register file as the interpreter
+ * in vpfpu.c, four lanes per instruction. The generated function stores
+ * the VECTOUT operands to out[0] (X) and out[1] (Y) and leaves scattering
+ * them over the mesh to the caller. jit_run returns false if the program
+ * has no VECTOUT, in which case out is left untouched.
+ *
+ * Only x86-64 is supported for now; on any other host jit_compile returns
+ * NULL and the caller keeps interpreting.
+ */
+
+struct jit_code;
+
+struct jit_code *jit_compile(const struct vpfpu_prog *vp);
+bool jit_run(const struct jit_code *jc, void *regs, void *out);
+void jit_free(struct jit_code *jc);
+
+#endif /* __JIT_H */
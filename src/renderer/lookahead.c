@@ -0,0 +1,70 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <math.h>
+
+#include "framedescriptor.h"
+#include "lookahead.h"
+
+/* smoothing of the slopes, at FPS frames per second */
+#define SLOPE_KEEP		(0.5f)
+
+void lookahead_init(struct lookahead_state *st, int fps)
+{
+	int i;
+
+	st->fps = fps;
+	st->keep = powf(SLOPE_KEEP, (float)FPS/fps);
+	st->started = false;
+	for(i=0;i<LOOKAHEAD_LEVELS;i++) {
+		st->last[i] = 0.0f;
+		st->slope[i] = 0.0f;
+	}
+}
+
+void lookahead_predict(struct frame_descriptor *frd,
+	struct lookahead_state *st, float ahead)
+{
+	float *levels[LOOKAHEAD_LEVELS];
+	float x;
+	int i;
+
+	levels[0] = &frd->bass;
+	levels[1] = &frd->mid;
+	levels[2] = &frd->treb;
+	levels[3] = &frd->bass_att;
+	levels[4] = &frd->mid_att;
+	levels[5] = &frd->treb_att;
+	for(i=0;i<BAND_COUNT;i++)
+		levels[6+i] = &frd->band[i];
+
+	if(ahead < 0.0f)
+		ahead = 0.0f;
+	if(ahead > LOOKAHEAD_MAX)
+		ahead = LOOKAHEAD_MAX;
+	for(i=0;i<LOOKAHEAD_LEVELS;i++) {
+		x = *levels[i];
+		if(st->started)
+			st->slope[i] = st->keep*st->slope[i]
+			    + (1.0f - st->keep)*(x - st->last[i])*st->fps;
+		st->last[i] = x;
+		x += st->slope[i]*ahead;
+		*levels[i] = x > 0.0f ? x : 0.0f;
+	}
+	st->started = true;
+}
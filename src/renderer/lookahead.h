@@ -0,0 +1,54 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOOKAHEAD_H
+#define __LOOKAHEAD_H
+
+#include "framedescriptor.h"
+
+/*
+ * Look-ahead: making up for how late the visuals are on the music.
+ *
+ * A frame is displayed well after the sound it was computed from: half
+ * its sound buffer, then eval and raster. framestats measures that delay
+ * (the sync stage). Without delaying anything, the look-ahead mode of the
+ * sampler predicts the band levels (bass, mid, treb, their attenuated
+ * versions and the spectrum bands) at the time the frame will be shown,
+ * by extrapolating each one along its recent trend, and runs the beat
+ * clock ahead by as much (see beat_set_lead).
+ *
+ * Trends of sound levels do not last: predictions go no further than
+ * LOOKAHEAD_MAX seconds ahead, and levels never fall below 0.
+ */
+
+#define LOOKAHEAD_MAX		(0.25f)
+#define LOOKAHEAD_LEVELS	(6+BAND_COUNT)
+
+struct lookahead_state {
+	int fps;
+	float keep;
+	bool started;
+	float last[LOOKAHEAD_LEVELS];	/* levels of the previous frame */
+	float slope[LOOKAHEAD_LEVELS];	/* per second */
+};
+
+void lookahead_init(struct lookahead_state *st, int fps);
+/* ahead is in seconds, e.g. framestats_get_sync()/1e6 */
+void lookahead_predict(struct frame_descriptor *frd,
+	struct lookahead_state *st, float ahead);
+
+#endif /* __LOOKAHEAD_H */
@@ -22,6 +22,12 @@
 #include <bsp/milkymist_tmu.h>
 
 #include "font.h"
+#ifdef WITH_SOFTTMU
+#include "softtmu.h"
+#define tmu_ioctl softtmu_ioctl
+#else
+#define tmu_ioctl ioctl
+#endif
 #include "osd.h"
 
 #define OSD_W 600
@@ -146,6 +152,6 @@ void osd_per_frame(int tmu_fd, unsigned short *dest, int hres, int vres)
 	td.invalidate_before = true;
 	td.invalidate_after = false;
 
-	ioctl(tmu_fd, TMU_EXECUTE, &td);
+	tmu_ioctl(tmu_fd, TMU_EXECUTE, &td);
 }
 
@@ -0,0 +1,41 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2010, 2011, 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RASTEROPS_H
+#define __RASTEROPS_H
+
+#include <stdbool.h>
+
+#include "framedescriptor.h"
+#include "wave.h"
+
+/*
+ * Drawing steps of the raster stage that do not depend on any device other
+ * than the TMU, shared between the renderer and host builds.
+ */
+
+void raster_warp(int tmu_fd, unsigned short *src, unsigned short *dest, struct tmu_vertex *vertices, bool tex_wrap, unsigned int brightness);
+void compute_wave_vertices(struct frame_descriptor *frd, struct wave_params *params, struct wave_vertex *vertices, int *nvertices);
+void software_draw(unsigned short *fb, struct frame_descriptor *frd, struct wave_params *params, struct wave_vertex *vertices, int nvertices);
+void init_scale_vertices(struct tmu_vertex *vertices);
+void init_vecho_vertices(struct tmu_vertex *vertices, struct frame_descriptor *frd);
+void raster_scale(int tmu_fd, struct tmu_vertex *vertices,
+	unsigned short *src, unsigned short *dest,
+	int src_hres, int src_vres, int hres, int vres, int alpha, bool additive, bool invalidate);
+int raster_brightness(float *error, float decay);
+
+#endif /* __RASTEROPS_H */
@@ -20,11 +20,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "../config.h"
 #include "sampler.h"
 #include "../compiler/compiler.h"
 #include "eval.h"
+#include "interp.h"
 #include "raster.h"
 #include "osd.h"
+#include "framestats.h"
 #include "../gui/rsswall.h"
 
 #include "renderer.h"
@@ -35,6 +38,9 @@ int renderer_vmeshlast;
 int renderer_squarew;
 int renderer_squareh;
 
+/* frames shown per second when interpolating, 0 to show evaluated frames */
+static int display_rate;
+
 static int mashup_en;
 static struct patch *mashup_head;
 static struct patch *current_patch;
@@ -171,9 +177,20 @@ void renderer_start(int framebuffer_fd, struct patch *p)
 	renderer_squarew = renderer_texsize/renderer_hmeshlast;
 	renderer_squareh = renderer_texsize/renderer_vmeshlast;
 
+	display_rate = config_read_int("display_rate", 0);
+	if(display_rate > 120)
+		display_rate = 120;
+
 	osd_init();
-	raster_start(framebuffer_fd, sampler_return);
-	eval_start(raster_input);
+	framestats_reset();
+	if(display_rate > 0) {
+		raster_start(framebuffer_fd, interp_input);
+		interp_start(display_rate, raster_input, sampler_return);
+		eval_start(interp_input);
+	} else {
+		raster_start(framebuffer_fd, sampler_return);
+		eval_start(raster_input);
+	}
 	sampler_start(eval_input);
 	rsswall_start();
 }
@@ -185,6 +202,8 @@ void renderer_stop(void)
 	rsswall_stop();
 	sampler_stop();
 	eval_stop();
+	if(display_rate > 0)
+		interp_stop();
 	raster_stop();
 
 	while(mashup_head != NULL) {
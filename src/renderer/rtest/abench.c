@@ -0,0 +1,221 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Band analysis of a WAV file, as done by the sampler.
+ *
+ * Prints the band levels of each frame, with enough digits to tell any
+ * two floats apart, so that the output can be compared with golden files
+ * (see test/). With -p, the levels are computed one sample at a time with
+ * analyzer_put_sample instead of analyze_snd, and must come out the same.
+ * The sound goes through the sound ring one frame at a time, as recorded by
+ * the sampler.
+ * With -b, the analysis is repeated over the whole file and its throughput
+ * is reported.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../framedescriptor.h"
+#include "../sndring.h"
+#include "../analyzer.h"
+
+#include "wavfile.h"
+
+static struct snd_buffer *sound;	/* the whole file, in whole frames */
+static struct frame_descriptor **frames;
+static int nframes;
+static int frame_nsamples;
+static struct snd_ring ring;
+
+static void load(struct wav *wav, int fps)
+{
+	int i;
+
+	frame_nsamples = 48000/fps;
+	nframes = (wav->remaining/(2*wav->channels) + frame_nsamples - 1)
+	    /frame_nsamples;
+	sound = malloc(sizeof(struct snd_buffer)+4*nframes*frame_nsamples);
+	frames = malloc(nframes*sizeof(*frames));
+	if((sound == NULL) || (frames == NULL)) {
+		perror("malloc");
+		exit(1);
+	}
+	sound->nsamples = nframes*frame_nsamples;
+	wav_read(wav, sound);
+	for(i=0;i<nframes;i++) {
+		frames[i] = new_frame_descriptor();
+		if(frames[i] == NULL) {
+			perror("new_frame_descriptor");
+			exit(1);
+		}
+		frames[i]->frame = i;
+		frames[i]->snd_ring = &ring;
+	}
+}
+
+/* reference, with the same state and scaling as analyze_snd */
+static void analyze_per_sample(struct frame_descriptor *frd,
+	struct snd_history *history)
+{
+	struct analyzer_state *a = &history->analyzer;
+	unsigned int pos;
+
+	if(history->streaming) {
+		a->bass_acc = 0;
+		a->mid_acc = 0;
+		a->treb_acc = 0;
+	} else
+		analyzer_init(a);
+	for(pos=frd->snd_end-FRD_AUDIO_NSAMPLES;pos!=frd->snd_end;pos++)
+		analyzer_put_sample(a, snd_ring_sample(&ring, pos, 0),
+		    snd_ring_sample(&ring, pos, 1));
+	frd->bass = ((float)a->bass_acc)/1200000.0;
+	frd->mid = ((float)a->mid_acc)/400000.0;
+	frd->treb = ((float)a->treb_acc)/252000.0;
+	history->treb_att = history->keep*history->treb_att + (1.0-history->keep)*frd->treb;
+	history->mid_att = history->keep*history->mid_att + (1.0-history->keep)*frd->mid;
+	history->bass_att = history->keep*history->bass_att + (1.0-history->keep)*frd->bass;
+	frd->treb_att = history->treb_att;
+	frd->mid_att = history->mid_att;
+	frd->bass_att = history->bass_att;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/*
+ * Records the sound into the ring one frame at a time, as the sampler
+ * does, and returns the time spent analyzing it.
+ */
+static double analyze(int fps, bool per_sample)
+{
+	struct snd_history history;
+	struct frame_descriptor *frd;
+	double start, elapsed;
+	int i;
+
+	if(!snd_ring_init(&ring)) {
+		perror("snd_ring_init");
+		exit(1);
+	}
+	analyzer_init_history(&history);
+	if(fps != FPS)
+		analyzer_set_frame_rate(&history, fps);
+	elapsed = 0.0;
+	for(i=0;i<nframes;i++) {
+		frd = frames[i];
+		snd_ring_put(&ring,
+		    (const short *)&sound->samples[i*frame_nsamples],
+		    frame_nsamples);
+		frd->snd_end = ring.written;
+		start = now();
+		if(per_sample)
+			analyze_per_sample(frd, &history);
+		else
+			analyze_snd(frd, &history);
+		elapsed += now() - start;
+	}
+	return elapsed;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+"usage: %s [-b repeat] [-f fps] [-p] [-q] file.wav\n\n"
+"  -b repeat analyze the file this many times and report the throughput\n"
+"            on stderr\n"
+"  -f fps    frame rate (default: %d, frames of sound back to back)\n"
+"  -p        analyze one sample at a time with analyzer_put_sample\n"
+"  -q        do not print the levels of each frame\n"
+    , name, FPS);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct wav wav;
+	struct frame_descriptor *frd;
+	int repeat = 1, fps = FPS;
+	bool per_sample = false, quiet = false;
+	double elapsed, samples;
+	int c, i;
+
+	while((c = getopt(argc, argv, "b:f:pq")) != EOF)
+		switch(c) {
+			case 'b':
+				repeat = atoi(optarg);
+				if(repeat < 1)
+					usage(*argv);
+				break;
+			case 'f':
+				fps = atoi(optarg);
+				if((fps < 1) || (fps > 48000))
+					usage(*argv);
+				break;
+			case 'p':
+				per_sample = true;
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			default:
+				usage(*argv);
+		}
+	if(optind != argc-1)
+		usage(*argv);
+
+	if(!wav_open(&wav, argv[optind]))
+		return 1;
+	load(&wav, fps);
+	wav_close(&wav);
+
+	elapsed = 0.0;
+	for(i=0;i<repeat;i++)
+		elapsed += analyze(fps, per_sample);
+
+	if(!quiet)
+		for(i=0;i<nframes;i++) {
+			frd = frames[i];
+			printf("%d %.9g %.9g %.9g %.9g %.9g %.9g\n", i,
+			    frd->bass, frd->mid, frd->treb,
+			    frd->bass_att, frd->mid_att, frd->treb_att);
+		}
+	if(repeat > 1) {
+		samples = (double)repeat*nframes*FRD_AUDIO_NSAMPLES;
+		fprintf(stderr, "%.0f samples in %.3f s, %.0f samples/s "
+		    "(%.1f times real time)\n", samples, elapsed,
+		    samples/elapsed, (double)repeat*nframes/fps/elapsed);
+	}
+
+	for(i=0;i<nframes;i++)
+		free_frame_descriptor(frames[i]);
+	free(frames);
+	free(sound);
+	snd_ring_free(&ring);
+	return 0;
+}
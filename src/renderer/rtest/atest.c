@@ -0,0 +1,453 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression tests for the sound analyzer.
+ *
+ * The per-frame band levels computed by analyze_snd are checked, bit for
+ * bit, against a reference that feeds the whole sound, one sample at a
+ * time, to a single analyzer_put_sample stream and reads its accumulators
+ * at each frame boundary. The sound goes through the sound ring, from
+ * positions that wrap around at 2^32, and frames may be dropped.
+ *
+ * The beat tracker must find the tempo of a drum loop over noise, and
+ * none in silence. With a lead, it must output the same beats, as much
+ * earlier, and each of them once.
+ *
+ * The look-ahead must extrapolate linear ramps of the levels, no further
+ * than LOOKAHEAD_MAX and never below 0, and the sync measure of framestats
+ * must follow the delay of the frames.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "../framedescriptor.h"
+#include "../analyzer.h"
+#include "../spectrum.h"
+#include "../beat.h"
+#include "../lookahead.h"
+#include "../framestats.h"
+#include "../sndring.h"
+
+#define FRAMES		(10*FPS)
+#define BEAT_FRAMES	(20*FPS)
+
+static short sound[2*BEAT_FRAMES*FRD_AUDIO_NSAMPLES];
+
+/* deterministic mix of tones, noise, silence and bursts */
+static void make_sound(void)
+{
+	unsigned int seed = 1;
+	double t;
+	int i, frame, x;
+
+	for(i=0;i<FRAMES*FRD_AUDIO_NSAMPLES;i++) {
+		frame = i/FRD_AUDIO_NSAMPLES;
+		t = i/48000.0;
+		seed = seed*1103515245 + 12345;
+		x = 0;
+		if(frame % 40 < 30)
+			x = 9000*sin(2*M_PI*(60 + 10*frame)*t)
+			    + 4000*sin(2*M_PI*3000*t);
+		if(frame % 7 == 0)
+			x += (int)((seed >> 16) & 0x3fff) - 0x2000;
+		sound[2*i] = x;
+		sound[2*i+1] = x/2 - ((seed >> 8) & 0xff);
+	}
+}
+
+static struct snd_ring ring;
+
+/* records the sound of a frame into the ring, as the sampler does */
+static void record(struct frame_descriptor *frd, const short *s)
+{
+	snd_ring_put(&ring, s, FRD_AUDIO_NSAMPLES);
+	frd->snd_ring = &ring;
+	frd->snd_end = ring.written;
+}
+
+static int failed;
+
+static void check(const char *what, int frame, float got, float expected)
+{
+	if(got == expected)
+		return;
+	if(failed < 10)
+		printf("%s: frame %d: %s is %g, expected %g\n", what, frame,
+		    what, got, expected);
+	failed++;
+}
+
+/*
+ * At FPS, frames are analyzed as one stream, even when some of them are
+ * dropped (every drop-th frame). At other rates (overlapping sounds), each
+ * frame is analyzed from silence.
+ */
+static void test_levels(const char *name, bool streaming, int drop)
+{
+	struct frame_descriptor *frd;
+	struct snd_history history;
+	struct analyzer_state ref;
+	float bass_att = 0.0, mid_att = 0.0, treb_att = 0.0;
+	const short *s;
+	int frame, i;
+
+	frd = new_frame_descriptor();
+	if(frd == NULL) {
+		perror("new_frame_descriptor");
+		exit(1);
+	}
+	if(!snd_ring_init(&ring)) {
+		perror("snd_ring_init");
+		exit(1);
+	}
+	/* off the chunks, and wrapping around after a few frames */
+	ring.written = -5*FRD_AUDIO_NSAMPLES - 100;
+	analyzer_init_history(&history);
+	if(!streaming)
+		analyzer_set_frame_rate(&history, 2*FPS);
+	analyzer_init(&ref);
+
+	for(frame=0;frame<FRAMES;frame++) {
+		s = &sound[2*frame*FRD_AUDIO_NSAMPLES];
+		record(frd, s);
+
+		if(!streaming)
+			analyzer_init(&ref);
+		ref.bass_acc = ref.mid_acc = ref.treb_acc = 0;
+		for(i=0;i<FRD_AUDIO_NSAMPLES;i++)
+			analyzer_put_sample(&ref, s[2*i], s[2*i+1]);
+		if(drop && (frame % drop == drop-1))
+			continue;
+		analyze_snd(frd, &history);
+
+		check(name, frame, frd->bass, ref.bass_acc/1200000.0);
+		check(name, frame, frd->mid, ref.mid_acc/400000.0);
+		check(name, frame, frd->treb, ref.treb_acc/252000.0);
+		if(streaming) {
+			bass_att = 0.6*bass_att + (1.0-0.6)*frd->bass;
+			mid_att = 0.6*mid_att + (1.0-0.6)*frd->mid;
+			treb_att = 0.6*treb_att + (1.0-0.6)*frd->treb;
+			check(name, frame, frd->bass_att, bass_att);
+			check(name, frame, frd->mid_att, mid_att);
+			check(name, frame, frd->treb_att, treb_att);
+		}
+	}
+	free_frame_descriptor(frd);
+}
+
+/* the streaming state must not depend on how the sound is cut up */
+static void test_blocks(void)
+{
+	struct analyzer_state a, b;
+	int n = FRAMES*FRD_AUDIO_NSAMPLES;
+	int pos, c, i;
+
+	analyzer_init(&a);
+	analyzer_init(&b);
+	for(i=0;i<n;i++)
+		analyzer_put_sample(&a, sound[2*i], sound[2*i+1]);
+	for(pos=0;pos<n;pos+=c) {
+		c = 1 + (unsigned int)pos*7919 % 701;
+		if(c > n - pos)
+			c = n - pos;
+		analyzer_put_block(&b, &sound[2*pos], c);
+	}
+	check("blocks", 0, a.bass_acc, b.bass_acc);
+	check("blocks", 0, a.mid_acc, b.mid_acc);
+	check("blocks", 0, a.treb_acc, b.treb_acc);
+	check("blocks", 0, a.decimation, b.decimation);
+}
+
+/* a kick every beat and a hi-hat every half beat, over noise */
+static void make_loop(float bpm, int volume)
+{
+	unsigned int seed = 1;
+	int i, n, p, x;
+
+	p = 48000*60/bpm;
+	for(i=0;i<BEAT_FRAMES*FRD_AUDIO_NSAMPLES;i++) {
+		seed = seed*1103515245 + 12345;
+		x = (int)((seed >> 16) & 0x7ff) - 0x400;
+		n = i % p;
+		if(n < 4800)
+			x += 16000*exp(-n/1200.0)*sin(2*M_PI*55*n/48000.0);
+		n = i % (p/2);
+		if(n < 1000)
+			x += (int)((seed >> 8) & 0x1fff)*(1000 - n)/1000;
+		x = x*volume/16;
+		sound[2*i] = sound[2*i+1] = x;
+	}
+}
+
+/* tracks the beats of the loop, and returns the tempo found */
+static float track_loop(float lead, bool *beats)
+{
+	struct frame_descriptor *frd;
+	struct snd_history history;
+	struct spectrum_state spectrum;
+	struct beat_state beat;
+	int frame;
+	float found;
+
+	frd = new_frame_descriptor();
+	if(frd == NULL) {
+		perror("new_frame_descriptor");
+		exit(1);
+	}
+	analyzer_init_history(&history);
+	spectrum_init(&spectrum, SPECTRUM_BANDS_DEFAULT, FPS);
+	beat_init(&beat, FPS);
+	beat_set_lead(&beat, lead);
+	if(!snd_ring_init(&ring)) {
+		perror("snd_ring_init");
+		exit(1);
+	}
+	for(frame=0;frame<BEAT_FRAMES;frame++) {
+		record(frd, &sound[2*frame*FRD_AUDIO_NSAMPLES]);
+		frd->time = (float)frame/FPS;
+		analyze_snd(frd, &history);
+		spectrum_analyze(frd, &spectrum);
+		beat_track(frd, &beat);
+		beats[frame] = frd->beat > 0.0f;
+	}
+	found = frd->bpm;
+	free_frame_descriptor(frd);
+	return found;
+}
+
+/* counts the beats over the second half, once settled */
+static int count_beats(const bool *beats)
+{
+	int frame, n;
+
+	n = 0;
+	for(frame=BEAT_FRAMES/2;frame<BEAT_FRAMES;frame++)
+		n += beats[frame];
+	return n;
+}
+
+static void test_beat(const char *name, float bpm, int volume)
+{
+	bool beats[BEAT_FRAMES];
+	int n;
+	float found;
+
+	make_loop(bpm, volume);
+	found = track_loop(0.0f, beats);
+
+	if(volume == 0) {
+		check(name, BEAT_FRAMES, found, 0.0f);
+		return;
+	}
+	if(fabsf(found - bpm) > 0.02f*bpm)
+		check(name, BEAT_FRAMES, found, bpm);
+	n = lrintf(bpm*BEAT_FRAMES/(2.0f*FPS*60.0f));
+	if(abs(count_beats(beats) - n) > 1)
+		check(name, BEAT_FRAMES, count_beats(beats), n);
+}
+
+/*
+ * The lead only moves the outputs: each beat of the clock must come out
+ * lead seconds earlier, give or take a frame, and the beats must stay at
+ * least half a period apart, even when the onsets pull the clock back
+ * after a beat went out.
+ */
+static void test_lead(const char *name, float bpm, float lead)
+{
+	bool beats[BEAT_FRAMES], early[BEAT_FRAMES];
+	int shift = lrintf(lead*FPS);
+	float period = 60.0f*FPS/bpm;
+	int frame, i, n, last;
+
+	make_loop(bpm, 16);
+	track_loop(0.0f, beats);
+	track_loop(lead, early);
+
+	if(abs(count_beats(early) - count_beats(beats)) > 1)
+		check(name, BEAT_FRAMES, count_beats(early),
+		    count_beats(beats));
+	for(frame=BEAT_FRAMES/2;frame<BEAT_FRAMES;frame++) {
+		if(!beats[frame])
+			continue;
+		for(i=frame-shift-1;i<=frame-shift+1;i++)
+			if(early[i])
+				break;
+		if(i > frame-shift+1)
+			check(name, frame, 0.0f, 1.0f);
+	}
+	last = -BEAT_FRAMES;
+	for(frame=BEAT_FRAMES/2;frame<BEAT_FRAMES;frame++) {
+		if(!early[frame])
+			continue;
+		if(frame - last < period/2)
+			check(name, frame, frame - last, period);
+		last = frame;
+	}
+
+	/* kicks a third of a beat late from there on: the clock is pulled back */
+	make_loop(bpm, 16);
+	i = 3*BEAT_FRAMES/4*FRD_AUDIO_NSAMPLES;
+	n = 48000*20/bpm;
+	memmove(&sound[2*(i+n)], &sound[2*i],
+	    2*(BEAT_FRAMES*FRD_AUDIO_NSAMPLES - i - n)*sizeof(short));
+	track_loop(lead, early);
+	last = -BEAT_FRAMES;
+	for(frame=BEAT_FRAMES/2;frame<BEAT_FRAMES;frame++) {
+		if(!early[frame])
+			continue;
+		if(frame - last < period/2)
+			check(name, frame, frame - last, period);
+		last = frame;
+	}
+}
+
+/* all the levels rise (or fall) by step per frame, from start */
+static void set_levels(struct frame_descriptor *frd, float start,
+	float step, int frame)
+{
+	float x = start + step*frame;
+	int i;
+
+	if(x < 0.0f)
+		x = 0.0f;
+	frd->bass = frd->mid = frd->treb = x;
+	frd->bass_att = frd->mid_att = frd->treb_att = x;
+	for(i=0;i<BAND_COUNT;i++)
+		frd->band[i] = x;
+}
+
+static void check_levels(const char *name, int frame,
+	const struct frame_descriptor *frd, float expected)
+{
+	const float *levels[] = { &frd->bass, &frd->mid_att,
+	    &frd->band[BAND_COUNT-1] };
+	int i;
+
+	for(i=0;i<3;i++)
+		if(fabsf(*levels[i] - expected) > 1e-3f)
+			check(name, frame, *levels[i], expected);
+}
+
+/*
+ * Once the slopes have settled, a ramp is predicted on its line, ahead
+ * being capped at LOOKAHEAD_MAX. A falling ramp is cut at 0, and so are
+ * its predictions once it gets there.
+ */
+static void test_lookahead(void)
+{
+	struct frame_descriptor *frd;
+	struct lookahead_state st;
+	float x;
+	int frame;
+
+	frd = new_frame_descriptor();
+	if(frd == NULL) {
+		perror("new_frame_descriptor");
+		exit(1);
+	}
+
+	lookahead_init(&st, FPS);
+	for(frame=0;frame<2*FPS;frame++) {
+		set_levels(frd, 1.0f, 0.05f, frame);
+		lookahead_predict(frd, &st, 0.1f);
+		x = 1.0f + 0.05f*frame + 0.05f*FPS*0.1f;
+		if(frame >= FPS)
+			check_levels("lookahead", frame, frd, x);
+	}
+	set_levels(frd, 1.0f, 0.05f, frame);
+	lookahead_predict(frd, &st, 1.0f);
+	x = 1.0f + 0.05f*frame + 0.05f*FPS*LOOKAHEAD_MAX;
+	check_levels("lookahead max", frame, frd, x);
+
+	lookahead_init(&st, FPS);
+	for(frame=0;frame<2*FPS;frame++) {
+		set_levels(frd, 1.0f, -0.05f, frame);
+		lookahead_predict(frd, &st, 0.2f);
+		x = 1.0f - 0.05f*frame - 0.05f*FPS*0.2f;
+		if(frame >= FPS/2 && frame < 16)
+			check_levels("lookahead falling", frame, frd, x);
+		if(frame >= 16)
+			check_levels("lookahead falling", frame, frd, 0.0f);
+	}
+	free_frame_descriptor(frd);
+}
+
+/* frames shown delay us after their sound, from a clock about to wrap */
+static void feed_sync(unsigned int *now, unsigned int delay, int frames)
+{
+	struct frame_descriptor *frd;
+	int i, j;
+
+	frd = new_frame_descriptor();
+	if(frd == NULL) {
+		perror("new_frame_descriptor");
+		exit(1);
+	}
+	for(i=0;i<frames;i++) {
+		*now += 1000000/FPS;
+		frd->snd_time = *now - delay;
+		for(j=0;j<FRD_STATUS_COUNT;j++)
+			frd->status_time[j] = *now;
+		for(j=0;j<FRD_MARK_COUNT;j++)
+			frd->mark_time[j] = *now;
+		framestats_record(frd);
+	}
+	free_frame_descriptor(frd);
+}
+
+static void test_sync(void)
+{
+	unsigned int now = -10*1000000/FPS;
+
+	framestats_reset();
+	feed_sync(&now, 30000, 1);
+	check("sync", 0, framestats_get_sync(), 30000);
+	feed_sync(&now, 30000, FPS);
+	check("sync", FPS, framestats_get_sync(), 30000);
+	feed_sync(&now, 75000, 4*FPS);
+	if(abs((int)framestats_get_sync() - 75000) > 8)
+		check("sync", 5*FPS, framestats_get_sync(), 75000);
+}
+
+int main(int argc, char **argv)
+{
+	make_sound();
+	test_levels("streaming", true, 0);
+	test_levels("dropped frames", true, 3);
+	test_levels("overlapping", false, 0);
+	test_blocks();
+	test_beat("bpm 95", 95.0f, 16);
+	test_beat("bpm 128", 128.0f, 16);
+	test_beat("bpm 128 quiet", 128.0f, 1);
+	test_beat("bpm 150", 150.0f, 16);
+	test_beat("silence", 120.0f, 0);
+	test_lead("lead 0.2", 128.0f, 0.2f);
+	test_lookahead();
+	test_sync();
+	if(failed) {
+		printf("%d mismatches\n", failed);
+		return 1;
+	}
+	printf("analyzer: passed\n");
+	snd_ring_free(&ring);
+	return 0;
+}
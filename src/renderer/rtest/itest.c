@@ -0,0 +1,205 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression tests for the frame interpolation.
+ *
+ * Two key frames half a second apart are fed to interp_key, and frames are
+ * synthesized at a quarter, three quarters, one and a quarter and four
+ * periods after the newer key. All values are chosen so that the expected
+ * results are exact in single precision.
+ *
+ * The continuous fields and the vertices are interpolated (and
+ * extrapolated, up to INTERP_EXTRAPOLATE), the vertices only moving by the
+ * fraction of a period elapsed since the previous frame. The sound position
+ * stops at the newer key, and the other fields come from the nearest key.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "../framedescriptor.h"
+#include "../renderer.h"
+#include "../interp.h"
+
+#define MESH		2
+#define SQUARE		16
+
+int renderer_texsize = MESH*SQUARE;
+int renderer_hmeshlast = MESH;
+int renderer_vmeshlast = MESH;
+int renderer_squarew = SQUARE;
+int renderer_squareh = SQUARE;
+
+#define PERIOD		500000		/* between the keys, in us */
+
+static int failed;
+
+static void check(const char *what, float t, float got, float expected)
+{
+	if(got == expected)
+		return;
+	if(failed < 10)
+		printf("t = %g: %s is %g, expected %g\n", t, what, got,
+		    expected);
+	failed++;
+}
+
+static void check_int(const char *what, float t, unsigned int got,
+	unsigned int expected)
+{
+	if(got == expected)
+		return;
+	if(failed < 10)
+		printf("t = %g: %s is 0x%x, expected 0x%x\n", t, what, got,
+		    expected);
+	failed++;
+}
+
+/* a key with the fields at v, and the identity mesh moved by (dx, dy) */
+static void make_key(struct frame_descriptor *frd, float time, float v,
+	int dx, int dy)
+{
+	int x, y;
+
+	frd->time = time;
+	frd->bass = v;
+	frd->band[3] = 2*v;
+	frd->idmx[0] = -v;
+	frd->osc[1] = v/2;
+	frd->decay = 0.81f;
+	frd->wave_x = v/4;
+	frd->mv_a = v;
+	frd->dmx[7] = 3*v;
+	frd->image_zoom[1] = v;
+	for(y=0;y<=MESH;y++)
+		for(x=0;x<=MESH;x++) {
+			frd->vertices[y*TMU_MESH_MAXSIZE+x].x =
+			    ((x*SQUARE) << TMU_FIXEDPOINT_SHIFT) + dx;
+			frd->vertices[y*TMU_MESH_MAXSIZE+x].y =
+			    ((y*SQUARE) << TMU_FIXEDPOINT_SHIFT) + dy;
+		}
+}
+
+/* the non-interpolated fields, which tell the keys apart */
+static void mark_key(struct frame_descriptor *frd, int n)
+{
+	frd->wave_mode = n;
+	frd->tex_wrap = n;
+	frd->vecho_orientation = n;
+	frd->image_index[0] = n;
+	frd->disabled = n;
+}
+
+/*
+ * Synthesizes the frame at now and checks it: fields lerped between 0 and
+ * 4 at t, vertices moved by (64, -128) + (128, 256)*t relative to the
+ * identity mesh, times step, the sound at snd_end and snd_time, the other
+ * fields from the key marked key.
+ */
+static void test_frame(struct frame_descriptor *out, unsigned int now,
+	float t, float step, unsigned int snd_end, unsigned int snd_time,
+	int key)
+{
+	const struct tmu_vertex *v;
+	float f = 4.0f*t;
+	int x, y;
+
+	interp_frame(out, now);
+
+	check("time", t, out->time, 1.0f + 0.5f*t);
+	check("bass", t, out->bass, f);
+	check("band[3]", t, out->band[3], 2*f);
+	check("idmx[0]", t, out->idmx[0], -f);
+	check("osc[1]", t, out->osc[1], f/2);
+	check("decay", t, out->decay, powf(0.81f, step));
+	check("wave_x", t, out->wave_x, f/4);
+	check("mv_a", t, out->mv_a, f);
+	check("dmx[7]", t, out->dmx[7], 3*f);
+	check("image_zoom[1]", t, out->image_zoom[1], f);
+
+	check_int("snd_end", t, out->snd_end, snd_end);
+	check_int("snd_time", t, out->snd_time, snd_time);
+
+	check_int("wave_mode", t, out->wave_mode, key);
+	check_int("tex_wrap", t, out->tex_wrap, key);
+	check_int("vecho_orientation", t, out->vecho_orientation, key);
+	check_int("image_index[0]", t, out->image_index[0], key);
+	check_int("disabled", t, out->disabled, key);
+
+	for(y=0;y<=MESH;y++)
+		for(x=0;x<=MESH;x++) {
+			v = &out->vertices[y*TMU_MESH_MAXSIZE+x];
+			check("vertex x", t, v->x,
+			    ((x*SQUARE) << TMU_FIXEDPOINT_SHIFT)
+			    + (64 + 128*t)*step);
+			check("vertex y", t, v->y,
+			    ((y*SQUARE) << TMU_FIXEDPOINT_SHIFT)
+			    + (-128 + 256*t)*step);
+		}
+}
+
+int main(int argc, char **argv)
+{
+	struct frame_descriptor *a, *b, *out;
+	unsigned int now;
+
+	a = new_frame_descriptor();
+	b = new_frame_descriptor();
+	out = new_frame_descriptor();
+	if(a == NULL || b == NULL || out == NULL || !interp_init()) {
+		perror("new_frame_descriptor");
+		exit(1);
+	}
+
+	/* the sound position wraps around between the keys */
+	make_key(a, 1.0f, 0.0f, 64, -128);
+	mark_key(a, 0);
+	a->snd_end = 0xfffffff0;
+	a->snd_time = 1000;
+	make_key(b, 1.5f, 4.0f, 192, 128);
+	mark_key(b, 1);
+	b->snd_end = 0x10;
+	b->snd_time = 1400;
+
+	now = 1000000;
+	interp_key(a, now-PERIOD);
+	interp_key(b, now);
+
+	/* a period and a quarter after the first key: full step */
+	test_frame(out, now+PERIOD/4, 0.25f, 1.0f, 0xfffffff8, 1100, 0);
+	/* half a period after the previous frame */
+	test_frame(out, now+3*PERIOD/4, 0.75f, 0.5f, 0x8, 1300, 1);
+	/* past the newer key, the sound stops there */
+	test_frame(out, now+5*PERIOD/4, 1.25f, 0.5f, 0x10, 1400, 1);
+	/* long after, extrapolation is capped and the step is full */
+	test_frame(out, now+4*PERIOD, 1.0f + INTERP_EXTRAPOLATE, 1.0f,
+	    0x10, 1400, 1);
+
+	interp_free();
+	free_frame_descriptor(a);
+	free_frame_descriptor(b);
+	free_frame_descriptor(out);
+	if(failed) {
+		printf("%d mismatches\n", failed);
+		return 1;
+	}
+	printf("interpolation: passed\n");
+	return 0;
+}
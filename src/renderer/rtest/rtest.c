@@ -0,0 +1,590 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Headless renderer pipeline for the host.
+ *
+ * The three stages of the renderer run in their own threads, as the
+ * sampler, eval and raster tasks do on the board, and pass frame
+ * descriptors to each other through lock-free single-producer,
+ * single-consumer rings instead of RTEMS message queues:
+ *
+ *   sampler -> eval -> raster -> (back to the) sampler
+ *
+ * The sampler records its sound into the sound ring from a WAV file (or
+ * silence), standing in for the sound driver, and runs the same analysis
+ * as the board. Time comes from a synthetic frame clock
+ * (frame/rate) so that runs are reproducible; with -r the sampler also
+ * paces itself to the real frame rate. The eval stage runs the patch
+ * with the software PFPU, and the raster stage draws into memory with the
+ * software TMU. Video input, images, the OSD and DMX are left out.
+ *
+ * The frames are timestamped and summarized as on the board (see
+ * framestats.h).
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../../compiler/compiler.h"
+#include "../framedescriptor.h"
+#include "../renderer.h"
+#include "../framestats.h"
+#include "../analyzer.h"
+#include "../spectrum.h"
+#include "../beat.h"
+#include "../lookahead.h"
+#include "../sndring.h"
+#include "../evalvars.h"
+#include "../rasterops.h"
+#include "../softpfpu.h"
+#include "../vpfpu.h"
+#include "../tilepool.h"
+#include "../softtmu.h"
+
+#include "wavfile.h"
+
+int renderer_texsize = 512;
+int renderer_hmeshlast = 32;
+int renderer_vmeshlast = 32;
+int renderer_squarew = 512/32;
+int renderer_squareh = 512/32;
+
+#define SCREEN_HRES	640
+#define SCREEN_VRES	480
+
+/****************************************************************/
+/* QUEUES                                                       */
+/****************************************************************/
+
+/*
+ * At most FRD_COUNT_MAX frame descriptors and the NULL terminating the
+ * stream are ever in a ring, so a push never finds it full.
+ */
+#define RING_SIZE	(16)
+
+struct frd_ring {
+	struct frame_descriptor *slots[RING_SIZE];
+	unsigned int head __attribute__((aligned(64)));	/* producer */
+	unsigned int tail __attribute__((aligned(64)));	/* consumer */
+};
+
+static void ring_init(struct frd_ring *r)
+{
+	r->head = 0;
+	r->tail = 0;
+}
+
+static void ring_push(struct frd_ring *r, struct frame_descriptor *frd)
+{
+	unsigned int head = r->head;
+
+	r->slots[head % RING_SIZE] = frd;
+	/* publish the slot with the new head */
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static bool ring_empty(struct frd_ring *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail;
+}
+
+static struct frame_descriptor *ring_pop(struct frd_ring *r)
+{
+	unsigned int tail = r->tail;
+	struct frame_descriptor *frd;
+
+	while(__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+		sched_yield();
+	frd = r->slots[tail % RING_SIZE];
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return frd;
+}
+
+static struct frd_ring eval_q, raster_q, returned_q;
+
+/****************************************************************/
+/* SAMPLER                                                      */
+/****************************************************************/
+
+struct sampler_param {
+	struct wav *wav;
+	int nframes;
+	bool realtime;
+	bool lookahead;
+	int fps;
+	int depth, depth_max;
+};
+
+static struct frame_descriptor *frame_descriptors[FRD_COUNT_MAX];
+static int n_frd;
+/* also read by the raster thread, for the waves */
+static struct snd_ring snd_ring;
+
+static struct frame_descriptor *add_frd(void)
+{
+	struct frame_descriptor *frd;
+
+	frd = new_frame_descriptor();
+	if(frd == NULL) {
+		perror("new_frame_descriptor");
+		exit(1);
+	}
+	frame_descriptors[n_frd++] = frd;
+	return frd;
+}
+
+static void remove_frd(struct frame_descriptor *frd)
+{
+	int i;
+
+	for(i=0;frame_descriptors[i]!=frd;i++);
+	frame_descriptors[i] = frame_descriptors[--n_frd];
+	free_frame_descriptor(frd);
+}
+
+/*
+ * Takes a free frame descriptor, adjusting the depth of the pipeline as
+ * the sampler task does: new descriptors are allocated when the depth
+ * grows, and returned ones are freed when it shrinks.
+ */
+static struct frame_descriptor *get_frd(struct frd_depth *depth)
+{
+	struct frame_descriptor *frd;
+	int target;
+
+	target = frd_depth_update(depth, false);
+	while(1) {
+		if(n_frd < target)
+			return add_frd();
+		/* all descriptors are downstream */
+		if(ring_empty(&returned_q))
+			frd_depth_stall(depth);
+		frd = ring_pop(&returned_q);
+		if(n_frd <= target)
+			return frd;
+		remove_frd(frd);
+	}
+}
+
+static void *sampler_thread(void *arg)
+{
+	struct sampler_param *param = arg;
+	struct frame_descriptor *frd;
+	struct snd_history history;
+	struct spectrum_state spectrum;
+	struct beat_state beat;
+	struct lookahead_state prediction;
+	struct frd_depth depth;
+	float ahead;
+	struct timespec start, deadline;
+	long long ns;
+	int frame;
+
+	if(!snd_ring_init(&snd_ring)) {
+		perror("snd_ring_init");
+		exit(1);
+	}
+	analyzer_init_history(&history);
+	spectrum_init(&spectrum, SPECTRUM_BANDS_DEFAULT, param->fps);
+	beat_init(&beat, param->fps);
+	lookahead_init(&prediction, param->fps);
+	if(param->fps != FPS)
+		analyzer_set_frame_rate(&history, param->fps);
+	frd_depth_init(&depth, param->depth, param->depth_max, param->depth,
+	    param->fps);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(frame=0;frame<param->nframes;frame++) {
+		frd = get_frd(&depth);
+		if(param->realtime) {
+			ns = start.tv_nsec + (long long)frame*1000000000/param->fps;
+			deadline.tv_sec = start.tv_sec + ns/1000000000;
+			deadline.tv_nsec = ns % 1000000000;
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			    &deadline, NULL) == EINTR);
+		}
+		frd->frame = frame;
+		frd_set_status(frd, FRD_STATUS_SAMPLING);
+		wav_feed(param->wav, &snd_ring, 48000/param->fps);
+		frd->snd_ring = &snd_ring;
+		frd->snd_end = snd_ring.written;
+		frd->snd_time = framestats_now() - FRD_AUDIO_NSAMPLES/2*1000/48;
+		ahead = param->lookahead ? framestats_get_sync()/1000000.0 : 0.0;
+		analyze_snd(frd, &history);
+		spectrum_analyze(frd, &spectrum);
+		frd->time = (float)frame/param->fps;
+		beat_set_lead(&beat, ahead);
+		beat_track(frd, &beat);
+		if(param->lookahead)
+			lookahead_predict(frd, &prediction, ahead);
+		memset(frd->idmx, 0, sizeof(frd->idmx));
+		memset(frd->osc, 0, sizeof(frd->osc));
+		frd_set_status(frd, FRD_STATUS_SAMPLED);
+		ring_push(&eval_q, frd);
+	}
+	ring_push(&eval_q, NULL);
+
+	/* wait for all descriptors to come back */
+	while(n_frd > 0)
+		remove_frd(ring_pop(&returned_q));
+	return NULL;
+}
+
+/****************************************************************/
+/* EVAL                                                         */
+/****************************************************************/
+
+struct eval_param {
+	struct patch *patch;
+	struct tile_pool *pool;
+};
+
+static void *eval_thread(void *arg)
+{
+	struct eval_param *param = arg;
+	struct patch *p = param->patch;
+	struct frame_descriptor *frd;
+	int i;
+
+	while((frd = ring_pop(&eval_q)) != NULL) {
+		frd_mark(frd, FRD_MARK_EVAL_START);
+		for(i=0;i<IMAGE_COUNT;i++)
+			frd->images[i] = NULL;
+		reinit_all_pfv(p);
+		set_pfv_from_frd(p, frd);
+		vpfpu_execute_frame(p->perframe_vprog, p->perframe_regs);
+		set_frd_from_pfv(p, frd);
+		transfer_pvv_regs(p);
+		tile_pool_run(param->pool, p->pervertex_vprog,
+		    p->pervertex_regs, frd->vertices,
+		    renderer_hmeshlast, renderer_vmeshlast);
+		frd_set_status(frd, FRD_STATUS_EVALUATED);
+		ring_push(&raster_q, frd);
+	}
+	ring_push(&raster_q, NULL);
+	return NULL;
+}
+
+/****************************************************************/
+/* RASTER                                                       */
+/****************************************************************/
+
+struct raster_param {
+	unsigned short *tex_frontbuffer;
+	unsigned short *tex_backbuffer;
+	unsigned short *screen;
+	struct tmu_vertex *scale_vertices;
+};
+
+static void *raster_thread(void *arg)
+{
+	struct raster_param *param = arg;
+	struct frame_descriptor *frd;
+	struct wave_params params;
+	struct wave_vertex vertices[256];
+	int nvertices;
+	float brightness_error;
+	int ibrightness;
+	int vecho_alpha;
+	unsigned short *p;
+
+	brightness_error = 0.0;
+	while((frd = ring_pop(&raster_q)) != NULL) {
+		frd_mark(frd, FRD_MARK_RASTER_START);
+
+		ibrightness = raster_brightness(&brightness_error, frd->decay);
+		raster_warp(-1, param->tex_frontbuffer, param->tex_backbuffer,
+		    frd->vertices, frd->tex_wrap, ibrightness);
+		frd_mark(frd, FRD_MARK_WARPED);
+		compute_wave_vertices(frd, &params, vertices, &nvertices);
+		software_draw(param->tex_backbuffer, frd, &params, vertices,
+		    nvertices);
+		frd_mark(frd, FRD_MARK_DRAWN);
+
+		init_scale_vertices(param->scale_vertices);
+		raster_scale(-1, param->scale_vertices, param->tex_backbuffer,
+		    param->screen, renderer_texsize, renderer_texsize,
+		    SCREEN_HRES, SCREEN_VRES, TMU_ALPHA_MAX, false, true);
+		vecho_alpha = 64.0*frd->vecho_alpha;
+		vecho_alpha--;
+		if(vecho_alpha > TMU_ALPHA_MAX)
+			vecho_alpha = TMU_ALPHA_MAX;
+		if(vecho_alpha > 0) {
+			init_vecho_vertices(param->scale_vertices, frd);
+			raster_scale(-1, param->scale_vertices,
+			    param->tex_backbuffer, param->screen,
+			    renderer_texsize, renderer_texsize,
+			    SCREEN_HRES, SCREEN_VRES, vecho_alpha, false, false);
+		}
+
+		frd_mark(frd, FRD_MARK_SWAPPED);
+
+		p = param->tex_frontbuffer;
+		param->tex_frontbuffer = param->tex_backbuffer;
+		param->tex_backbuffer = p;
+
+		frd_set_status(frd, FRD_STATUS_USED);
+		framestats_record(frd);
+		ring_push(&returned_q, frd);
+	}
+	return NULL;
+}
+
+/****************************************************************/
+/* MAIN                                                         */
+/****************************************************************/
+
+static void compile_report(void *arg, const char *msg)
+{
+	fprintf(stderr, "%s\n", msg);
+}
+
+static struct patch *load_patch(const char *filename)
+{
+	struct patch *p;
+	FILE *f;
+	char *code;
+	long size;
+
+	f = fopen(filename, "r");
+	if(f == NULL) {
+		perror(filename);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	code = malloc(size+1);
+	if(code == NULL) {
+		fclose(f);
+		return NULL;
+	}
+	code[fread(code, 1, size, f)] = 0;
+	fclose(f);
+
+	/* the images are not loaded, see pixbufstub.h */
+	p = patch_compile(NULL, code, compile_report, NULL);
+	free(code);
+	return p;
+}
+
+static bool write_ppm(const char *filename, const unsigned short *screen)
+{
+	FILE *f;
+	unsigned short c;
+	int i;
+
+	f = fopen(filename, "wb");
+	if(f == NULL) {
+		perror(filename);
+		return false;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", SCREEN_HRES, SCREEN_VRES);
+	for(i=0;i<SCREEN_HRES*SCREEN_VRES;i++) {
+		c = screen[i];
+		putc((c >> 8) & 0xf8, f);
+		putc((c >> 3) & 0xfc, f);
+		putc((c << 3) & 0xf8, f);
+	}
+	fclose(f);
+	return true;
+}
+
+static void *alloc(size_t size)
+{
+	void *p;
+
+	if(posix_memalign(&p, 32, size) != 0) {
+		perror("posix_memalign");
+		exit(1);
+	}
+	memset(p, 0, size);
+	return p;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+"usage: %s [-d depth[,max]] [-f fps] [-i] [-j threads[,rows]] [-l]\n"
+"       %*s [-n frames] [-o file.ppm] [-r] [-w file.wav] patch.fnp\n\n"
+"  -d depth[,max]\n"
+"            keep this many frames in flight, growing up to max when the\n"
+"            sampler has to wait (default: %d, no growth)\n"
+"  -f fps    frame rate (default: %d, frames of sound back to back)\n"
+"  -i        interpret the patch instead of compiling it to native code\n"
+"  -j threads[,rows]\n"
+"            evaluate the mesh with this many threads, handing out tiles of\n"
+"            the given number of rows (default: all CPUs, 4 rows)\n"
+"  -l        look-ahead: predict the levels and the beat at the time the\n"
+"            frame is shown (see lookahead.h)\n"
+"  -n frames number of frames to render (default: 240)\n"
+"  -o file   write the last frame to a PPM file\n"
+"  -r        pace the sampler to the frame rate instead of running as fast\n"
+"            as possible\n"
+"  -w file   analyze this 16-bit PCM WAV file (default: silence)\n"
+    , name, (int) strlen(name), "", FRD_COUNT_DEFAULT, FPS);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct sampler_param sampler_param;
+	struct eval_param eval_param;
+	struct raster_param raster_param;
+	pthread_t sampler, eval, raster;
+	struct wav wav;
+	const char *wav_name = NULL;
+	const char *ppm_name = NULL;
+	bool native = true;
+	int threads = 0, tile_rows = 4;
+	int nframes = 240;
+	bool realtime = false;
+	bool lookahead = false;
+	int depth = FRD_COUNT_DEFAULT, depth_max = 0;
+	int fps = FPS;
+	struct patch *p;
+	unsigned int start;
+	double elapsed;
+	int c;
+
+	while((c = getopt(argc, argv, "d:f:ij:ln:o:rw:")) != EOF)
+		switch(c) {
+			case 'd':
+				if((sscanf(optarg, "%d,%d", &depth, &depth_max) < 1)
+				    || (depth < FRD_COUNT_MIN)
+				    || (depth > FRD_COUNT_MAX)
+				    || (depth_max > FRD_COUNT_MAX))
+					usage(*argv);
+				break;
+			case 'f':
+				fps = atoi(optarg);
+				if((fps < 1) || (fps > 48000))
+					usage(*argv);
+				break;
+			case 'i':
+				native = false;
+				break;
+			case 'j':
+				if((sscanf(optarg, "%d,%d", &threads, &tile_rows) < 1)
+				    || (threads < 1) || (tile_rows < 1))
+					usage(*argv);
+				break;
+			case 'l':
+				lookahead = true;
+				break;
+			case 'n':
+				nframes = atoi(optarg);
+				if(nframes < 1)
+					usage(*argv);
+				break;
+			case 'o':
+				ppm_name = optarg;
+				break;
+			case 'r':
+				realtime = true;
+				break;
+			case 'w':
+				wav_name = optarg;
+				break;
+			default:
+				usage(*argv);
+		}
+	if(optind != argc-1)
+		usage(*argv);
+
+	p = load_patch(argv[optind]);
+	if(p == NULL)
+		return 1;
+	p->perframe_vprog = vpfpu_new(p->perframe_prog,
+	    p->perframe_prog_length, native);
+	p->pervertex_vprog = vpfpu_new(p->pervertex_prog,
+	    p->pervertex_prog_length, native);
+	if((p->perframe_vprog == NULL) || (p->pervertex_vprog == NULL)) {
+		fprintf(stderr, "unable to lower the patch\n");
+		return 1;
+	}
+
+	sampler_param.wav = NULL;
+	if(wav_name != NULL) {
+		if(!wav_open(&wav, wav_name))
+			return 1;
+		sampler_param.wav = &wav;
+	}
+	sampler_param.nframes = nframes;
+	sampler_param.realtime = realtime;
+	sampler_param.lookahead = lookahead;
+	sampler_param.fps = fps;
+	sampler_param.depth = depth;
+	sampler_param.depth_max = depth_max > depth ? depth_max : depth;
+
+	eval_param.patch = p;
+	eval_param.pool = tile_pool_new(threads, tile_rows);
+	if(eval_param.pool == NULL) {
+		fprintf(stderr, "unable to create evaluation threads\n");
+		return 1;
+	}
+
+	raster_param.tex_frontbuffer =
+	    alloc(2*renderer_texsize*renderer_texsize);
+	raster_param.tex_backbuffer =
+	    alloc(2*renderer_texsize*renderer_texsize);
+	raster_param.screen = alloc(2*SCREEN_HRES*SCREEN_VRES);
+	raster_param.scale_vertices =
+	    alloc(sizeof(struct tmu_vertex)*TMU_MESH_MAXSIZE*TMU_MESH_MAXSIZE);
+
+	ring_init(&eval_q);
+	ring_init(&raster_q);
+	ring_init(&returned_q);
+
+	framestats_set_frame_rate(fps);
+	start = framestats_now();
+	if((pthread_create(&raster, NULL, raster_thread, &raster_param) != 0)
+	    || (pthread_create(&eval, NULL, eval_thread, &eval_param) != 0)
+	    || (pthread_create(&sampler, NULL, sampler_thread,
+	    &sampler_param) != 0)) {
+		fprintf(stderr, "unable to create the pipeline threads\n");
+		return 1;
+	}
+	pthread_join(sampler, NULL);
+	pthread_join(eval, NULL);
+	pthread_join(raster, NULL);
+	elapsed = (framestats_now() - start)/1e6;
+
+	framestats_print();
+	printf("%.3f s, %.1f fps\n", elapsed, nframes/elapsed);
+	if((ppm_name != NULL) && !write_ppm(ppm_name, raster_param.screen))
+		return 1;
+
+	free(raster_param.scale_vertices);
+	free(raster_param.screen);
+	free(raster_param.tex_backbuffer);
+	free(raster_param.tex_frontbuffer);
+	tile_pool_free(eval_param.pool);
+	if(sampler_param.wav != NULL)
+		wav_close(&wav);
+	vpfpu_free(p->perframe_vprog);
+	vpfpu_free(p->pervertex_vprog);
+	patch_free(p);
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * One transfer of the software TMU, on a small texture and destination.
+ *
+ * The texture has TEX_RES x TEX_RES texels. The texel at (x, y) has red 4x,
+ * green 8y and blue x+y, so it reads 0x2000*x + 0x100*y + x+y in hex. The
+ * vertices of the mesh are read from stdin, one "x y" pair per vertex, row
+ * by row. The destination has DST_RES x DST_RES pixels, which are printed
+ * in hex after the transfer, one row per line.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../softtmu.h"
+
+#define TEX_RES	4
+#define DST_RES	4
+
+static struct tmu_vertex vertices[TMU_MESH_MAXSIZE*TMU_MESH_MAXSIZE];
+static unsigned short texture[TEX_RES*TEX_RES];
+static unsigned short dst[DST_RES*DST_RES];
+
+static void make_texture(void)
+{
+	int x, y;
+
+	for(y=0;y<TEX_RES;y++)
+		for(x=0;x<TEX_RES;x++)
+			texture[y*TEX_RES+x] =
+			    (4*x << 11) | (8*y << 5) | (x + y);
+}
+
+static bool read_vertices(unsigned int hmeshlast, unsigned int vmeshlast)
+{
+	struct tmu_vertex *v;
+	unsigned int i, j;
+
+	for(j=0;j<=vmeshlast;j++)
+		for(i=0;i<=hmeshlast;i++) {
+			v = &vertices[j*TMU_MESH_MAXSIZE + i];
+			if(scanf("%d %d", &v->x, &v->y) != 2) {
+				fprintf(stderr, "vertex (%u, %u) missing\n",
+				    i, j);
+				return false;
+			}
+		}
+	return true;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+"usage: %s [-a alpha] [-A] [-b brightness] [-d color] [-k color]\n"
+"       %*s [-m hmask,vmask] [-M hmeshlast,vmeshlast] [-o hoffset,voffset]\n"
+"       %*s [-s squarew,squareh] <vertices\n\n"
+"  -a alpha  alpha of the transfer (default: %d)\n"
+"  -A        add to the destination (TMU_FLAG_ADDITIVE)\n"
+"  -b brightness\n"
+"            brightness of the transfer (default: %d)\n"
+"  -d color  fill the destination with this color first (default: 0)\n"
+"  -k color  do not draw the pixels whose texel has this color\n"
+"            (TMU_FLAG_CHROMAKEY)\n"
+"  -m hmask,vmask\n"
+"            texture coordinate masks, in hex (default: full)\n"
+"  -M hmeshlast,vmeshlast\n"
+"            size of the mesh, in squares (default: 1,1)\n"
+"  -o hoffset,voffset\n"
+"            position of the mesh in the destination (default: 0,0)\n"
+"  -s squarew,squareh\n"
+"            size of a square in the destination (default: the\n"
+"            destination divided by the mesh size)\n"
+    , name, (int) strlen(name), "", (int) strlen(name), "",
+    TMU_ALPHA_MAX, TMU_BRIGHTNESS_MAX);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct tmu_td td = {
+		.flags = 0,
+		.hmeshlast = 1,
+		.vmeshlast = 1,
+		.brightness = TMU_BRIGHTNESS_MAX,
+		.chromakey = 0,
+		.vertices = vertices,
+		.texfbuf = texture,
+		.texhres = TEX_RES,
+		.texvres = TEX_RES,
+		.texhmask = TMU_MASK_FULL,
+		.texvmask = TMU_MASK_FULL,
+		.dstfbuf = dst,
+		.dsthres = DST_RES,
+		.dstvres = DST_RES,
+		.dsthoffset = 0,
+		.dstvoffset = 0,
+		.dstsquarew = 0,
+		.dstsquareh = 0,
+		.alpha = TMU_ALPHA_MAX,
+	};
+	unsigned int fill = 0;
+	int c, x, y;
+
+	while((c = getopt(argc, argv, "a:Ab:d:k:m:M:o:s:")) != EOF)
+		switch(c) {
+			case 'a':
+				td.alpha = strtoul(optarg, NULL, 0);
+				if(td.alpha > TMU_ALPHA_MAX)
+					usage(*argv);
+				break;
+			case 'A':
+				td.flags |= TMU_FLAG_ADDITIVE;
+				break;
+			case 'b':
+				td.brightness = strtoul(optarg, NULL, 0);
+				if(td.brightness > TMU_BRIGHTNESS_MAX)
+					usage(*argv);
+				break;
+			case 'd':
+				fill = strtoul(optarg, NULL, 0);
+				break;
+			case 'k':
+				td.flags |= TMU_FLAG_CHROMAKEY;
+				td.chromakey = strtoul(optarg, NULL, 0);
+				break;
+			case 'm':
+				if(sscanf(optarg, "%x,%x", &td.texhmask,
+				    &td.texvmask) != 2)
+					usage(*argv);
+				break;
+			case 'M':
+				if(sscanf(optarg, "%u,%u", &td.hmeshlast,
+				    &td.vmeshlast) != 2)
+					usage(*argv);
+				if(!td.hmeshlast ||
+				    td.hmeshlast >= TMU_MESH_MAXSIZE ||
+				    !td.vmeshlast ||
+				    td.vmeshlast >= TMU_MESH_MAXSIZE)
+					usage(*argv);
+				break;
+			case 'o':
+				if(sscanf(optarg, "%d,%d", &td.dsthoffset,
+				    &td.dstvoffset) != 2)
+					usage(*argv);
+				break;
+			case 's':
+				if(sscanf(optarg, "%u,%u", &td.dstsquarew,
+				    &td.dstsquareh) != 2)
+					usage(*argv);
+				break;
+			default:
+				usage(*argv);
+		}
+	if(optind != argc)
+		usage(*argv);
+	if(!td.dstsquarew)
+		td.dstsquarew = DST_RES/td.hmeshlast;
+	if(!td.dstsquareh)
+		td.dstsquareh = DST_RES/td.vmeshlast;
+
+	make_texture();
+	if(!read_vertices(td.hmeshlast, td.vmeshlast))
+		return 1;
+	for(x=0;x<DST_RES*DST_RES;x++)
+		dst[x] = fill;
+
+	softtmu_execute(&td);
+
+	for(y=0;y<DST_RES;y++)
+		for(x=0;x<DST_RES;x++)
+			printf("%04x%c", dst[y*DST_RES+x],
+			    x == DST_RES-1 ? '\n' : ' ');
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../framedescriptor.h"
+#include "../sndring.h"
+#include "wavfile.h"
+
+static unsigned int le(const unsigned char *p, int n)
+{
+	unsigned int v = 0;
+
+	while(n--)
+		v = (v << 8) | p[n];
+	return v;
+}
+
+bool wav_open(struct wav *w, const char *filename)
+{
+	unsigned char hdr[16];
+	unsigned int size;
+	bool fmt = false;
+
+	w->f = fopen(filename, "rb");
+	if(w->f == NULL) {
+		perror(filename);
+		return false;
+	}
+	if((fread(hdr, 1, 12, w->f) != 12)
+	    || memcmp(hdr, "RIFF", 4) || memcmp(hdr+8, "WAVE", 4))
+		goto bad;
+	while(fread(hdr, 1, 8, w->f) == 8) {
+		size = le(hdr+4, 4);
+		if(!memcmp(hdr, "fmt ", 4)) {
+			if((size < 16) || (fread(hdr, 1, 16, w->f) != 16))
+				goto bad;
+			if((le(hdr, 2) != 1) || (le(hdr+14, 2) != 16)) {
+				fprintf(stderr, "%s: only 16-bit PCM is supported\n",
+				    filename);
+				goto fail;
+			}
+			w->channels = le(hdr+2, 2);
+			if((w->channels != 1) && (w->channels != 2)) {
+				fprintf(stderr, "%s: only mono and stereo are supported\n",
+				    filename);
+				goto fail;
+			}
+			if(le(hdr+4, 4) != 48000)
+				fprintf(stderr, "%s: sample rate is %u Hz, analyzing as 48000 Hz\n",
+				    filename, le(hdr+4, 4));
+			fmt = true;
+			size -= 16;
+		} else if(!memcmp(hdr, "data", 4)) {
+			if(!fmt)
+				goto bad;
+			w->remaining = size;
+			return true;
+		}
+		/* chunks are padded to an even size */
+		if(fseek(w->f, size + (size & 1), SEEK_CUR) != 0)
+			goto bad;
+	}
+bad:
+	fprintf(stderr, "%s: not a WAV file\n", filename);
+fail:
+	fclose(w->f);
+	return false;
+}
+
+static void read_samples(struct wav *w, unsigned int *dst, int n)
+{
+	short *samples = (short *)dst;
+	unsigned char in[4];
+	int frame_bytes;
+	int i;
+
+	frame_bytes = w == NULL ? 0 : 2*w->channels;
+	for(i=0;i<n;i++) {
+		if((frame_bytes == 0) || (w->remaining < frame_bytes)
+		    || (fread(in, 1, frame_bytes, w->f) != frame_bytes)) {
+			samples[2*i] = 0;
+			samples[2*i+1] = 0;
+			continue;
+		}
+		w->remaining -= frame_bytes;
+		samples[2*i] = le(in, 2);
+		samples[2*i+1] = w->channels == 2 ? le(in+2, 2) : le(in, 2);
+	}
+}
+
+void wav_read(struct wav *w, struct snd_buffer *buf)
+{
+	read_samples(w, buf->samples, buf->nsamples);
+}
+
+void wav_feed(struct wav *w, struct snd_ring *r, int n)
+{
+	unsigned int pos;
+	int offset, c;
+
+	while(n > 0) {
+		pos = r->written;
+		offset = pos % SND_RING_CHUNK_NSAMPLES;
+		c = SND_RING_CHUNK_NSAMPLES - offset;
+		if(c > n)
+			c = n;
+		read_samples(w, &snd_ring_chunk(r, pos)->samples[offset], c);
+		snd_ring_advance(r, c);
+		n -= c;
+	}
+}
+
+void wav_close(struct wav *w)
+{
+	fclose(w->f);
+}
+
+static void put_le(FILE *f, unsigned int v, int n)
+{
+	while(n--) {
+		fputc(v & 0xff, f);
+		v >>= 8;
+	}
+}
+
+void wav_write_header(FILE *f, unsigned int nsamples)
+{
+	fwrite("RIFF", 1, 4, f);
+	put_le(f, 36 + 4*nsamples, 4);
+	fwrite("WAVEfmt ", 1, 8, f);
+	put_le(f, 16, 4);
+	put_le(f, 1, 2);		/* PCM */
+	put_le(f, 2, 2);		/* channels */
+	put_le(f, 48000, 4);
+	put_le(f, 4*48000, 4);		/* bytes per second */
+	put_le(f, 4, 2);		/* bytes per sample */
+	put_le(f, 16, 2);		/* bits */
+	fwrite("data", 1, 4, f);
+	put_le(f, 4*nsamples, 4);
+}
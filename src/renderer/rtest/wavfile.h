@@ -0,0 +1,45 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WAVFILE_H
+#define __WAVFILE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "../framedescriptor.h"
+#include "../sndring.h"
+
+/* 16-bit PCM WAV files, mono or stereo, for the host tools */
+
+struct wav {
+	FILE *f;
+	int channels;
+	long remaining;		/* bytes of sample data left */
+};
+
+bool wav_open(struct wav *w, const char *filename);
+/* fills the buffer with stereo samples, and silence after the end */
+void wav_read(struct wav *w, struct snd_buffer *buf);
+/* stands in for the sound driver, recording n samples into the ring */
+void wav_feed(struct wav *w, struct snd_ring *r, int n);
+void wav_close(struct wav *w);
+
+/* header of a 48kHz stereo file of nsamples samples */
+void wav_write_header(FILE *f, unsigned int nsamples);
+
+#endif /* __WAVFILE_H */
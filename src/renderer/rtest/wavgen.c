@@ -0,0 +1,175 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Test signals for the sound analysis, as 48kHz stereo WAV files.
+ *
+ * Signals are made with integer arithmetic only, so that the files, and
+ * the analysis of them, are the same on every host.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wavfile.h"
+
+static unsigned int seed;
+
+static int noise(void)
+{
+	seed = seed*1103515245 + 12345;
+	return (int)((seed >> 16) & 0xffff) - 0x8000;
+}
+
+/* triangle wave from a 32-bit phase */
+static int triangle(unsigned int phase)
+{
+	int x = phase >> 15;		/* 0 .. 2^17-1 */
+
+	return x < 65536 ? x - 32768 : 98303 - x;
+}
+
+static short clip(int x)
+{
+	if(x > 32767)
+		return 32767;
+	if(x < -32768)
+		return -32768;
+	return x;
+}
+
+/* phase increment of a frequency */
+#define FREQ(f)		((unsigned int)((f)*89478.485f))	/* 2^32/48000 */
+
+static void silence(int i, int *l, int *r)
+{
+	*l = *r = 0;
+}
+
+static void white(int i, int *l, int *r)
+{
+	*l = noise()/2;
+	*r = noise()/2;
+}
+
+/* triangle sweeping linearly from 20Hz to 16kHz */
+static void chirp(int i, int *l, int *r)
+{
+	static unsigned int phase, inc;
+
+	if(i == 0) {
+		phase = 0;
+		inc = FREQ(20);
+	}
+	phase += inc;
+	inc += (FREQ(16000) - FREQ(20))/(10*48000);
+	*l = *r = triangle(phase)/2;
+}
+
+/* 110Hz square on the left, 2kHz square on the right */
+static void square(int i, int *l, int *r)
+{
+	*l = (i % 436) < 218 ? 12000 : -12000;
+	*r = (i % 24) < 12 ? 4000 : -4000;
+}
+
+/* a burst of noise every half second, decaying over 50ms */
+static void clicks(int i, int *l, int *r)
+{
+	int n = i % 24000;
+
+	*l = *r = n < 2400 ? noise()*(2400 - n)/2400 : 0;
+}
+
+/* bass, mid and treble tones starting and stopping at different times */
+static void mix(int i, int *l, int *r)
+{
+	static unsigned int p1, p2, p3;
+	int x;
+
+	if(i == 0)
+		p1 = p2 = p3 = 0;
+	p1 += FREQ(60);
+	p2 += FREQ(800);
+	p3 += FREQ(7000);
+	x = 0;
+	if((i/12000) % 3 != 2)
+		x += triangle(p1)/3;
+	if((i/8000) % 2)
+		x += triangle(p2)/6;
+	if((i/30000) % 2 == 0)
+		x += triangle(p3)/8;
+	*l = x + noise()/64;
+	*r = x/2 - noise()/64;
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(int i, int *l, int *r);
+} signals[] = {
+	{ "silence", silence },
+	{ "noise", white },
+	{ "chirp", chirp },
+	{ "square", square },
+	{ "clicks", clicks },
+	{ "mix", mix },
+	{ NULL, NULL }
+};
+
+static void usage(const char *name)
+{
+	int i;
+
+	fprintf(stderr, "usage: %s signal seconds >file.wav\n\n", name);
+	fprintf(stderr, "signals:");
+	for(i=0;signals[i].name!=NULL;i++)
+		fprintf(stderr, " %s", signals[i].name);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char out[4];
+	int i, n, s, l, r;
+
+	if(argc != 3)
+		usage(*argv);
+	for(s=0;signals[s].name!=NULL;s++)
+		if(strcmp(signals[s].name, argv[1]) == 0)
+			break;
+	if(signals[s].name == NULL)
+		usage(*argv);
+	n = atoi(argv[2])*48000;
+	if(n <= 0)
+		usage(*argv);
+
+	seed = 1;
+	wav_write_header(stdout, n);
+	for(i=0;i<n;i++) {
+		signals[s].fn(i, &l, &r);
+		l = clip(l);
+		r = clip(r);
+		out[0] = l;
+		out[1] = l >> 8;
+		out[2] = r;
+		out[3] = r >> 8;
+		fwrite(out, 1, 4, stdout);
+	}
+	return 0;
+}
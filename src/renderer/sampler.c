@@ -16,6 +16,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -27,7 +28,12 @@
 #include <bsp/milkymist_ac97.h>
 
 #include "framedescriptor.h"
+#include "framestats.h"
 #include "analyzer.h"
+#include "spectrum.h"
+#include "beat.h"
+#include "lookahead.h"
+#include "sndring.h"
 #include "../osc.h"
 #include "../config.h"
 #include "../input.h"
@@ -35,39 +41,6 @@
 #include "stimuli.h"
 #include "sampler.h"
 
-struct snd_history {
-	float bass_att, mid_att, treb_att;
-};
-
-static void init_history(struct snd_history *history)
-{
-	history->bass_att = 0.0;
-	history->mid_att = 0.0;
-	history->treb_att = 0.0;
-}
-
-static void analyze_snd(struct frame_descriptor *frd, struct snd_history *history)
-{
-	struct analyzer_state analyzer;
-	short *analyzer_buffer = (short *)frd->snd_buf->samples;
-	int i;
-
-	analyzer_init(&analyzer);
-	for(i=0;i<frd->snd_buf->nsamples;i++)
-		analyzer_put_sample(&analyzer, analyzer_buffer[2*i], analyzer_buffer[2*i+1]);
-
-	frd->bass = ((float)analyzer.bass_acc)/1200000.0;
-	frd->mid = ((float)analyzer.mid_acc)/400000.0;
-	frd->treb = ((float)analyzer.treb_acc)/252000.0;
-
-	history->treb_att = 0.6*history->treb_att + 0.4*frd->treb;
-	history->mid_att = 0.6*history->mid_att + 0.4*frd->mid;
-	history->bass_att = 0.6*history->bass_att + 0.4*frd->bass;
-	frd->treb_att = history->treb_att;
-	frd->mid_att = history->mid_att;
-	frd->bass_att = history->bass_att;
-}
-
 static int idmx_map[IDMX_COUNT];
 
 static void get_dmx_variables(int fd, float *out)
@@ -82,19 +55,76 @@ static void get_dmx_variables(int fd, float *out)
 	}
 }
 
+static int frd_count, frd_count_max, frd_count_live;
+static int frame_rate;
+static int spectrum_bands;
+static bool lookahead;
+static float time_offset;
+/* too large for the stack of the sampler task */
+static struct snd_history history;
+static struct spectrum_state spectrum;
+static struct beat_state beat;
+static struct lookahead_state prediction;
+/* never freed, other tasks may read it after the sampler stops */
+static struct snd_ring ring;
+
+/* read by other tasks */
+static volatile unsigned int beat_count;
+static volatile float beat_bpm;
+
+void sampler_get_beat(unsigned int *count, float *bpm)
+{
+	*count = beat_count;
+	*bpm = beat_bpm;
+}
+
+/*
+ * The sound is recorded into the ring in chunks, independently of the
+ * frame descriptors. At FPS, a frame is due each time FRD_AUDIO_NSAMPLES
+ * more samples have been recorded. At other frame rates, frames are due
+ * by the monotonic clock, and get the time read from it. A due frame is
+ * sent downstream, with the position of the end of its sound in the ring,
+ * as soon as a frame descriptor is free.
+ *
+ * The frame descriptor is stamped with when the middle of its sound was
+ * recorded, from which framestats measures how late the frame is shown.
+ * In look-ahead mode ("lookahead" setting), the levels and the beat are
+ * predicted that far ahead. The "time_offset" setting (in ms) shifts the
+ * time seen by the patches.
+ */
+#define FRAME_RATE_MIN		(10)
+#define FRAME_RATE_MAX		(120)
+
+static bool live_video(void)
+{
+	struct patch *p;
+	bool live;
+
+	renderer_lock_patch();
+	p = renderer_get_patch(0);
+	live = (p != NULL) && (p->require & REQUIRE_VIDEO);
+	renderer_unlock_patch();
+	return live;
+}
+
 static rtems_id returned_q;
 static rtems_id sampler_terminated;
 
 static rtems_task sampler_task(rtems_task_argument argument)
 {
-	struct frame_descriptor *frame_descriptors[FRD_COUNT];
+	struct frame_descriptor *frame_descriptors[FRD_COUNT_MAX];
+	int n_frd;
+	struct frd_depth depth;
 	int i;
 	int snd_fd, dmx_fd;
-	struct snd_history history;
 	frd_callback callback = (frd_callback)argument;
 	rtems_event_set dummy;
-	float time;
 	int frame;
+	bool decoupled;
+	unsigned int now, last, next_frame, frame_period;
+	unsigned int snd_end;
+	double elapsed;
+	float ahead;
 
 	snd_fd = open("/dev/snd", O_RDWR);
 	if(snd_fd == -1) {
@@ -107,51 +137,65 @@ static rtems_task sampler_task(rtems_task_argument argument)
 		goto end0;
 	}
 
-	init_history(&history);
-
-	for(i=0;i<FRD_COUNT;i++)
-		frame_descriptors[i] = NULL;
-	for(i=0;i<FRD_COUNT;i++) {
-		frame_descriptors[i] = new_frame_descriptor();
-		if(frame_descriptors[i] == NULL) {
+	analyzer_init_history(&history);
+	spectrum_init(&spectrum, spectrum_bands, frame_rate);
+	beat_init(&beat, frame_rate);
+	beat_bpm = 0.0f;
+	lookahead_init(&prediction, frame_rate);
+
+	decoupled = frame_rate != FPS;
+	frame_period = 1000000/frame_rate;
+	framestats_set_frame_rate(frame_rate);
+	if(decoupled)
+		analyzer_set_frame_rate(&history, frame_rate);
+
+	frd_depth_init(&depth, frd_count, frd_count_max, frd_count_live,
+		frame_rate);
+	for(n_frd=0;n_frd<depth.count;n_frd++) {
+		frame_descriptors[n_frd] = new_frame_descriptor();
+		if(frame_descriptors[n_frd] == NULL) {
 			perror("new_frame_descriptor");
 			goto end1;
 		}
 	}
 
-	time = 0;
+	if(!snd_ring_init(&ring)) {
+		printf("Unable to allocate the sound ring\n");
+		goto end1;
+	}
+	for(i=0;i<SND_RING_DRIVER_CHUNKS;i++)
+		ioctl(snd_fd, SOUND_SND_SUBMIT_RECORD,
+			snd_ring_chunk(&ring, i*SND_RING_CHUNK_NSAMPLES));
+
 	frame = 0;
+	snd_end = 0;
+	last = next_frame = framestats_now();
+	elapsed = 0.0;
 
 	while(rtems_event_receive(RTEMS_EVENT_0, RTEMS_NO_WAIT, RTEMS_NO_TIMEOUT, &dummy) != RTEMS_SUCCESSFUL) {
 		struct snd_buffer *recorded_buf;
 		struct frame_descriptor *recorded_descriptor;
-		bool pending_downstream;
+		unsigned int end;
+		int target;
 
-		/*
-		 * Recycle any returned frame descriptor.
-		 * Block if all frame descriptors have status >= FRD_STATUS_SAMPLED
-		 * (i.e. all frame descriptors are pending processing by downstream)
-		 */
-		pending_downstream = true;
-		for(i=0;i<FRD_COUNT;i++) {
-			if(frame_descriptors[i]->status < FRD_STATUS_SAMPLED) {
-				pending_downstream = false;
-				break;
-			}
+		/* Wait for the next chunk of sound, and hand the driver the next one */
+		ioctl(snd_fd, SOUND_SND_COLLECT_RECORD, &recorded_buf);
+		snd_ring_advance(&ring, recorded_buf->nsamples);
+		ioctl(snd_fd, SOUND_SND_SUBMIT_RECORD, snd_ring_chunk(&ring,
+			ring.written + (SND_RING_DRIVER_CHUNKS-1)*SND_RING_CHUNK_NSAMPLES));
+
+		now = framestats_now();
+		if(!decoupled) {
+			end = snd_end + FRD_AUDIO_NSAMPLES;
+			if((int)(ring.written - end) < 0)
+				continue;
+		} else {
+			if((int)(now - next_frame) < 0)
+				continue;
+			end = ring.written;
 		}
-		if(pending_downstream) {
-			size_t s;
-			struct frame_descriptor *returned_descriptor;
 
-			rtems_message_queue_receive(
-				returned_q,
-				&returned_descriptor,
-				&s,
-				RTEMS_WAIT,
-				RTEMS_NO_TIMEOUT
-			);
-			returned_descriptor->status = FRD_STATUS_NEW;
-		}
+		/* Recycle any returned frame descriptor */
 		while(1) {
 			size_t s;
 			struct frame_descriptor *returned_descriptor;
@@ -166,50 +210,86 @@ static rtems_task sampler_task(rtems_task_argument argument)
 			);
 			if(sc != RTEMS_SUCCESSFUL)
 				break;
-			returned_descriptor->status = FRD_STATUS_NEW;
+			frd_set_status(returned_descriptor, FRD_STATUS_NEW);
 		}
-		/* Refill AC97 driver with record buffers */
-		for(i=0;i<FRD_COUNT;i++) {
+		/*
+		 * Adjust the depth of the pipeline. Only descriptors that are
+		 * not downstream can be freed.
+		 */
+		target = frd_depth_update(&depth, live_video());
+		for(i=n_frd-1;(i>=0) && (n_frd>target);i--) {
 			if(frame_descriptors[i]->status == FRD_STATUS_NEW) {
-				ioctl(snd_fd, SOUND_SND_SUBMIT_RECORD, frame_descriptors[i]->snd_buf);
-				frame_descriptors[i]->status = FRD_STATUS_SAMPLING;
+				free_frame_descriptor(frame_descriptors[i]);
+				frame_descriptors[i] = frame_descriptors[--n_frd];
 			}
 		}
-		/* Wait for some sound to be recorded */
-		ioctl(snd_fd, SOUND_SND_COLLECT_RECORD, &recorded_buf);
-		recorded_descriptor = (struct frame_descriptor *)recorded_buf->user;
+		while(n_frd < target) {
+			frame_descriptors[n_frd] = new_frame_descriptor();
+			if(frame_descriptors[n_frd] == NULL)
+				break;
+			n_frd++;
+		}
+
+		recorded_descriptor = NULL;
+		for(i=0;i<n_frd;i++) {
+			if(frame_descriptors[i]->status == FRD_STATUS_NEW) {
+				recorded_descriptor = frame_descriptors[i];
+				break;
+			}
+		}
+		if(recorded_descriptor == NULL) {
+			/* Frame is late */
+			frd_depth_stall(&depth);
+			continue;
+		}
+		if(!decoupled) {
+			/* Drop the frames that are more than one late */
+			while(ring.written - end >= FRD_AUDIO_NSAMPLES)
+				end += FRD_AUDIO_NSAMPLES;
+			elapsed += (end - snd_end)/48000.0;
+			/* (the time of the start of the sound) */
+			recorded_descriptor->time = elapsed - 1.0/FPS;
+		} else {
+			next_frame += frame_period;
+			if((int)(now - next_frame) >= 0)
+				next_frame = now + frame_period;
+			elapsed += (now - last)/1000000.0;
+			last = now;
+			recorded_descriptor->time = elapsed;
+		}
+		snd_end = end;
+		frd_set_status(recorded_descriptor, FRD_STATUS_SAMPLING);
+		recorded_descriptor->snd_ring = &ring;
+		recorded_descriptor->snd_end = end;
+		/* (when the middle of its sound was recorded) */
+		recorded_descriptor->snd_time = now
+			- (ring.written - end + FRD_AUDIO_NSAMPLES/2)*1000/48;
 		/* Analyze */
+		ahead = lookahead ? framestats_get_sync()/1000000.0 : 0.0;
 		analyze_snd(recorded_descriptor, &history);
+		spectrum_analyze(recorded_descriptor, &spectrum);
+		beat_set_lead(&beat, ahead);
+		beat_track(recorded_descriptor, &beat);
+		beat_count = beat.count;
+		beat_bpm = beat.bpm;
+		if(lookahead)
+			lookahead_predict(recorded_descriptor, &prediction, ahead);
+		/* Shift the time, for the patches that are driven by it */
+		recorded_descriptor->time += time_offset;
 		recorded_descriptor->frame = frame++;
-		recorded_descriptor->time = time;
-		time += 1.0/FPS;
 		/* Get DMX/OSC inputs */
 		get_dmx_variables(dmx_fd, recorded_descriptor->idmx);
 		get_osc_variables(recorded_descriptor->osc);
 		/* Update status and send downstream */
-		recorded_descriptor->status = FRD_STATUS_SAMPLED;
+		frd_set_status(recorded_descriptor, FRD_STATUS_SAMPLED);
 		callback(recorded_descriptor);
 	}
 
 	/* Drain buffers from the sound driver */
-	while(1) {
+	for(i=0;i<SND_RING_DRIVER_CHUNKS;i++) {
 		struct snd_buffer *recorded_buf;
-		struct frame_descriptor *recorded_descriptor;
-		bool recording;
-
-		recording = false;
-		for(i=0;i<FRD_COUNT;i++) {
-			if(frame_descriptors[i]->status == FRD_STATUS_SAMPLING) {
-				recording = true;
-				break;
-			}
-		}
-		if(!recording)
-			break;
 
 		ioctl(snd_fd, SOUND_SND_COLLECT_RECORD, &recorded_buf);
-		recorded_descriptor = (struct frame_descriptor *)recorded_buf->user;
-		recorded_descriptor->status = FRD_STATUS_NEW;
 	}
 
 	/* Wait for all frame descriptors to be returned */
@@ -219,7 +299,7 @@ static rtems_task sampler_task(rtems_task_argument argument)
 		struct frame_descriptor *returned_descriptor;
 
 		all_returned = true;
-		for(i=0;i<FRD_COUNT;i++) {
+		for(i=0;i<n_frd;i++) {
 			if(frame_descriptors[i]->status >= FRD_STATUS_SAMPLED) {
 				all_returned = false;
 				break;
@@ -235,12 +315,12 @@ static rtems_task sampler_task(rtems_task_argument argument)
 			RTEMS_WAIT,
 			RTEMS_NO_TIMEOUT
 		);
-		returned_descriptor->status = FRD_STATUS_NEW;
+		frd_set_status(returned_descriptor, FRD_STATUS_NEW);
 	}
 
 end1:
 	close(dmx_fd);
-	for(i=0;i<FRD_COUNT;i++)
+	for(i=0;i<n_frd;i++)
 		free_frame_descriptor(frame_descriptors[i]);
 
 end0:
@@ -308,10 +388,21 @@ void sampler_start(frd_callback callback)
 		sprintf(confname, "idmx%d", i+1);
 		idmx_map[i] = config_read_int(confname, i+1)-1;
 	}
+	frd_count = config_read_int("frd_count", FRD_COUNT_DEFAULT);
+	frd_count_max = config_read_int("frd_count_max", 6);
+	frd_count_live = config_read_int("frd_count_live", 3);
+	frame_rate = config_read_int("frame_rate", FPS);
+	if(frame_rate < FRAME_RATE_MIN)
+		frame_rate = FRAME_RATE_MIN;
+	if(frame_rate > FRAME_RATE_MAX)
+		frame_rate = FRAME_RATE_MAX;
+	spectrum_bands = config_read_int("spectrum_bands", SPECTRUM_BANDS_DEFAULT);
+	lookahead = config_read_int("lookahead", 0);
+	time_offset = config_read_int("time_offset", 0)/1000.0;	/* ms */
 
 	sc = rtems_message_queue_create(
 		rtems_build_name('S', 'M', 'P', 'L'),
-		FRD_COUNT,
+		FRD_COUNT_MAX,
 		sizeof(void *),
 		0,
 		&returned_q);
@@ -24,4 +24,10 @@ void sampler_start(frd_callback callback);
 void sampler_return(struct frame_descriptor *frd);
 void sampler_stop(void);
 
+/*
+ * Beats counted by the sampler since it started, and the current tempo
+ * (0 when none is found). See beat.h.
+ */
+void sampler_get_beat(unsigned int *count, float *bpm);
+
 #endif /* __SAMPLER_H */
@@ -0,0 +1,121 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sndring.h"
+
+/* positions wrap around at 2^32, a multiple of the size of the ring */
+#define CHUNK(pos)	(((pos)/SND_RING_CHUNK_NSAMPLES) % SND_RING_CHUNKS)
+#define OFFSET(pos)	((pos) % SND_RING_CHUNK_NSAMPLES)
+
+bool snd_ring_init(struct snd_ring *r)
+{
+	int i;
+
+	for(i=0;i<SND_RING_CHUNKS;i++) {
+		if(r->chunks[i] == NULL) {
+			r->chunks[i] = malloc(sizeof(struct snd_buffer)
+			    + 4*SND_RING_CHUNK_NSAMPLES);
+			if(r->chunks[i] == NULL) {
+				snd_ring_free(r);
+				return false;
+			}
+		}
+		r->chunks[i]->nsamples = SND_RING_CHUNK_NSAMPLES;
+		r->chunks[i]->user = NULL;
+		memset(r->chunks[i]->samples, 0, 4*SND_RING_CHUNK_NSAMPLES);
+	}
+	r->written = 0;
+	return true;
+}
+
+void snd_ring_free(struct snd_ring *r)
+{
+	int i;
+
+	for(i=0;i<SND_RING_CHUNKS;i++) {
+		free(r->chunks[i]);
+		r->chunks[i] = NULL;
+	}
+}
+
+struct snd_buffer *snd_ring_chunk(struct snd_ring *r, unsigned int pos)
+{
+	return r->chunks[CHUNK(pos)];
+}
+
+void snd_ring_advance(struct snd_ring *r, int n)
+{
+	r->written += n;
+}
+
+void snd_ring_put(struct snd_ring *r, const short *samples, int n)
+{
+	unsigned int pos;
+	int c;
+
+	while(n > 0) {
+		pos = r->written;
+		c = SND_RING_CHUNK_NSAMPLES - OFFSET(pos);
+		if(c > n)
+			c = n;
+		memcpy(&r->chunks[CHUNK(pos)]->samples[OFFSET(pos)], samples,
+		    4*c);
+		snd_ring_advance(r, c);
+		samples += 2*c;
+		n -= c;
+	}
+}
+
+int snd_ring_get(const struct snd_ring *r, unsigned int pos, int n,
+	const short **samples)
+{
+	int c;
+
+	*samples = (const short *)&r->chunks[CHUNK(pos)]->samples[OFFSET(pos)];
+	c = SND_RING_CHUNK_NSAMPLES - OFFSET(pos);
+	return c < n ? c : n;
+}
+
+short snd_ring_sample(const struct snd_ring *r, unsigned int pos,
+	int channel)
+{
+	const short *s = (const short *)r->chunks[CHUNK(pos)]->samples;
+
+	return s[2*OFFSET(pos) + channel];
+}
+
+int snd_ring_peak(const struct snd_ring *r, unsigned int pos, int n)
+{
+	const short *s;
+	int i, c, peak;
+
+	peak = 0;
+	while(n > 0) {
+		c = snd_ring_get(r, pos, n, &s);
+		for(i=0;i<2*c;i++) {
+			if(abs(s[i]) > peak)
+				peak = abs(s[i]);
+		}
+		pos += c;
+		n -= c;
+	}
+	return peak;
+}
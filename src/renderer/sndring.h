@@ -0,0 +1,85 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SNDRING_H
+#define __SNDRING_H
+
+#include <stdbool.h>
+
+#ifndef STANDALONE
+#include <bsp/milkymist_ac97.h>
+#else
+#include STANDALONE
+#endif /* STANDALONE */
+
+/*
+ * Ring of recorded sound, shared by the sampler and the tasks that read it.
+ *
+ * The ring is made of SND_RING_CHUNKS record buffers, of which the sampler
+ * keeps SND_RING_DRIVER_CHUNKS with the sound driver: the driver records
+ * straight into the ring and, when a chunk comes back, the write position
+ * moves past it and the chunk SND_RING_DRIVER_CHUNKS ahead goes to the
+ * driver. Nothing is copied.
+ *
+ * Sound is addressed by position, the number of stereo samples written
+ * since snd_ring_init (wrapping around at 2^32). Frame descriptors carry
+ * the position of the end of their sound, from which the analyzer, the
+ * spectrum and the wave drawing read it, and the GUI meters read the sound
+ * just before the write position. The SND_RING_HISTORY samples before the
+ * write position can be read from any task, longer than a frame descriptor
+ * stays in the pipeline. The ring starts out as silence.
+ */
+
+#define SND_RING_CHUNK_NSAMPLES	(256)	/* 5.3ms */
+#define SND_RING_CHUNKS		(256)
+#define SND_RING_NSAMPLES	(SND_RING_CHUNKS*SND_RING_CHUNK_NSAMPLES)
+#define SND_RING_DRIVER_CHUNKS	(8)
+#define SND_RING_HISTORY	(SND_RING_NSAMPLES \
+				- SND_RING_DRIVER_CHUNKS*SND_RING_CHUNK_NSAMPLES)
+
+struct snd_ring {
+	struct snd_buffer *chunks[SND_RING_CHUNKS];
+	volatile unsigned int written;	/* write position */
+};
+
+/*
+ * Allocates the chunks that are still NULL (as in a new static ring) and
+ * fills the ring with silence. A ring can be initialized again without
+ * being freed, while other tasks may still read it.
+ */
+bool snd_ring_init(struct snd_ring *r);
+void snd_ring_free(struct snd_ring *r);
+
+/* writing: the chunk where the sound at pos goes, and moving past n samples */
+struct snd_buffer *snd_ring_chunk(struct snd_ring *r, unsigned int pos);
+void snd_ring_advance(struct snd_ring *r, int n);
+/* copies sound that does not come from the driver */
+void snd_ring_put(struct snd_ring *r, const short *samples, int n);
+
+/*
+ * Reading: snd_ring_get points samples to the interleaved stereo samples
+ * from pos, and returns how many of the next n follow in memory (at least
+ * one).
+ */
+int snd_ring_get(const struct snd_ring *r, unsigned int pos, int n,
+	const short **samples);
+short snd_ring_sample(const struct snd_ring *r, unsigned int pos,
+	int channel);
+/* largest absolute value of n samples from pos, in both channels */
+int snd_ring_peak(const struct snd_ring *r, unsigned int pos, int n);
+
+#endif /* __SNDRING_H */
@@ -0,0 +1,159 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include <fpvm/fpvm.h>
+#include <fpvm/pfpu.h>
+
+#include "softpfpu.h"
+
+/* must be a power of two larger than the longest PFPU latency */
+#define PIPELINE_SLOTS	16
+
+union reg {
+	float f;
+	unsigned int i;
+};
+
+/*
+ * The PFPU computes SIN and COS with a lookup table indexed by the integer
+ * angle (8192 steps per turn). We build the same table from double
+ * precision values rounded to single precision.
+ */
+float softpfpu_sin_table[SOFTPFPU_TRIG_STEPS];
+static bool sin_table_ready;
+
+void softpfpu_init(void)
+{
+	int i;
+
+	if(sin_table_ready)
+		return;
+	for(i=0;i<SOFTPFPU_TRIG_STEPS;i++)
+		softpfpu_sin_table[i] = sin(2.0*M_PI*(double)i
+		    /(double)SOFTPFPU_TRIG_STEPS);
+	sin_table_ready = true;
+}
+
+static unsigned int alu(int opcode, union reg a, union reg b, union reg ifb)
+{
+	union reg r;
+
+	switch(opcode) {
+		case FPVM_OPCODE_FADD:
+			r.f = a.f + b.f;
+			break;
+		case FPVM_OPCODE_FSUB:
+			r.f = a.f - b.f;
+			break;
+		case FPVM_OPCODE_FMUL:
+			r.f = a.f * b.f;
+			break;
+		case FPVM_OPCODE_FABS:
+			r.i = a.i & 0x7fffffff;
+			break;
+		case FPVM_OPCODE_F2I:
+			r.i = (int)a.f;
+			break;
+		case FPVM_OPCODE_I2F:
+			r.f = (int)a.i;
+			break;
+		case FPVM_OPCODE_SIN:
+			r.f = softpfpu_sin_table[a.i & (SOFTPFPU_TRIG_STEPS-1)];
+			break;
+		case FPVM_OPCODE_COS:
+			r.f = softpfpu_sin_table[(a.i + SOFTPFPU_TRIG_STEPS/4)
+			    & (SOFTPFPU_TRIG_STEPS-1)];
+			break;
+		case FPVM_OPCODE_ABOVE:
+			r.f = a.f > b.f ? 1.0f : 0.0f;
+			break;
+		case FPVM_OPCODE_EQUAL:
+			r.f = a.f == b.f ? 1.0f : 0.0f;
+			break;
+		case FPVM_OPCODE_COPY:
+			r = a;
+			break;
+		case FPVM_OPCODE_IF:
+			r = ifb.i ? a : b;
+			break;
+		case FPVM_OPCODE_TSIGN:
+			r.i = (a.i & 0x7fffffff) | (b.i & 0x80000000);
+			break;
+		case FPVM_OPCODE_QUAKE:
+			r.i = 0x5f3759df - (a.i >> 1);
+			break;
+		default:
+			r.i = 0;
+			break;
+	}
+	return r.i;
+}
+
+void softpfpu_execute(struct pfpu_td *td)
+{
+	union reg regs[PFPU_REG_COUNT];
+	union reg result[PIPELINE_SLOTS];
+	bool busy[PIPELINE_SLOTS];
+	pfpu_instruction *prog = (pfpu_instruction *)td->program;
+	pfpu_instruction inst;
+	unsigned int x, y, pc;
+	unsigned int *out;
+	int opcode, done;
+
+	softpfpu_init();
+	memcpy(regs, td->registers, sizeof(regs));
+
+	for(y=0;y<=td->vmeshlast;y++)
+		for(x=0;x<=td->hmeshlast;x++) {
+			regs[SOFTPFPU_REG_X].i = x;
+			regs[SOFTPFPU_REG_Y].i = y;
+			memset(busy, 0, sizeof(busy));
+
+			for(pc=0;pc<td->progsize;pc++) {
+				inst = prog[pc];
+				opcode = inst.i.opcode;
+
+				/* operands are read before this cycle's write */
+				if(opcode == FPVM_OPCODE_VECTOUT) {
+					out = td->output
+					    + 2*(y*TMU_MESH_MAXSIZE + x);
+					out[0] = regs[inst.i.opa].i;
+					out[1] = regs[inst.i.opb].i;
+				} else if(opcode != FPVM_OPCODE_NOP) {
+					done = (pc + pfpu_get_latency(opcode))
+					    & (PIPELINE_SLOTS-1);
+					result[done].i = alu(opcode,
+					    regs[inst.i.opa], regs[inst.i.opb],
+					    regs[SOFTPFPU_REG_IFB]);
+					busy[done] = true;
+				}
+
+				if(busy[pc & (PIPELINE_SLOTS-1)]) {
+					regs[inst.i.dest] =
+					    result[pc & (PIPELINE_SLOTS-1)];
+					busy[pc & (PIPELINE_SLOTS-1)] = false;
+				}
+			}
+		}
+
+	if(td->update)
+		memcpy(td->registers, regs, sizeof(regs));
+}
@@ -0,0 +1,51 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SOFTPFPU_H
+#define __SOFTPFPU_H
+
+#ifndef STANDALONE
+#include <bsp/milkymist_pfpu.h>
+#include <bsp/milkymist_tmu.h>
+#else
+#include STANDALONE
+#endif /* STANDALONE */
+
+/*
+ * Software model of the PFPU. It runs the scheduled VLIW microcode from
+ * struct patch exactly like the hardware does: one instruction is issued
+ * per cycle, and the result of an operation is written at the cycle it
+ * leaves the pipeline, to the register named by the "dest" field of the
+ * instruction word fetched at that cycle.
+ *
+ * softpfpu_execute takes the same transfer descriptor as the PFPU_EXECUTE
+ * ioctl and writes the VECTOUT results to td->output, with the row pitch
+ * of the TMU (TMU_MESH_MAXSIZE vertices).
+ */
+
+#define SOFTPFPU_REG_X		0	/* mesh column, integer */
+#define SOFTPFPU_REG_Y		1	/* mesh row, integer */
+#define SOFTPFPU_REG_IFB	2	/* condition for IF */
+
+#define SOFTPFPU_TRIG_STEPS	8192	/* SIN/COS units per full turn */
+
+extern float softpfpu_sin_table[SOFTPFPU_TRIG_STEPS];
+
+void softpfpu_init(void);
+void softpfpu_execute(struct pfpu_td *td);
+
+#endif /* __SOFTPFPU_H */
@@ -0,0 +1,298 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+
+#include "softtmu.h"
+
+typedef int vint __attribute__((vector_size(SOFTTMU_LANES*sizeof(int))));
+
+union vpix {
+	vint v;
+	int l[SOFTTMU_LANES];
+};
+
+#define FRAC_MASK	((1 << TMU_FIXEDPOINT_SHIFT) - 1)
+#define ONE		(1 << TMU_FIXEDPOINT_SHIFT)
+
+/****************************************************************/
+/* COORDINATES                                                  */
+/****************************************************************/
+
+/* a + trunc((b-a)*n/d), as computed by the TMU dividers */
+static int interp(int a, int b, int n, int d)
+{
+	return a + (int)((long long)(b - a)*n/d);
+}
+
+/*
+ * Steps a + trunc((b-a)*n/d) for successive n without dividing, like the
+ * DDA of the TMU horizontal interpolator.
+ */
+struct dda {
+	int value;
+	int q;		/* quotient of the step */
+	int r;		/* absolute value of the remainder */
+	int s;		/* sign of the remainder */
+	int d;
+	int err;
+};
+
+static void dda_init(struct dda *dda, int a, int b, int d)
+{
+	int diff = b - a;
+
+	dda->value = a;
+	dda->q = diff/d;
+	dda->r = diff % d;
+	dda->s = 1;
+	if(dda->r < 0) {
+		dda->r = -dda->r;
+		dda->s = -1;
+	}
+	dda->d = d;
+	dda->err = 0;
+}
+
+static int dda_next(struct dda *dda)
+{
+	int v = dda->value;
+
+	dda->value += dda->q;
+	dda->err += dda->r;
+	if(dda->err >= dda->d) {
+		dda->err -= dda->d;
+		dda->value += dda->s;
+	}
+	return v;
+}
+
+/* mask, sign-extend from bit 17, then clamp to the texture */
+static vint clamp_coord(vint t, unsigned int mask, unsigned int res)
+{
+	vint max, above;
+
+	t &= (int)(mask & 0x3ffff);
+	t = (t ^ 0x20000) - 0x20000;
+	t &= ~(t >> 31);
+	max = (vint){} + (int)((res - 1) << TMU_FIXEDPOINT_SHIFT);
+	above = t > max;
+	return (t & ~above) | (max & above);
+}
+
+/****************************************************************/
+/* PIXELS                                                       */
+/****************************************************************/
+
+#define RED(c)		(((c) >> 11) & 0x1f)
+#define GREEN(c)	(((c) >> 5) & 0x3f)
+#define BLUE(c)		((c) & 0x1f)
+
+static vint filter(vint c00, vint c01, vint c10, vint c11, vint fx, vint fy)
+{
+	vint w00, w01, w10, w11;
+	vint r, g, b;
+
+	w00 = (ONE - fx)*(ONE - fy);
+	w01 = fx*(ONE - fy);
+	w10 = (ONE - fx)*fy;
+	w11 = fx*fy;
+	r = (RED(c00)*w00 + RED(c01)*w01 + RED(c10)*w10 + RED(c11)*w11)
+	    >> (2*TMU_FIXEDPOINT_SHIFT);
+	g = (GREEN(c00)*w00 + GREEN(c01)*w01 + GREEN(c10)*w10
+	    + GREEN(c11)*w11) >> (2*TMU_FIXEDPOINT_SHIFT);
+	b = (BLUE(c00)*w00 + BLUE(c01)*w01 + BLUE(c10)*w10 + BLUE(c11)*w11)
+	    >> (2*TMU_FIXEDPOINT_SHIFT);
+	return (r << 11) | (g << 5) | b;
+}
+
+static vint scale(vint c, int k)
+{
+	return (((RED(c)*k) >> TMU_FIXEDPOINT_SHIFT) << 11)
+	    | (((GREEN(c)*k) >> TMU_FIXEDPOINT_SHIFT) << 5)
+	    | ((BLUE(c)*k) >> TMU_FIXEDPOINT_SHIFT);
+}
+
+static vint saturate(vint x, int max)
+{
+	vint above = x > max;
+
+	return (x & ~above) | (max & above);
+}
+
+static vint blend(const struct tmu_td *td, vint src, vint dst)
+{
+	int a = td->alpha + 1;
+	vint r, g, b;
+
+	if(td->flags & TMU_FLAG_ADDITIVE) {
+		r = saturate(((RED(src)*a) >> TMU_FIXEDPOINT_SHIFT)
+		    + RED(dst), 0x1f);
+		g = saturate(((GREEN(src)*a) >> TMU_FIXEDPOINT_SHIFT)
+		    + GREEN(dst), 0x3f);
+		b = saturate(((BLUE(src)*a) >> TMU_FIXEDPOINT_SHIFT)
+		    + BLUE(dst), 0x1f);
+	} else {
+		r = (RED(src)*a + RED(dst)*(ONE - a)) >> TMU_FIXEDPOINT_SHIFT;
+		g = (GREEN(src)*a + GREEN(dst)*(ONE - a))
+		    >> TMU_FIXEDPOINT_SHIFT;
+		b = (BLUE(src)*a + BLUE(dst)*(ONE - a))
+		    >> TMU_FIXEDPOINT_SHIFT;
+	}
+	return (r << 11) | (g << 5) | b;
+}
+
+/* draws n consecutive destination pixels from their texture coordinates */
+static void span(const struct tmu_td *td, unsigned short *dst, int n,
+    union vpix *tx, union vpix *ty)
+{
+	const unsigned short *tex = td->texfbuf;
+	union vpix ix, iy, ix1, iy1, fx, fy;
+	union vpix c00, c01, c10, c11, d, out;
+	vint x, y, key;
+	int l;
+
+	x = clamp_coord(tx->v, td->texhmask, td->texhres);
+	y = clamp_coord(ty->v, td->texvmask, td->texvres);
+	ix.v = x >> TMU_FIXEDPOINT_SHIFT;
+	iy.v = y >> TMU_FIXEDPOINT_SHIFT;
+	fx.v = x & FRAC_MASK;
+	fy.v = y & FRAC_MASK;
+	/* (comparisons give -1 for true) */
+	ix1.v = ix.v - (ix.v < (int)(td->texhres - 1));
+	iy1.v = iy.v - (iy.v < (int)(td->texvres - 1));
+
+	for(l=0;l<n;l++) {
+		const unsigned short *row0 = tex + iy.l[l]*td->texhres;
+		const unsigned short *row1 = tex + iy1.l[l]*td->texhres;
+
+		c00.l[l] = row0[ix.l[l]];
+		c01.l[l] = row0[ix1.l[l]];
+		c10.l[l] = row1[ix.l[l]];
+		c11.l[l] = row1[ix1.l[l]];
+	}
+	for(;l<SOFTTMU_LANES;l++) {
+		c00.l[l] = c01.l[l] = c10.l[l] = c11.l[l] = 0;
+		d.l[l] = 0;
+	}
+
+	out.v = filter(c00.v, c01.v, c10.v, c11.v, fx.v, fy.v);
+	if(td->brightness < TMU_BRIGHTNESS_MAX)
+		out.v = scale(out.v, td->brightness + 1);
+	if((td->flags & TMU_FLAG_ADDITIVE) || (td->alpha < TMU_ALPHA_MAX)) {
+		for(l=0;l<n;l++)
+			d.l[l] = dst[l];
+		out.v = blend(td, out.v, d.v);
+	}
+
+	if(td->flags & TMU_FLAG_CHROMAKEY) {
+		union vpix skip;
+
+		key = (vint){} + td->chromakey;
+		skip.v = c00.v == key;
+		for(l=0;l<n;l++)
+			if(!skip.l[l])
+				dst[l] = out.l[l];
+	} else {
+		for(l=0;l<n;l++)
+			dst[l] = out.l[l];
+	}
+}
+
+/****************************************************************/
+/* MESH                                                         */
+/****************************************************************/
+
+static void square(const struct tmu_td *td, int i, int j)
+{
+	const struct tmu_vertex *v00, *v01, *v10, *v11;
+	union vpix tx, ty;
+	struct dda hx, hy;
+	unsigned short *dst;
+	int w = td->dstsquarew;
+	int h = td->dstsquareh;
+	int x0, y0, u0, u1, u, v, n, l;
+	int lx, ly, rx, ry;
+
+	v00 = &td->vertices[j*TMU_MESH_MAXSIZE + i];
+	v01 = v00 + 1;
+	v10 = v00 + TMU_MESH_MAXSIZE;
+	v11 = v10 + 1;
+
+	x0 = td->dsthoffset + i*w;
+	y0 = td->dstvoffset + j*h;
+
+	/* horizontal clipping */
+	u0 = x0 < 0 ? -x0 : 0;
+	u1 = w;
+	if(x0 + u1 > (int)td->dsthres)
+		u1 = td->dsthres - x0;
+	if(u0 >= u1)
+		return;
+
+	for(v=0;v<h;v++) {
+		if((y0 + v < 0) || (y0 + v >= (int)td->dstvres))
+			continue;
+		lx = interp(v00->x, v10->x, v, h);
+		ly = interp(v00->y, v10->y, v, h);
+		rx = interp(v01->x, v11->x, v, h);
+		ry = interp(v01->y, v11->y, v, h);
+		dda_init(&hx, lx, rx, w);
+		dda_init(&hy, ly, ry, w);
+		for(u=0;u<u0;u++) {
+			dda_next(&hx);
+			dda_next(&hy);
+		}
+
+		dst = td->dstfbuf + (y0 + v)*td->dsthres + x0 + u0;
+		while(u < u1) {
+			for(n=0;(n<SOFTTMU_LANES) && (u < u1);n++,u++) {
+				tx.l[n] = dda_next(&hx);
+				ty.l[n] = dda_next(&hy);
+			}
+			for(l=n;l<SOFTTMU_LANES;l++)
+				tx.l[l] = ty.l[l] = 0;
+			span(td, dst, n, &tx, &ty);
+			dst += n;
+		}
+	}
+}
+
+void softtmu_execute(const struct tmu_td *td)
+{
+	unsigned int i, j;
+
+	if((td->dstsquarew == 0) || (td->dstsquareh == 0))
+		return;
+	for(j=0;j<td->vmeshlast;j++)
+		for(i=0;i<td->hmeshlast;i++)
+			square(td, i, j);
+}
+
+int softtmu_ioctl(int fd, int request, struct tmu_td *td)
+{
+	switch(request) {
+		case TMU_EXECUTE:
+		case TMU_EXECUTE_NONBLOCK:
+			softtmu_execute(td);
+			return 0;
+		case TMU_EXECUTE_WAIT:
+			return 0;
+		default:
+			return -1;
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SOFTTMU_H
+#define __SOFTTMU_H
+
+#ifndef STANDALONE
+#include <bsp/milkymist_tmu.h>
+#else
+#include STANDALONE
+#endif /* STANDALONE */
+
+/*
+ * Software model of the TMU. softtmu_execute takes the same transfer
+ * descriptor as the TMU_EXECUTE ioctl and goes through the same stages as
+ * the hardware:
+ *
+ * - each mesh square is mapped to a dstsquarew x dstsquareh rectangle of
+ *   the destination, and the texture coordinates of its corners are
+ *   interpolated linearly, first down the left and right edges, then
+ *   along each scanline, with truncating integer division;
+ * - the coordinates are masked with texhmask/texvmask, bit 17 being the
+ *   sign, and clamped to the texture;
+ * - the four nearest texels are filtered with the 6 fractional bits, then
+ *   scaled by (brightness+1)/64;
+ * - the result is blended with the destination according to alpha, or
+ *   added to it with TMU_FLAG_ADDITIVE. With TMU_FLAG_CHROMAKEY, pixels
+ *   whose nearest texel equals chromakey are not written.
+ *
+ * Filtering and blending work on SOFTTMU_LANES pixels at a time.
+ */
+
+#ifndef SOFTTMU_LANES
+#ifdef __AVX__
+#define SOFTTMU_LANES	8
+#else
+#define SOFTTMU_LANES	4
+#endif
+#endif
+
+void softtmu_execute(const struct tmu_td *td);
+
+/*
+ * Stand-in for the TMU ioctls, for renderer code built with WITH_SOFTTMU.
+ * TMU_EXECUTE and TMU_EXECUTE_NONBLOCK run the transfer at once, so
+ * TMU_EXECUTE_WAIT has nothing to wait for.
+ */
+int softtmu_ioctl(int fd, int request, struct tmu_td *td);
+
+#endif /* __SOFTTMU_H */
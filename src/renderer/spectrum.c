@@ -0,0 +1,238 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "framedescriptor.h"
+#include "spectrum.h"
+
+/*
+ * The board has no FPU: the FFT is done on integers, as the real FFT of
+ * SPECTRUM_N points computed from a complex FFT of half that size. Each
+ * butterfly stage halves its results, so that no value ever exceeds about
+ * 2^15.5 and every product fits in 32 bits.
+ */
+
+#define M		(SPECTRUM_N/2)	/* points of the complex FFT */
+#define SAMPLE_RATE	(48000)
+
+/* average energy of a band under which it counts as silent (-45dBFS) */
+#define ENERGY_FLOOR	(1000.0f)
+#define LEVEL_MAX	(10.0f)
+
+/* weights of the previous averages, at FPS frames per second */
+#define AVG_KEEP	(0.99f)		/* about 4s */
+#define FLUX_KEEP	(0.9f)
+
+#define ONSET_RATIO	(2.0f)
+#define ONSET_MIN	(0.3f)
+
+static bool tables_ready;
+static short cos_table[M];	/* cos(2*pi*k/SPECTRUM_N), Q15 */
+static short sin_table[M];
+static short window[FRD_AUDIO_NSAMPLES];
+static int re[M], im[M];
+
+static void init_tables(void)
+{
+	int i;
+
+	for(i=0;i<M;i++) {
+		cos_table[i] = lrint(32767.0*cos(2.0*M_PI*i/SPECTRUM_N));
+		sin_table[i] = lrint(32767.0*sin(2.0*M_PI*i/SPECTRUM_N));
+	}
+	for(i=0;i<FRD_AUDIO_NSAMPLES;i++)
+		window[i] = lrint(32767.0*0.5
+		    *(1.0 - cos(2.0*M_PI*i/(FRD_AUDIO_NSAMPLES-1))));
+	tables_ready = true;
+}
+
+void spectrum_init(struct spectrum_state *st, int nbands, int fps)
+{
+	float res, f;
+	int edge[BAND_COUNT+1];
+	int i;
+
+	if(!tables_ready)
+		init_tables();
+
+	if(nbands < 1)
+		nbands = 1;
+	if(nbands > BAND_COUNT)
+		nbands = BAND_COUNT;
+	st->nbands = nbands;
+
+	res = (float)SAMPLE_RATE/SPECTRUM_N;
+	for(i=0;i<=nbands;i++) {
+		f = SPECTRUM_FMIN*powf(SPECTRUM_FMAX/SPECTRUM_FMIN,
+		    (float)i/nbands);
+		edge[i] = f/res + 0.5f;
+		if(edge[i] < 1)
+			edge[i] = 1;
+		if(edge[i] > M)
+			edge[i] = M;
+	}
+	for(i=0;i<nbands;i++) {
+		st->lo[i] = edge[i];
+		st->hi[i] = edge[i+1];
+		/* low bands narrower than a bin get a bin of their own */
+		if(st->hi[i] <= st->lo[i])
+			st->hi[i] = st->lo[i] + 1;
+		if(st->hi[i] > M) {
+			st->hi[i] = M;
+			st->lo[i] = M - 1;
+		}
+		st->avg[i] = 0.0f;
+		/* the level of the first frame, not an onset */
+		st->last[i] = 1.0f;
+	}
+
+	st->keep = powf(AVG_KEEP, (float)FPS/fps);
+	st->flux_keep = powf(FLUX_KEEP, (float)FPS/fps);
+	st->flux_avg = 0.0f;
+	st->holdoff = 0;
+	st->holdoff_frames = ceilf(SPECTRUM_ONSET_HOLDOFF*fps);
+}
+
+/* in place on re and im, scaled by 1/M */
+static void fft(void)
+{
+	int i, j, k, h, step;
+	int c, s, tr, ti, t;
+
+	j = 0;
+	for(i=0;i<M-1;i++) {
+		if(i < j) {
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+		k = M >> 1;
+		while(k <= j) {
+			j -= k;
+			k >>= 1;
+		}
+		j += k;
+	}
+
+	for(h=1;h<M;h<<=1) {
+		step = SPECTRUM_N/(2*h);
+		for(k=0;k<h;k++) {
+			c = cos_table[k*step];
+			s = sin_table[k*step];
+			for(i=k;i<M;i+=2*h) {
+				j = i + h;
+				tr = (c*re[j] + s*im[j]) >> 15;
+				ti = (c*im[j] - s*re[j]) >> 15;
+				re[j] = (re[i] - tr) >> 1;
+				im[j] = (im[i] - ti) >> 1;
+				re[i] = (re[i] + tr) >> 1;
+				im[i] = (im[i] + ti) >> 1;
+			}
+		}
+	}
+}
+
+/* energy of bin k of the real FFT, from the half-size complex one */
+static unsigned int power(int k)
+{
+	int n = (M - k) & (M - 1);
+	int evr, evi, odr, odi, xr, xi;
+
+	evr = (re[k] + re[n]) >> 1;
+	evi = (im[k] - im[n]) >> 1;
+	odr = (im[k] + im[n]) >> 1;
+	odi = (re[n] - re[k]) >> 1;
+	xr = (evr + ((cos_table[k]*odr + sin_table[k]*odi) >> 15)) >> 1;
+	xi = (evi + ((cos_table[k]*odi - sin_table[k]*odr) >> 15)) >> 1;
+	xr = abs(xr);
+	xi = abs(xi);
+	return (((unsigned int)xr*xr) >> 1) + (((unsigned int)xi*xi) >> 1);
+}
+
+void spectrum_analyze(struct frame_descriptor *frd, struct spectrum_state *st)
+{
+	const short *samples;
+	unsigned int pos;
+	int n, c, i, k, x, peak;
+	unsigned long long squares, e;
+	float energy, level, flux;
+
+	n = FRD_AUDIO_NSAMPLES;
+	pos = frd->snd_end - n;
+
+	/* windowed mono sound, even samples in re and odd ones in im */
+	peak = 0;
+	squares = 0;
+	c = 0;
+	for(i=0;i<2*M;i++) {
+		if(i < n) {
+			if(c == 0)
+				c = snd_ring_get(frd->snd_ring, pos + i, n - i,
+				    &samples);
+			x = (samples[0] + samples[1]) >> 1;
+			samples += 2;
+			c--;
+			if(abs(x) > peak)
+				peak = abs(x);
+			squares += x*x;
+			x = (x*window[i]) >> 15;
+		} else
+			x = 0;
+		if(i & 1)
+			im[i >> 1] = x;
+		else
+			re[i >> 1] = x;
+	}
+	frd->peak = peak/32768.0f;
+	frd->rms = n > 0 ? sqrtf((float)squares/n)/32768.0f : 0.0f;
+
+	fft();
+
+	flux = 0.0f;
+	for(i=0;i<st->nbands;i++) {
+		e = 0;
+		for(k=st->lo[i];k<st->hi[i];k++)
+			e += power(k);
+		energy = e;
+		if(st->avg[i] == 0.0f)
+			st->avg[i] = energy;
+		level = energy/(st->avg[i] > ENERGY_FLOOR ?
+		    st->avg[i] : ENERGY_FLOOR);
+		if(level > LEVEL_MAX)
+			level = LEVEL_MAX;
+		st->avg[i] = st->keep*st->avg[i] + (1.0f - st->keep)*energy;
+		if(level > st->last[i])
+			flux += level - st->last[i];
+		st->last[i] = level;
+		frd->band[i] = level;
+	}
+	for(;i<BAND_COUNT;i++)
+		frd->band[i] = 0.0f;
+
+	flux /= st->nbands;
+	frd->onset = 0.0f;
+	if(st->holdoff > 0)
+		st->holdoff--;
+	else if((flux > ONSET_RATIO*st->flux_avg) && (flux > ONSET_MIN)) {
+		frd->onset = 1.0f;
+		st->holdoff = st->holdoff_frames;
+	}
+	st->flux_avg = st->flux_keep*st->flux_avg
+	    + (1.0f - st->flux_keep)*flux;
+}
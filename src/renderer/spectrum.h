@@ -0,0 +1,64 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SPECTRUM_H
+#define __SPECTRUM_H
+
+#include "framedescriptor.h"
+
+/*
+ * Spectrum analysis of the sound of a frame, with one fixed-point real FFT
+ * of SPECTRUM_N points over its Hann-windowed sound.
+ *
+ * The spectrum is split into 1 to BAND_COUNT bands, spaced logarithmically
+ * between SPECTRUM_FMIN and SPECTRUM_FMAX. Like bass, mid and treb, the
+ * level of each band is its energy relative to its own average over the
+ * last few seconds, so it hovers around 1 whatever the volume and the
+ * balance of the music, up to 10. Bands above the configured count read 0.
+ *
+ * peak and rms are the levels of the sound itself, from 0 to 1. onset is 1
+ * on frames where the levels of the bands rise sharply (spectral flux well
+ * above its recent average), at most once every SPECTRUM_ONSET_HOLDOFF
+ * seconds, and 0 otherwise.
+ *
+ * spectrum_analyze uses static buffers and must only be called from one
+ * task.
+ */
+
+#define SPECTRUM_N		(2048)
+#define SPECTRUM_BANDS_DEFAULT	(16)
+#define SPECTRUM_FMIN		(40.0f)
+#define SPECTRUM_FMAX		(16000.0f)
+#define SPECTRUM_ONSET_HOLDOFF	(0.1f)
+
+struct spectrum_state {
+	int nbands;
+	int lo[BAND_COUNT];	/* first FFT bin of each band */
+	int hi[BAND_COUNT];	/* bin after the last one */
+	float keep;		/* weight of the previous averages */
+	float avg[BAND_COUNT];	/* average band energies */
+	float last[BAND_COUNT];	/* band levels of the previous frame */
+	float flux_keep;
+	float flux_avg;
+	int holdoff;		/* frames before the next onset */
+	int holdoff_frames;
+};
+
+void spectrum_init(struct spectrum_state *st, int nbands, int fps);
+void spectrum_analyze(struct frame_descriptor *frd, struct spectrum_state *st);
+
+#endif /* __SPECTRUM_H */
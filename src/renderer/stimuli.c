@@ -234,9 +234,14 @@ void stim_redirect(struct stimuli *s, void *new)
 /* ----- Input device database --------------------------------------------- */
 
 
-static struct stim_db_midi *db = NULL, **last = &db;
+void stim_db_init(struct stim_db *db)
+{
+	db->midi = NULL;
+	db->last = &db->midi;
+}
+
 
-struct stim_db_midi *stim_db_midi(const char *selector)
+struct stim_db_midi *stim_db_midi(struct stim_db *db, const char *selector)
 {
 	struct stim_db_midi *dev;
 
@@ -246,8 +251,8 @@ struct stim_db_midi *stim_db_midi(const char *selector)
 	dev->selector = selector;
 	dev->ctrls = NULL;
 	dev->next = NULL;
-	*last = dev;
-	last = &dev->next;
+	*db->last = dev;
+	db->last = &dev->next;
 	return dev;
 }
 
@@ -281,18 +286,17 @@ static void free_db_midi_ctrls(struct stim_db_midi_ctrl *ctrls)
 	}
 }
 
-void stim_db_free(void)
+void stim_db_free(struct stim_db *db)
 {
-	struct stim_db_midi *next;
-
-	while(db) {
-		next = db->next;
-		free_db_midi_ctrls(db->ctrls);
-		free((void *) db->selector);
-		free(db);
-		db = next;
+	struct stim_db_midi *dev, *next;
+
+	for(dev = db->midi; dev; dev = next) {
+		next = dev->next;
+		free_db_midi_ctrls(dev->ctrls);
+		free((void *) dev->selector);
+		free(dev);
 	}
-	last = &db;
+	stim_db_init(db);
 }
 
 
@@ -341,15 +345,53 @@ static struct stim_regs *do_bind(struct stimuli *s,
 	return stim_add_midi_ctrl(s, ctrl->chan, ctrl->ctrl, proc);
 }
 
-struct stim_regs *stim_bind(struct stimuli *s, const void *handle,
-    enum stim_midi_fn_type fn)
+struct stim_regs *stim_bind(const struct stim_db *db, struct stimuli *s,
+    const void *handle, enum stim_midi_fn_type fn)
 {
 	const struct stim_db_midi *dev;
 	const struct stim_db_midi_ctrl *ctrl;
 
-	for(dev = db; dev; dev = dev->next)
+	for(dev = db->midi; dev; dev = dev->next)
 		for(ctrl = dev->ctrls; ctrl; ctrl = ctrl->next)
 			if(ctrl->handle == handle)
 				return do_bind(s, ctrl, fn);
 	return NULL;
 }
+
+
+/* ----- Saving and restoring bindings ------------------------------------- */
+
+
+/* only add at the end, the index is the processor number */
+
+static void (*procs[])(struct s_midi_ctrl *sct, int value) = {
+	midi_proc_linear,
+	midi_proc_diff_cyclic,
+	midi_proc_diff_unbounded,
+	midi_proc_diff_linear,
+	midi_proc_range_button,
+	midi_proc_diff_button,
+	midi_proc_button_switch,
+};
+
+#define	N_PROCS	((int) (sizeof(procs)/sizeof(*procs)))
+
+
+int stim_proc_id(const struct s_midi_ctrl *ct)
+{
+	int i;
+
+	for(i = 0; i != N_PROCS; i++)
+		if(ct->proc == procs[i])
+			return i;
+	return -1;
+}
+
+
+struct stim_regs *stim_restore(struct stimuli *s, int chan, int ctrl,
+    int proc)
+{
+	if(proc < 0 || proc >= N_PROCS)
+		return NULL;
+	return stim_add_midi_ctrl(s, chan, ctrl, procs[proc]);
+}
@@ -70,6 +70,13 @@ struct stim_db_midi {
 	struct stim_db_midi *next;
 };
 
+/* input devices declared by the patch being parsed */
+
+struct stim_db {
+	struct stim_db_midi *midi;
+	struct stim_db_midi **last;
+};
+
 /*
  * Channel numbers are one-based. Channel 0 acts as a catch-all when used with
  * stim_add_midi_ctrl.
@@ -81,11 +88,21 @@ struct stimuli *stim_get(struct stimuli *s);
 void stim_put(struct stimuli *s);
 void stim_redirect(struct stimuli *s, void *new);
 
-struct stim_db_midi *stim_db_midi(const char *selector);
+void stim_db_init(struct stim_db *db);
+struct stim_db_midi *stim_db_midi(struct stim_db *db, const char *selector);
 int stim_db_midi_ctrl(struct stim_db_midi *dev, const void *handle,
     enum stim_midi_dev_type type, int chan, int ctrl);
-void stim_db_free(void);
-struct stim_regs *stim_bind(struct stimuli *s, const void *handle,
-    enum stim_midi_fn_type fn);
+void stim_db_free(struct stim_db *db);
+struct stim_regs *stim_bind(const struct stim_db *db, struct stimuli *s,
+    const void *handle, enum stim_midi_fn_type fn);
+
+/*
+ * Processor numbers are stable (they are stored in the patch cache). A
+ * binding saved with stim_proc_id can be restored with stim_restore.
+ */
+
+int stim_proc_id(const struct s_midi_ctrl *ct);
+struct stim_regs *stim_restore(struct stimuli *s, int chan, int ctrl,
+    int proc);
 
 #endif /* STIMULI_H */
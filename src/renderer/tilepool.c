@@ -0,0 +1,209 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "softpfpu.h"
+#include "vpfpu.h"
+#include "tilepool.h"
+
+/* tiles initially given to one worker, on its own cache line */
+struct tile_share {
+	int next;
+	int end;
+} __attribute__((aligned(64)));
+
+struct tile_worker {
+	struct tile_pool *pool;
+	int index;
+	pthread_t thread;
+};
+
+struct tile_pool {
+	int nthreads;
+	int tile_rows;
+	struct tile_worker workers[TILE_POOL_MAX_THREADS];
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned int generation;	/* bumped for each new mesh */
+	int running;			/* helper threads still working */
+	bool quit;
+
+	/* current mesh */
+	const struct vpfpu_prog *vp;
+	const float *registers;
+	struct tmu_vertex *output;
+	unsigned int hmeshlast;
+	unsigned int vmeshlast;
+	struct tile_share share[TILE_POOL_MAX_THREADS];
+};
+
+static void work(struct tile_pool *pool, int index)
+{
+	struct tile_share *share;
+	unsigned int first, last;
+	int i, tile;
+
+	for(i=0;i<pool->nthreads;i++) {
+		/* our own share first, then steal from the others */
+		share = &pool->share[(index + i) % pool->nthreads];
+		while((tile = __sync_fetch_and_add(&share->next, 1)) < share->end) {
+			first = tile*pool->tile_rows;
+			last = first + pool->tile_rows - 1;
+			if(last > pool->vmeshlast)
+				last = pool->vmeshlast;
+			vpfpu_execute_rows(pool->vp, pool->registers, pool->output,
+				pool->hmeshlast, first, last);
+		}
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct tile_worker *w = arg;
+	struct tile_pool *pool = w->pool;
+	unsigned int seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while(1) {
+		while(!pool->quit && (pool->generation == seen))
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if(pool->quit)
+			break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		work(pool, w->index);
+
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->running == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static int online_cpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n > 0)
+		return n;
+#endif
+	return 1;
+}
+
+struct tile_pool *tile_pool_new(int nthreads, int tile_rows)
+{
+	struct tile_pool *pool;
+	int i;
+
+	if(nthreads <= 0)
+		nthreads = online_cpus();
+	if(nthreads > TILE_POOL_MAX_THREADS)
+		nthreads = TILE_POOL_MAX_THREADS;
+	if(tile_rows < 1)
+		tile_rows = 1;
+
+	pool = calloc(1, sizeof(struct tile_pool));
+	if(pool == NULL)
+		return NULL;
+	pool->nthreads = nthreads;
+	pool->tile_rows = tile_rows;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	/* build the SIN/COS table before any worker needs it */
+	softpfpu_init();
+
+	for(i=0;i<nthreads;i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+	}
+	for(i=1;i<nthreads;i++) {
+		if(pthread_create(&pool->workers[i].thread, NULL,
+		    worker_thread, &pool->workers[i]) != 0) {
+			/* run with the threads we got */
+			pool->nthreads = i;
+			break;
+		}
+	}
+	return pool;
+}
+
+void tile_pool_run(struct tile_pool *pool, const struct vpfpu_prog *vp,
+    const float *registers, struct tmu_vertex *output,
+    unsigned int hmeshlast, unsigned int vmeshlast)
+{
+	int ntiles;
+	int i;
+
+	ntiles = (vmeshlast + pool->tile_rows)/pool->tile_rows;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->vp = vp;
+	pool->registers = registers;
+	pool->output = output;
+	pool->hmeshlast = hmeshlast;
+	pool->vmeshlast = vmeshlast;
+	for(i=0;i<pool->nthreads;i++) {
+		pool->share[i].next = ntiles*i/pool->nthreads;
+		pool->share[i].end = ntiles*(i+1)/pool->nthreads;
+	}
+	pool->running = pool->nthreads-1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while(pool->running)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int tile_pool_threads(const struct tile_pool *pool)
+{
+	return pool->nthreads;
+}
+
+void tile_pool_free(struct tile_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for(i=1;i<pool->nthreads;i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
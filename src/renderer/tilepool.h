@@ -0,0 +1,48 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TILEPOOL_H
+#define __TILEPOOL_H
+
+#include "vpfpu.h"
+
+/*
+ * Multi-threaded per-vertex evaluation.
+ *
+ * The mesh is cut into tiles of tile_rows rows. Each worker starts with
+ * an equal, contiguous share of the tiles and, once done with it, steals
+ * the remaining tiles of the other workers. Tiles are claimed with an
+ * atomic increment, so there is no lock on the work path, and every
+ * worker evaluates from its own copy of the register file.
+ *
+ * The thread calling tile_pool_run is worker 0, so a pool of one thread
+ * does not create any.
+ */
+
+#define TILE_POOL_MAX_THREADS	32
+
+struct tile_pool;
+
+/* nthreads = 0 uses one thread per online CPU */
+struct tile_pool *tile_pool_new(int nthreads, int tile_rows);
+void tile_pool_run(struct tile_pool *pool, const struct vpfpu_prog *vp,
+    const float *registers, struct tmu_vertex *output,
+    unsigned int hmeshlast, unsigned int vmeshlast);
+int tile_pool_threads(const struct tile_pool *pool);
+void tile_pool_free(struct tile_pool *pool);
+
+#endif /* __TILEPOOL_H */
@@ -0,0 +1,318 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fpvm/fpvm.h>
+#include <fpvm/pfpu.h>
+
+#include "softpfpu.h"
+#include "vpfpu.h"
+#include "jit.h"
+
+/****************************************************************/
+/* LOWERING                                                     */
+/****************************************************************/
+
+static bool reads_reg(pfpu_instruction inst, int reg)
+{
+	switch(inst.i.opcode) {
+		case FPVM_OPCODE_NOP:
+			return false;
+		case FPVM_OPCODE_IF:
+			if(reg == SOFTPFPU_REG_IFB)
+				return true;
+			/* fall through */
+		default:
+			return inst.i.opa == reg || inst.i.opb == reg;
+	}
+}
+
+static void emit(struct vpfpu_prog *vp, int opcode, int opa, int opb,
+    int dest)
+{
+	struct vpfpu_op *op = vp->ops+vp->n_ops++;
+
+	op->opcode = opcode;
+	op->opa = opa;
+	op->opb = opb;
+	op->dest = dest;
+}
+
+void vpfpu_lower(struct vpfpu_prog *vp, const unsigned int *program,
+    int length)
+{
+	const pfpu_instruction *prog = (const pfpu_instruction *)program;
+	int exit[PFPU_PROGSIZE];	/* exit cycle, or -1 if none */
+	int issued[PFPU_PROGSIZE];	/* issue cycle of the result leaving */
+	bool direct[PFPU_PROGSIZE];	/* result written at issue */
+	int pc, c, dest, opcode;
+
+	for(pc=0;pc<length;pc++)
+		issued[pc] = -1;
+	for(pc=0;pc<length;pc++) {
+		opcode = prog[pc].i.opcode;
+		exit[pc] = -1;
+		if((opcode == FPVM_OPCODE_NOP) || (opcode == FPVM_OPCODE_VECTOUT))
+			continue;
+		c = pc + pfpu_get_latency(opcode);
+		/* results still in flight at the end are lost */
+		if(c >= length)
+			continue;
+		exit[pc] = c;
+		issued[c] = pc;
+	}
+
+	/*
+	 * A result can be written at issue if no instruction until (and
+	 * including) its exit cycle reads the old value of the destination,
+	 * and no other result lands there in the meantime.
+	 */
+	for(pc=0;pc<length;pc++) {
+		direct[pc] = false;
+		if(exit[pc] < 0)
+			continue;
+		dest = prog[exit[pc]].i.dest;
+		direct[pc] = true;
+		for(c=pc;c<=exit[pc];c++) {
+			if((c > pc) && reads_reg(prog[c], dest))
+				direct[pc] = false;
+			if((c < exit[pc]) && (issued[c] >= 0)
+			    && (prog[c].i.dest == dest))
+				direct[pc] = false;
+		}
+	}
+
+	vp->n_ops = 0;
+	vp->native = NULL;
+	for(pc=0;pc<length;pc++) {
+		opcode = prog[pc].i.opcode;
+		if(opcode == FPVM_OPCODE_VECTOUT)
+			emit(vp, opcode, prog[pc].i.opa, prog[pc].i.opb, 0);
+		else if(exit[pc] >= 0)
+			emit(vp, opcode, prog[pc].i.opa, prog[pc].i.opb,
+			    direct[pc] ? prog[exit[pc]].i.dest :
+			    PFPU_REG_COUNT + (exit[pc] % VPFPU_TEMPS));
+		if((issued[pc] >= 0) && !direct[issued[pc]])
+			emit(vp, FPVM_OPCODE_COPY,
+			    PFPU_REG_COUNT + (pc % VPFPU_TEMPS), 0,
+			    prog[pc].i.dest);
+	}
+}
+
+/****************************************************************/
+/* EXECUTION                                                    */
+/****************************************************************/
+
+typedef float vfloat __attribute__((vector_size(VPFPU_LANES*sizeof(float))));
+typedef int vint __attribute__((vector_size(VPFPU_LANES*sizeof(int))));
+typedef unsigned int vuint
+    __attribute__((vector_size(VPFPU_LANES*sizeof(unsigned int))));
+
+union vreg {
+	vfloat f;
+	vint i;
+	vuint u;
+	float lf[VPFPU_LANES];
+	int li[VPFPU_LANES];
+	unsigned int lu[VPFPU_LANES];
+};
+
+#define ONE_BITS	0x3f800000	/* 1.0f */
+
+static void run(const struct vpfpu_prog *vp, union vreg *regs,
+    struct tmu_vertex *output, const unsigned int *offsets, int valid)
+{
+	const struct vpfpu_op *op, *end = vp->ops+vp->n_ops;
+	union vreg a, b, r;
+	vint mask;
+	int l;
+
+	for(op=vp->ops;op!=end;op++) {
+		a = regs[op->opa];
+		b = regs[op->opb];
+		switch(op->opcode) {
+			case FPVM_OPCODE_FADD:
+				r.f = a.f + b.f;
+				break;
+			case FPVM_OPCODE_FSUB:
+				r.f = a.f - b.f;
+				break;
+			case FPVM_OPCODE_FMUL:
+				r.f = a.f * b.f;
+				break;
+			case FPVM_OPCODE_FABS:
+				r.u = a.u & 0x7fffffff;
+				break;
+			case FPVM_OPCODE_F2I:
+				for(l=0;l<VPFPU_LANES;l++)
+					r.li[l] = (int)a.lf[l];
+				break;
+			case FPVM_OPCODE_I2F:
+				for(l=0;l<VPFPU_LANES;l++)
+					r.lf[l] = a.li[l];
+				break;
+			case FPVM_OPCODE_SIN:
+				for(l=0;l<VPFPU_LANES;l++)
+					r.lf[l] = softpfpu_sin_table[a.lu[l]
+					    & (SOFTPFPU_TRIG_STEPS-1)];
+				break;
+			case FPVM_OPCODE_COS:
+				for(l=0;l<VPFPU_LANES;l++)
+					r.lf[l] = softpfpu_sin_table[(a.lu[l]
+					    + SOFTPFPU_TRIG_STEPS/4)
+					    & (SOFTPFPU_TRIG_STEPS-1)];
+				break;
+			case FPVM_OPCODE_ABOVE:
+				mask = a.f > b.f;
+				r.i = mask & ONE_BITS;
+				break;
+			case FPVM_OPCODE_EQUAL:
+				mask = a.f == b.f;
+				r.i = mask & ONE_BITS;
+				break;
+			case FPVM_OPCODE_COPY:
+				r = a;
+				break;
+			case FPVM_OPCODE_IF:
+				mask = regs[SOFTPFPU_REG_IFB].i != 0;
+				r.i = (a.i & mask) | (b.i & ~mask);
+				break;
+			case FPVM_OPCODE_TSIGN:
+				r.u = (a.u & 0x7fffffff) | (b.u & 0x80000000);
+				break;
+			case FPVM_OPCODE_QUAKE:
+				r.u = 0x5f3759df - (a.u >> 1);
+				break;
+			case FPVM_OPCODE_VECTOUT:
+				for(l=0;l<valid;l++) {
+					output[offsets[l]].x = a.li[l];
+					output[offsets[l]].y = b.li[l];
+				}
+				continue;
+			default:
+				r.u = a.u ^ a.u;
+				break;
+		}
+		regs[op->dest] = r;
+	}
+}
+
+static void scatter(const union vreg *out, struct tmu_vertex *output,
+    const unsigned int *offsets, int valid)
+{
+	int l;
+
+	for(l=0;l<valid;l++) {
+		output[offsets[l]].x = out[0].li[l];
+		output[offsets[l]].y = out[1].li[l];
+	}
+}
+
+void vpfpu_execute_rows(const struct vpfpu_prog *vp, const float *registers,
+    struct tmu_vertex *output, unsigned int hmeshlast,
+    unsigned int first_row, unsigned int last_row)
+{
+	union vreg regs[VPFPU_REG_COUNT] __attribute__((aligned(64)));
+	union vreg out[2] __attribute__((aligned(64)));
+	unsigned int offsets[VPFPU_LANES];
+	unsigned int x, y;
+	int i, l;
+
+	softpfpu_init();
+	for(i=0;i<PFPU_REG_COUNT;i++)
+		for(l=0;l<VPFPU_LANES;l++)
+			regs[i].lf[l] = registers[i];
+
+	x = 0;
+	y = first_row;
+	while(y <= last_row) {
+		for(l=0;(l<VPFPU_LANES) && (y <= last_row);l++) {
+			regs[SOFTPFPU_REG_X].lu[l] = x;
+			regs[SOFTPFPU_REG_Y].lu[l] = y;
+			offsets[l] = y*TMU_MESH_MAXSIZE + x;
+			if(++x > hmeshlast) {
+				x = 0;
+				y++;
+			}
+		}
+		if(vp->native) {
+			if(jit_run(vp->native, regs, out))
+				scatter(out, output, offsets, l);
+		} else
+			run(vp, regs, output, offsets, l);
+	}
+}
+
+void vpfpu_execute(const struct vpfpu_prog *vp, const float *registers,
+    struct tmu_vertex *output, unsigned int hmeshlast, unsigned int vmeshlast)
+{
+	vpfpu_execute_rows(vp, registers, output, hmeshlast, 0, vmeshlast);
+}
+
+void vpfpu_execute_frame(const struct vpfpu_prog *vp, float *registers)
+{
+	union vreg regs[VPFPU_REG_COUNT] __attribute__((aligned(64)));
+	union vreg out[2] __attribute__((aligned(64)));
+	struct tmu_vertex dummy;
+	unsigned int offsets[VPFPU_LANES];
+	int i, l;
+
+	softpfpu_init();
+	for(i=0;i<PFPU_REG_COUNT;i++)
+		for(l=0;l<VPFPU_LANES;l++)
+			regs[i].lf[l] = registers[i];
+	for(l=0;l<VPFPU_LANES;l++) {
+		regs[SOFTPFPU_REG_X].lu[l] = 0;
+		regs[SOFTPFPU_REG_Y].lu[l] = 0;
+		offsets[l] = 0;
+	}
+	if(vp->native)
+		jit_run(vp->native, regs, out);
+	else
+		run(vp, regs, &dummy, offsets, 1);
+	for(i=0;i<PFPU_REG_COUNT;i++)
+		registers[i] = regs[i].lf[0];
+}
+
+/****************************************************************/
+/* ALLOCATION                                                   */
+/****************************************************************/
+
+struct vpfpu_prog *vpfpu_new(const unsigned int *program, int length,
+    bool native)
+{
+	struct vpfpu_prog *vp;
+
+	vp = malloc(sizeof(struct vpfpu_prog));
+	if(vp == NULL)
+		return NULL;
+	vpfpu_lower(vp, program, length);
+	if(native)
+		vp->native = jit_compile(vp);
+	return vp;
+}
+
+void vpfpu_free(struct vpfpu_prog *vp)
+{
+	if(vp == NULL)
+		return;
+	jit_free(vp->native);
+	free(vp);
+}
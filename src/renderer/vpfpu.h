@@ -0,0 +1,84 @@
+/*
+ * Flickernoise
+ * Copyright (C) 2012 Sebastien Bourdeauducq
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VPFPU_H
+#define __VPFPU_H
+
+#include <stdbool.h>
+
+#include "softpfpu.h"
+
+/*
+ * Vectorized per-vertex evaluator.
+ *
+ * vpfpu_lower turns scheduled PFPU microcode back into straight-line code:
+ * each operation is issued in program order and, when nothing in between
+ * observes the destination register, writes it directly; otherwise its
+ * result is parked in one of VPFPU_TEMPS pipeline registers and copied to
+ * its destination at the cycle it would leave the PFPU pipeline. This
+ * gives the same register contents as softpfpu_execute, without any
+ * per-cycle bookkeeping.
+ *
+ * vpfpu_execute then runs the lowered program over VPFPU_LANES vertices at
+ * a time using GCC vector extensions, which the compiler maps to SSE, AVX
+ * or NEON depending on the target flags. Results are written in tmu_vertex
+ * layout, with a row pitch of TMU_MESH_MAXSIZE. vpfpu_execute_rows only
+ * evaluates the given range of mesh rows and keeps its register file on
+ * the stack, so several threads can work on the same mesh at once.
+ *
+ * Programs made with vpfpu_new can also carry native code for the host
+ * (see jit.h), which is then used instead of the interpreter. They must be
+ * released with vpfpu_free. vpfpu_execute_frame runs a per-frame program
+ * and writes the final register file back.
+ */
+
+#ifndef VPFPU_LANES
+#define VPFPU_LANES	8
+#endif
+
+#define VPFPU_TEMPS	16
+#define VPFPU_REG_COUNT	(PFPU_REG_COUNT+VPFPU_TEMPS)
+#define VPFPU_MAXOPS	(2*PFPU_PROGSIZE)
+
+struct vpfpu_op {
+	unsigned char opcode;
+	unsigned char opa;
+	unsigned char opb;
+	unsigned char dest;
+};
+
+struct jit_code;
+
+struct vpfpu_prog {
+	int n_ops;
+	struct vpfpu_op ops[VPFPU_MAXOPS];
+	struct jit_code *native;	/* NULL to interpret */
+};
+
+void vpfpu_lower(struct vpfpu_prog *vp, const unsigned int *program,
+    int length);
+struct vpfpu_prog *vpfpu_new(const unsigned int *program, int length,
+    bool native);
+void vpfpu_free(struct vpfpu_prog *vp);
+void vpfpu_execute_frame(const struct vpfpu_prog *vp, float *registers);
+void vpfpu_execute_rows(const struct vpfpu_prog *vp, const float *registers,
+    struct tmu_vertex *output, unsigned int hmeshlast,
+    unsigned int first_row, unsigned int last_row);
+void vpfpu_execute(const struct vpfpu_prog *vp, const float *registers,
+    struct tmu_vertex *output, unsigned int hmeshlast, unsigned int vmeshlast);
+
+#endif /* __VPFPU_H */
@@ -37,6 +37,7 @@
 #include "shellext.h"
 #include "fbgrab.h"
 #include "usbfirmware.h"
+#include "renderer/framestats.h"
 
 #ifndef PFPU_SPREG_COUNT
 #define	PFPU_SPREG_COUNT 2
@@ -355,16 +356,43 @@ static int main_usb(int argc, char **argv)
 }
 
 
+/* ----- framestats -------------------------------------------------------- */
+
+
+static int main_framestats(int argc, char **argv)
+{
+	if(argc == 1) {
+		framestats_print();
+		return 0;
+	}
+	if(argc == 2 && !strcmp(argv[1], "reset")) {
+		framestats_reset();
+		return 0;
+	}
+	fprintf(stderr, "usage: framestats [reset]\n");
+	return 1;
+}
+
+
 /* ----- Command definitions ----------------------------------------------- */
 
 
+static rtems_shell_cmd_t shellext_framestats = {
+	"framestats",			/* name */
+	"framestats [reset]",		/* usage */
+	"flickernoise",			/* topic */
+	main_framestats,		/* command */
+	NULL,				/* alias */
+	NULL				/* next */
+};
+
 static rtems_shell_cmd_t shellext_viwrite = {
 	"viwrite",			/* name */
 	"viwrite register value",	/* usage */
 	"flickernoise",			/* topic */
 	main_viwrite,			/* command */
 	NULL,				/* alias */
-	NULL				/* next */
+	&shellext_framestats		/* next */
 };
 
 static rtems_shell_cmd_t shellext_viread = {